@@ -0,0 +1,121 @@
+#ifndef ATTENTION
+#define ATTENTION
+#include <algorithm>
+#include <cmath>
+#include <concepts>
+#include <limits>
+#include <optional>
+#include <vector>
+#include "mat.cpp"
+#include "gemm.cpp"
+#include "parallel.cpp"
+
+namespace lawcat
+{
+   // softmax(scale * Q K^T) V without materialising the n x m score matrix.
+   //
+   // Queries are split into blocks of gemm_tile_m rows which run in parallel.
+   // For each block, the tiled A * B^T kernel streams K in blocks of gemm_tile_n
+   // rows and the epilogue folds each score tile into a running row maximum,
+   // running denominator and unnormalised output (online softmax), so V is read
+   // one block at a time as well. With causal set, the queries are the last n
+   // of the m positions covered by the keys (cached keys come first), so query
+   // i attends to keys 0..i + m - n; key blocks past that are never computed.
+   // Without a scale, the usual 1 / sqrt(d) is used. Shapes are checked per
+   // Policy.
+   template <typename Policy = default_policy, std::floating_point T>
+      policy_result<Policy, mat<T>> attention(const mat<T>& q, const mat<T>& k, const mat<T>& v, const bool& causal = false, const std::optional<T>& scale = std::nullopt)
+      {
+         if constexpr ( Policy::checked )
+         {
+            if ( q.get_n_cols() != k.get_n_cols() )
+               return Policy::template failure<mat<T>>({ mat_errc::attention_width_mismatch, { q.get_n_cols(), k.get_n_cols() } });
+            if ( k.get_n_rows() != v.get_n_rows() )
+               return Policy::template failure<mat<T>>({ mat_errc::attention_length_mismatch, { k.get_n_rows(), v.get_n_rows() } });
+            if ( causal && k.get_n_rows() < q.get_n_rows() )
+               return Policy::template failure<mat<T>>({ mat_errc::causal_length_mismatch, { k.get_n_rows(), q.get_n_rows() } });
+         }
+
+         const size_t n = q.get_n_rows();
+         const size_t m = k.get_n_rows();
+         const size_t d = q.get_n_cols();
+         const size_t dv = v.get_n_cols();
+         const T s = scale ? *scale : T(1) / std::sqrt(T(std::max<size_t>(d, 1)));
+         // Keys before the first query's own position, visible to every query.
+         const size_t offset = causal ? m - n : 0;
+         const T neg_inf = -std::numeric_limits<T>::infinity();
+
+         mat<T> out(n, dv);
+         out.fill(T(0));
+
+         const size_t n_blocks = (n + gemm_tile_m - 1) / gemm_tile_m;
+         parallel_for(0, n_blocks, [&](size_t block_lo, size_t block_hi) {
+            std::vector<T> row_max(gemm_tile_m);
+            std::vector<T> row_sum(gemm_tile_m);
+            std::vector<T> p(gemm_tile_n);
+
+            for ( size_t block = block_lo; block < block_hi; ++block )
+            {
+               const size_t q0 = block * gemm_tile_m;
+               const size_t qb = std::min(gemm_tile_m, n - q0);
+               const size_t keys = causal ? std::min(m, q0 + qb + offset) : m;
+               std::fill(row_max.begin(), row_max.end(), neg_inf);
+               std::fill(row_sum.begin(), row_sum.end(), T(0));
+
+               gemm_nt_tiles(q.rows() + q0, qb, k.rows(), keys, d,
+                  [&](size_t i0, size_t j0, size_t mb, size_t nb, const T* tile, size_t ld) {
+                     for ( size_t i = i0; i < i0 + mb; ++i )
+                     {
+                        const size_t qi = q0 + i;
+                        const size_t last = qi + offset + 1;
+                        const size_t valid = causal ? std::min(nb, last > j0 ? last - j0 : 0) : nb;
+                        if ( valid == 0 )
+                           continue;
+
+                        const T* scores = tile + (i - i0) * ld;
+                        T tile_max = neg_inf;
+                        for ( size_t j = 0; j < valid; ++j )
+                           tile_max = std::max(tile_max, s * scores[j]);
+
+                        const T new_max = std::max(row_max[i], tile_max);
+                        const T correction = std::exp(row_max[i] - new_max);
+                        T tile_sum = T(0);
+                        for ( size_t j = 0; j < valid; ++j )
+                        {
+                           p[j] = std::exp(s * scores[j] - new_max);
+                           tile_sum += p[j];
+                        }
+
+                        T* o = out.row(qi);
+                        if ( correction != T(1) )
+                           for ( size_t c = 0; c < dv; ++c )
+                              o[c] *= correction;
+                        for ( size_t j = 0; j < valid; ++j )
+                        {
+                           const T* v_row = v.row(j0 + j);
+                           const T pj = p[j];
+                           for ( size_t c = 0; c < dv; ++c )
+                              o[c] += pj * v_row[c];
+                        }
+
+                        row_sum[i] = row_sum[i] * correction + tile_sum;
+                        row_max[i] = new_max;
+                     }
+                  });
+
+               for ( size_t i = 0; i < qb; ++i )
+               {
+                  if ( row_sum[i] == T(0) )
+                     continue;
+                  const T inv = T(1) / row_sum[i];
+                  T* o = out.row(q0 + i);
+                  for ( size_t c = 0; c < dv; ++c )
+                     o[c] *= inv;
+               }
+            }
+         });
+
+         return out;
+      }
+}
+#endif
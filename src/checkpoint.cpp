@@ -0,0 +1,277 @@
+#ifndef CHECKPOINT
+#define CHECKPOINT
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+#include "mat.cpp"
+#include "parallel.cpp"
+#include "codec.cpp"
+#include "io.cpp"
+#include "tracked.cpp"
+
+namespace lawcat
+{
+   namespace detail
+   {
+      inline constexpr std::array<uint32_t, 256> crc32c_table()
+      {
+         std::array<uint32_t, 256> table {};
+         for ( uint32_t i = 0; i < 256; ++i )
+         {
+            uint32_t c = i;
+            for ( size_t k = 0; k < 8; ++k )
+               c = (c & 1) ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+            table[i] = c;
+         }
+         return table;
+      }
+
+      inline constexpr std::array<uint32_t, 256> crc32c_lookup = crc32c_table();
+   }
+
+   // CRC-32C (Castagnoli), using the SSE4.2 instruction when the build enables it.
+   inline uint32_t crc32c(const uint8_t* data, const size_t& n, const uint32_t& seed = 0)
+   {
+      uint32_t crc = ~seed;
+      size_t i = 0;
+#if defined(__SSE4_2__)
+      uint64_t crc64 = crc;
+      for ( ; i + 8 <= n; i += 8 )
+      {
+         uint64_t word;
+         std::memcpy(&word, data + i, 8);
+         crc64 = _mm_crc32_u64(crc64, word);
+      }
+      crc = uint32_t(crc64);
+#endif
+      for ( ; i < n; ++i )
+         crc = detail::crc32c_lookup[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+      return ~crc;
+   }
+
+   // Checkpoint file layout (little-endian):
+   //
+   //   "LAWCATD1"
+   //   u64 element size, rows, cols, block rows, base epoch, epoch, block count
+   //   per block: u64 block index, u64 chunk size, u64 CRC-32C of the chunk, chunk
+   //
+   // A full snapshot has base epoch 0 and every block. A delta holds the blocks
+   // changed after base epoch and can be applied on top of any state that
+   // ends at base epoch.
+   namespace detail
+   {
+      inline constexpr char checkpoint_magic[8] = { 'L', 'A', 'W', 'C', 'A', 'T', 'D', '1' };
+
+      struct checkpoint_block
+      {
+         uint64_t index;
+         std::vector<uint8_t> chunk;
+      };
+
+      struct checkpoint_file
+      {
+         uint64_t element_size;
+         uint64_t n_rows;
+         uint64_t n_cols;
+         uint64_t block_rows;
+         uint64_t base_epoch;
+         uint64_t epoch;
+         std::vector<checkpoint_block> blocks;
+      };
+
+      inline void write_checkpoint_file(const std::string& path, const checkpoint_file& f)
+      {
+         std::ofstream out(path, std::ios::binary | std::ios::trunc);
+         if ( !out )
+            io_fail("ERROR: Cannot open " + path + " for writing.");
+
+         out.write(checkpoint_magic, sizeof(checkpoint_magic));
+         for ( const uint64_t& v : { f.element_size, f.n_rows, f.n_cols, f.block_rows, f.base_epoch, f.epoch, uint64_t(f.blocks.size()) } )
+            io_put_u64(out, v);
+         for ( const checkpoint_block& b : f.blocks )
+         {
+            io_put_u64(out, b.index);
+            io_put_u64(out, b.chunk.size());
+            io_put_u64(out, crc32c(b.chunk.data(), b.chunk.size()));
+            out.write(reinterpret_cast<const char*>(b.chunk.data()), std::streamsize(b.chunk.size()));
+         }
+
+         if ( !out.flush() )
+            io_fail("ERROR: Failed writing " + path + ".");
+      }
+
+      inline checkpoint_file read_checkpoint_file(const std::string& path)
+      {
+         std::ifstream in(path, std::ios::binary);
+         if ( !in )
+            io_fail("ERROR: Cannot open " + path + " for reading.");
+
+         char magic[sizeof(checkpoint_magic)];
+         if ( !in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), checkpoint_magic) )
+            io_fail("ERROR: " + path + " is not a lawcat checkpoint.");
+
+         checkpoint_file f;
+         f.element_size = io_get_u64(in);
+         f.n_rows = io_get_u64(in);
+         f.n_cols = io_get_u64(in);
+         f.block_rows = io_get_u64(in);
+         f.base_epoch = io_get_u64(in);
+         f.epoch = io_get_u64(in);
+         const uint64_t n_blocks = io_get_u64(in);
+         const uint64_t max_blocks = f.block_rows == 0 ? 0 : (f.n_rows + f.block_rows - 1) / f.block_rows;
+         if ( f.block_rows == 0 || n_blocks > max_blocks )
+            io_fail("ERROR: Corrupt header in " + path + ".");
+
+         // n_rows is as untrusted as n_blocks, so the file size bounds both
+         // the block table and every chunk before they are allocated.
+         uint64_t remaining = io_remaining(in);
+         if ( n_blocks > remaining / 24 )
+            io_fail("ERROR: Corrupt header in " + path + ".");
+
+         f.blocks.resize(n_blocks);
+         for ( checkpoint_block& b : f.blocks )
+         {
+            b.index = io_get_u64(in);
+            const uint64_t size = io_get_u64(in);
+            const uint64_t crc = io_get_u64(in);
+            remaining -= 24;
+            if ( b.index >= max_blocks || size > remaining )
+               io_fail("ERROR: Corrupt block in " + path + ".");
+            remaining -= size;
+
+            b.chunk.resize(size);
+            if ( !in.read(reinterpret_cast<char*>(b.chunk.data()), std::streamsize(b.chunk.size())) )
+               io_fail("ERROR: Corrupt block in " + path + ".");
+            if ( crc32c(b.chunk.data(), b.chunk.size()) != crc )
+               io_fail("ERROR: Checksum mismatch in block " + std::to_string(b.index) + " of " + path + ".");
+         }
+         return f;
+      }
+   }
+
+   // Writes the blocks of m_a changed after epoch `since` and closes the
+   // current epoch. Returns the epoch to pass as `since` next time; since == 0
+   // writes a full snapshot.
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      uint64_t write_checkpoint(tracked_mat<T>& m_a, const std::string& path, const uint64_t& since = 0, const bool& compress = true)
+      {
+         const std::vector<size_t> dirty = m_a.dirty_blocks(since);
+         const size_t n_cols = m_a.get_n_cols();
+
+         detail::checkpoint_file f { sizeof(T), m_a.get_n_rows(), n_cols, m_a.get_block_rows(), since, 0, {} };
+         f.blocks.resize(dirty.size());
+         parallel_for(0, dirty.size(), [&](size_t lo, size_t hi) {
+            std::vector<T> buf;
+            for ( size_t k = lo; k < hi; ++k )
+            {
+               const auto [first, last] = m_a.block_range(dirty[k]);
+               buf.resize((last - first) * n_cols);
+               for ( size_t i = first; i < last; ++i )
+                  std::copy(m_a.value().row(i), m_a.value().row(i) + n_cols, buf.begin() + (i - first) * n_cols);
+               f.blocks[k] = { dirty[k], encode_chunk(buf.data(), buf.size(), compress ? codec_method::shuffle_lz : codec_method::stored) };
+            }
+         });
+
+         f.epoch = m_a.advance();
+         detail::write_checkpoint_file(path, f);
+         return f.epoch;
+      }
+
+   namespace detail
+   {
+      template <typename T>
+         void apply_checkpoint_file(mat<T>& m_a, const checkpoint_file& f, const std::string& path)
+         {
+            if ( f.element_size != sizeof(T) )
+               io_fail("ERROR: Element size in " + path + " does not match the requested type.");
+            if ( f.n_rows != m_a.get_n_rows() || f.n_cols != m_a.get_n_cols() )
+               default_policy::failure({ mat_errc::operator_apply_mismatch, { f.n_rows, f.n_cols, m_a.get_n_rows(), m_a.get_n_cols() }, "checkpoint" });
+
+            parallel_for(0, f.blocks.size(), [&](size_t lo, size_t hi) {
+               std::vector<T> buf;
+               for ( size_t k = lo; k < hi; ++k )
+               {
+                  const checkpoint_block& b = f.blocks[k];
+                  const size_t first = b.index * f.block_rows;
+                  const size_t last = std::min<size_t>(f.n_rows, first + f.block_rows);
+                  buf.resize((last - first) * f.n_cols);
+                  decode_chunk(b.chunk.data(), b.chunk.size(), buf.data(), buf.size());
+                  for ( size_t i = first; i < last; ++i )
+                     std::copy(buf.begin() + (i - first) * f.n_cols, buf.begin() + (i - first + 1) * f.n_cols, m_a.row(i));
+               }
+            });
+         }
+   }
+
+   // Applies one checkpoint on top of m_a. Returns the epoch it ends at.
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      uint64_t apply_checkpoint(mat<T>& m_a, const std::string& path)
+      {
+         const detail::checkpoint_file f = detail::read_checkpoint_file(path);
+         detail::apply_checkpoint_file(m_a, f, path);
+         return f.epoch;
+      }
+
+   // Rebuilds a matrix from a full snapshot followed by its deltas, in order.
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      mat<T> restore_checkpoint(const std::vector<std::string>& paths)
+      {
+         if ( paths.empty() )
+            default_policy::failure({ mat_errc::no_checkpoints, {}, "restore from" });
+
+         mat<T> out(0, 0);
+         uint64_t epoch = 0;
+         for ( size_t p = 0; p < paths.size(); ++p )
+         {
+            const detail::checkpoint_file f = detail::read_checkpoint_file(paths[p]);
+            if ( f.base_epoch != epoch )
+               detail::io_fail("ERROR: " + paths[p] + " does not follow epoch " + std::to_string(epoch) + ".");
+            if ( p == 0 )
+               out = mat<T>(f.n_rows, f.n_cols);
+            detail::apply_checkpoint_file(out, f, paths[p]);
+            epoch = f.epoch;
+         }
+         return out;
+      }
+
+   // Folds a chain of checkpoints into one covering the same epochs. Chunks
+   // are copied verbatim, later blocks replacing earlier ones.
+   inline void merge_checkpoints(const std::vector<std::string>& paths, const std::string& out_path)
+   {
+      if ( paths.empty() )
+         default_policy::failure({ mat_errc::no_checkpoints, {}, "merge" });
+
+      detail::checkpoint_file merged;
+      std::map<uint64_t, std::vector<uint8_t>> blocks;
+      for ( size_t p = 0; p < paths.size(); ++p )
+      {
+         detail::checkpoint_file f = detail::read_checkpoint_file(paths[p]);
+         if ( p == 0 )
+            merged = { f.element_size, f.n_rows, f.n_cols, f.block_rows, f.base_epoch, f.epoch, {} };
+         else if ( f.element_size != merged.element_size || f.n_rows != merged.n_rows || f.n_cols != merged.n_cols || f.block_rows != merged.block_rows )
+            detail::io_fail("ERROR: " + paths[p] + " belongs to a different matrix.");
+         else if ( f.base_epoch != merged.epoch )
+            detail::io_fail("ERROR: " + paths[p] + " does not follow epoch " + std::to_string(merged.epoch) + ".");
+
+         merged.epoch = f.epoch;
+         for ( detail::checkpoint_block& b : f.blocks )
+            blocks[b.index] = std::move(b.chunk);
+      }
+
+      for ( auto& [index, chunk] : blocks )
+         merged.blocks.push_back({ index, std::move(chunk) });
+      detail::write_checkpoint_file(out_path, merged);
+   }
+}
+#endif
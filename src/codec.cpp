@@ -0,0 +1,431 @@
+#ifndef CODEC
+#define CODEC
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+#include "mat.cpp"
+#include "parallel.cpp"
+
+namespace lawcat
+{
+   // Lossless codec for arrays of trivially copyable values, tuned for smooth
+   // floating-point data:
+   //
+   //   1. XOR delta: each value's bit pattern is XORed with its predecessor's.
+   //      Neighbouring values of a smooth field share sign, exponent and high
+   //      mantissa bits, which become zero.
+   //   2. Byte shuffle: byte k of every value is gathered into plane k, so the
+   //      zeroed high bytes form long runs.
+   //   3. LZ: a byte-oriented LZ77 with a 4-byte hash, 64 KiB window and
+   //      LZ4-style sequences (token, literals, 16-bit offset).
+   //
+   // Each call encodes one independent chunk, so chunks can be decoded on
+   // their own (per tile) and in parallel.
+   enum class codec_method : uint8_t
+   {
+      stored = 0,
+      shuffle_lz = 1
+   };
+
+   namespace detail
+   {
+      inline constexpr size_t lz_min_match = 4;
+      inline constexpr size_t lz_hash_bits = 14;
+      inline constexpr size_t lz_window = 65535;
+
+      inline uint32_t lz_read32(const uint8_t* p)
+      {
+         uint32_t v;
+         std::memcpy(&v, p, sizeof(v));
+         return v;
+      }
+
+      inline uint32_t lz_hash(const uint32_t& v)
+      {
+         return (v * 2654435761u) >> (32 - lz_hash_bits);
+      }
+
+      inline void lz_put_length(std::vector<uint8_t>& out, size_t len)
+      {
+         while ( len >= 255 )
+         {
+            out.push_back(255);
+            len -= 255;
+         }
+         out.push_back(uint8_t(len));
+      }
+
+      inline void lz_emit(std::vector<uint8_t>& out, const uint8_t* literals, const size_t& n_literals, const size_t& match_len, const size_t& offset)
+      {
+         const size_t ml = match_len == 0 ? 0 : match_len - lz_min_match;
+         out.push_back(uint8_t((std::min<size_t>(n_literals, 15) << 4) | std::min<size_t>(ml, 15)));
+         if ( n_literals >= 15 )
+            lz_put_length(out, n_literals - 15);
+         out.insert(out.end(), literals, literals + n_literals);
+         if ( match_len == 0 )
+            return;
+         out.push_back(uint8_t(offset));
+         out.push_back(uint8_t(offset >> 8));
+         if ( ml >= 15 )
+            lz_put_length(out, ml - 15);
+      }
+
+      inline std::vector<uint8_t> lz_compress(const uint8_t* in, const size_t& n)
+      {
+         std::vector<uint8_t> out;
+         out.reserve(n / 2 + 16);
+         std::vector<uint32_t> table(size_t(1) << lz_hash_bits, uint32_t(-1));
+
+         size_t anchor = 0;
+         size_t i = 0;
+         while ( i + lz_min_match <= n )
+         {
+            const uint32_t v = lz_read32(in + i);
+            const uint32_t h = lz_hash(v);
+            const uint32_t cand = table[h];
+            table[h] = uint32_t(i);
+
+            if ( cand != uint32_t(-1) && i - cand <= lz_window && lz_read32(in + cand) == v )
+            {
+               size_t len = lz_min_match;
+               while ( i + len < n && in[cand + len] == in[i + len] )
+                  ++len;
+
+               lz_emit(out, in + anchor, i - anchor, len, i - cand);
+               i += len;
+               anchor = i;
+               continue;
+            }
+            ++i;
+         }
+
+         lz_emit(out, in + anchor, n - anchor, 0, 0);
+         return out;
+      }
+
+      inline size_t lz_get_length(const uint8_t*& p, const uint8_t* end)
+      {
+         size_t len = 0;
+         uint8_t b;
+         do
+         {
+            if ( p >= end )
+               default_policy::failure({ mat_errc::corrupt_data });
+            b = *p++;
+            len += b;
+         }
+         while ( b == 255 );
+         return len;
+      }
+
+      inline void lz_decompress(const uint8_t* in, const size_t& n, uint8_t* out, const size_t& out_size)
+      {
+         const uint8_t* p = in;
+         const uint8_t* end = in + n;
+         size_t o = 0;
+
+         while ( p < end )
+         {
+            const uint8_t token = *p++;
+            size_t n_literals = token >> 4;
+            if ( n_literals == 15 )
+               n_literals += lz_get_length(p, end);
+            if ( size_t(end - p) < n_literals || out_size - o < n_literals )
+               default_policy::failure({ mat_errc::corrupt_data });
+            std::memcpy(out + o, p, n_literals);
+            p += n_literals;
+            o += n_literals;
+
+            if ( p == end )
+               break;
+
+            if ( end - p < 2 )
+               default_policy::failure({ mat_errc::corrupt_data });
+            const size_t offset = size_t(p[0]) | (size_t(p[1]) << 8);
+            p += 2;
+            size_t len = (token & 15);
+            if ( len == 15 )
+               len += lz_get_length(p, end);
+            len += lz_min_match;
+
+            if ( offset == 0 || offset > o || out_size - o < len )
+               default_policy::failure({ mat_errc::corrupt_data });
+            // Byte by byte: matches may overlap their own output.
+            for ( size_t k = 0; k < len; ++k, ++o )
+               out[o] = out[o - offset];
+         }
+
+         if ( o != out_size )
+            default_policy::failure({ mat_errc::corrupt_data });
+      }
+
+      template <size_t N>
+         using word_for = std::conditional_t<N == 1, uint8_t, std::conditional_t<N == 2, uint16_t, std::conditional_t<N == 4, uint32_t, uint64_t>>>;
+   }
+
+   // Encodes n values into a self-describing chunk:
+   // [method u8][raw size u64][payload]. Falls back to storing the raw bytes
+   // when compression does not pay.
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      std::vector<uint8_t> encode_chunk(const T* values, const size_t& n, const codec_method& method = codec_method::shuffle_lz)
+      {
+         constexpr size_t w = sizeof(T);
+         const size_t raw_size = n * w;
+         std::vector<uint8_t> bytes(raw_size);
+         std::memcpy(bytes.data(), values, raw_size);
+
+         std::vector<uint8_t> out(9);
+         for ( size_t b = 0; b < 8; ++b )
+            out[1 + b] = uint8_t(uint64_t(raw_size) >> (8 * b));
+         out[0] = uint8_t(codec_method::stored);
+         if ( method == codec_method::stored )
+         {
+            out.insert(out.end(), bytes.begin(), bytes.end());
+            return out;
+         }
+
+         std::vector<uint8_t> planes(raw_size);
+         if constexpr ( w == 1 || w == 2 || w == 4 || w == 8 )
+         {
+            using word = detail::word_for<w>;
+            word prev = 0;
+            for ( size_t i = 0; i < n; ++i )
+            {
+               word cur;
+               std::memcpy(&cur, bytes.data() + i * w, w);
+               const word d = word(cur ^ prev);
+               prev = cur;
+               for ( size_t b = 0; b < w; ++b )
+                  planes[b * n + i] = uint8_t(d >> (8 * b));
+            }
+         }
+         else
+            for ( size_t i = 0; i < n; ++i )
+               for ( size_t b = 0; b < w; ++b )
+                  planes[b * n + i] = bytes[i * w + b];
+
+         std::vector<uint8_t> packed = detail::lz_compress(planes.data(), raw_size);
+         if ( packed.size() < raw_size )
+         {
+            out[0] = uint8_t(codec_method::shuffle_lz);
+            out.insert(out.end(), packed.begin(), packed.end());
+         }
+         else
+            out.insert(out.end(), bytes.begin(), bytes.end());
+         return out;
+      }
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      void decode_chunk(const uint8_t* chunk, const size_t& chunk_size, T* values, const size_t& n)
+      {
+         constexpr size_t w = sizeof(T);
+         if ( chunk_size < 9 )
+            default_policy::failure({ mat_errc::corrupt_data });
+
+         uint64_t raw_size = 0;
+         for ( size_t b = 0; b < 8; ++b )
+            raw_size |= uint64_t(chunk[1 + b]) << (8 * b);
+         if ( raw_size != n * w )
+            default_policy::failure({ mat_errc::chunk_size_mismatch });
+
+         const uint8_t* payload = chunk + 9;
+         const size_t payload_size = chunk_size - 9;
+
+         if ( chunk[0] == uint8_t(codec_method::stored) )
+         {
+            if ( payload_size != raw_size )
+               default_policy::failure({ mat_errc::corrupt_data });
+            std::memcpy(values, payload, raw_size);
+            return;
+         }
+         if ( chunk[0] != uint8_t(codec_method::shuffle_lz) )
+            default_policy::failure({ mat_errc::unknown_codec });
+
+         std::vector<uint8_t> planes(raw_size);
+         detail::lz_decompress(payload, payload_size, planes.data(), raw_size);
+
+         std::vector<uint8_t> bytes(raw_size);
+         if constexpr ( w == 1 || w == 2 || w == 4 || w == 8 )
+         {
+            using word = detail::word_for<w>;
+            word prev = 0;
+            for ( size_t i = 0; i < n; ++i )
+            {
+               word d = 0;
+               for ( size_t b = 0; b < w; ++b )
+                  d |= word(word(planes[b * n + i]) << (8 * b));
+               prev = word(prev ^ d);
+               std::memcpy(bytes.data() + i * w, &prev, w);
+            }
+         }
+         else
+            for ( size_t i = 0; i < n; ++i )
+               for ( size_t b = 0; b < w; ++b )
+                  bytes[i * w + b] = planes[b * n + i];
+
+         std::memcpy(values, bytes.data(), raw_size);
+      }
+
+   // Matrix kept compressed in memory, one chunk per tile of tile_rows rows.
+   // Tiles are decoded on access; the most recently decoded tile is cached.
+   // Meant for cold data where memory matters more than access latency.
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      class compressed_mat
+      {
+         public:
+            static constexpr size_t default_tile_rows = 64;
+
+            explicit compressed_mat(const mat<T>& m_a, const size_t& tile_rows = default_tile_rows, const codec_method& method = codec_method::shuffle_lz);
+            compressed_mat(const size_t& n_rows, const size_t& n_cols, const size_t& tile_rows, std::vector<std::vector<uint8_t>> chunks);
+
+            // The tile cache is not carried over.
+            compressed_mat(compressed_mat<T>&& other) noexcept
+               : n_rows(other.n_rows), n_cols(other.n_cols), tile_rows(other.tile_rows), chunks(std::move(other.chunks)) {}
+
+            size_t get_n_rows() const { return this->n_rows; }
+            size_t get_n_cols() const { return this->n_cols; }
+            size_t get_tile_rows() const { return this->tile_rows; }
+            size_t get_n_tiles() const { return this->chunks.size(); }
+            const std::vector<uint8_t>& get_chunk(const size_t& tile) const { return this->chunks[tile]; }
+            size_t compressed_bytes() const;
+
+            // Indices are checked per Policy; corrupt chunks are reported
+            // through default_policy.
+            template <typename Policy = default_policy>
+               policy_result<Policy, T> get(const size_t& row, const size_t& col) const;
+
+            // Decodes tile t (rows [t * tile_rows, ...)) into a fresh matrix.
+            template <typename Policy = default_policy>
+               policy_result<Policy, mat<T>> tile(const size_t& t) const;
+            mat<T> to_mat() const;
+
+            // Calls fn(first_row, tile) for every tile in order, decoding one at a time.
+            template <typename F>
+               void for_each_tile(F&& fn) const
+               {
+                  for ( size_t t = 0; t < this->chunks.size(); ++t )
+                     fn(t * this->tile_rows, this->template tile<unchecked_policy>(t));
+               }
+
+         private:
+            size_t n_rows;
+            size_t n_cols;
+            size_t tile_rows;
+            std::vector<std::vector<uint8_t>> chunks;
+
+            mutable std::mutex cache_lock;
+            mutable size_t cached_tile = size_t(-1);
+            mutable std::vector<T> cache;
+      };
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      compressed_mat<T>::compressed_mat(const mat<T>& m_a, const size_t& tile_rows, const codec_method& method)
+         : n_rows(m_a.get_n_rows()), n_cols(m_a.get_n_cols()), tile_rows(tile_rows)
+      {
+         if ( tile_rows == 0 )
+            default_policy::failure({ mat_errc::nonpositive_size, {}, "Tile size" });
+
+         this->chunks.resize((this->n_rows + tile_rows - 1) / tile_rows);
+         parallel_for(0, this->chunks.size(), [&](size_t lo, size_t hi) {
+            std::vector<T> buf;
+            for ( size_t t = lo; t < hi; ++t )
+            {
+               const size_t r0 = t * tile_rows;
+               const size_t r1 = std::min(this->n_rows, r0 + tile_rows);
+               buf.resize((r1 - r0) * this->n_cols);
+               for ( size_t i = r0; i < r1; ++i )
+                  std::copy(m_a.row(i), m_a.row(i) + this->n_cols, buf.begin() + (i - r0) * this->n_cols);
+               this->chunks[t] = encode_chunk(buf.data(), buf.size(), method);
+            }
+         });
+      }
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      compressed_mat<T>::compressed_mat(const size_t& n_rows, const size_t& n_cols, const size_t& tile_rows, std::vector<std::vector<uint8_t>> chunks)
+         : n_rows(n_rows), n_cols(n_cols), tile_rows(tile_rows), chunks(std::move(chunks))
+      {
+         if ( tile_rows == 0 || this->chunks.size() != (n_rows + tile_rows - 1) / tile_rows )
+            default_policy::failure({ mat_errc::chunk_count_mismatch });
+      }
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      size_t compressed_mat<T>::compressed_bytes() const
+      {
+         size_t total = 0;
+         for ( const std::vector<uint8_t>& c : this->chunks )
+            total += c.size();
+         return total;
+      }
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      template <typename Policy>
+         policy_result<Policy, mat<T>> compressed_mat<T>::tile(const size_t& t) const
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( t >= this->chunks.size() )
+                  return Policy::template failure<mat<T>>({ mat_errc::tile_out_of_range });
+            }
+
+            const size_t r0 = t * this->tile_rows;
+            const size_t rows = std::min(this->n_rows, r0 + this->tile_rows) - r0;
+            std::vector<T> buf(rows * this->n_cols);
+            decode_chunk(this->chunks[t].data(), this->chunks[t].size(), buf.data(), buf.size());
+
+            mat<T> out(rows, this->n_cols);
+            for ( size_t i = 0; i < rows; ++i )
+               std::copy(buf.begin() + i * this->n_cols, buf.begin() + (i + 1) * this->n_cols, out.row(i));
+            return out;
+         }
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      template <typename Policy>
+         policy_result<Policy, T> compressed_mat<T>::get(const size_t& row, const size_t& col) const
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( row >= this->n_rows || col >= this->n_cols )
+                  return Policy::template failure<T>({ mat_errc::index_out_of_range });
+            }
+
+            const size_t t = row / this->tile_rows;
+            std::lock_guard<std::mutex> guard(this->cache_lock);
+            if ( t != this->cached_tile )
+            {
+               const size_t rows = std::min(this->n_rows, (t + 1) * this->tile_rows) - t * this->tile_rows;
+               this->cache.resize(rows * this->n_cols);
+               decode_chunk(this->chunks[t].data(), this->chunks[t].size(), this->cache.data(), this->cache.size());
+               this->cached_tile = t;
+            }
+            return this->cache[(row - t * this->tile_rows) * this->n_cols + col];
+         }
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      mat<T> compressed_mat<T>::to_mat() const
+      {
+         mat<T> out(this->n_rows, this->n_cols);
+         parallel_for(0, this->chunks.size(), [&](size_t lo, size_t hi) {
+            for ( size_t t = lo; t < hi; ++t )
+            {
+               const mat<T> part = this->template tile<unchecked_policy>(t);
+               for ( size_t i = 0; i < part.get_n_rows(); ++i )
+                  std::copy(part.row(i), part.row(i) + this->n_cols, out.row(t * this->tile_rows + i));
+            }
+         });
+         return out;
+      }
+}
+#endif
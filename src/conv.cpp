@@ -0,0 +1,308 @@
+#ifndef CONV
+#define CONV
+#include <algorithm>
+#include <array>
+#include <vector>
+#include "mat.cpp"
+#include "gemm.cpp"
+#include "parallel.cpp"
+
+namespace lawcat
+{
+   // Batches of images are stored one image per row of a mat<T>. Within a row
+   // the planes are laid out as CHW (nchw) or HWC (nhwc). Filters are stored one
+   // per row of a mat<T> as C x kernel_h x kernel_w, whatever the image layout.
+   enum class tensor_layout
+   {
+      nchw,
+      nhwc
+   };
+
+   enum class conv2d_algorithm
+   {
+      automatic,
+      im2col,
+      direct,
+      winograd
+   };
+
+   struct conv2d_desc
+   {
+      size_t channels;
+      size_t height;
+      size_t width;
+      size_t kernel_h;
+      size_t kernel_w;
+      size_t stride_h = 1;
+      size_t stride_w = 1;
+      size_t pad_h = 0;
+      size_t pad_w = 0;
+      size_t dilation_h = 1;
+      size_t dilation_w = 1;
+      tensor_layout layout = tensor_layout::nchw;
+
+      size_t out_height() const { return (height + 2 * pad_h - dilation_h * (kernel_h - 1) - 1) / stride_h + 1; }
+      size_t out_width() const { return (width + 2 * pad_w - dilation_w * (kernel_w - 1) - 1) / stride_w + 1; }
+   };
+
+   inline size_t plane_index(const tensor_layout& layout, const size_t& n_channels, const size_t& height, const size_t& width, const size_t& c, const size_t& y, const size_t& x)
+   {
+      if ( layout == tensor_layout::nchw )
+         return (c * height + y) * width + x;
+      return (y * width + x) * n_channels + c;
+   }
+
+   // Reads input pixel (c, y, x) of a padded image, where y and x are in padded
+   // coordinates. Pixels in the padding read as zero.
+   template <typename T>
+      T padded_pixel(const T* image, const conv2d_desc& desc, const size_t& c, const size_t& y, const size_t& x)
+      {
+         if ( y < desc.pad_h || x < desc.pad_w || y - desc.pad_h >= desc.height || x - desc.pad_w >= desc.width )
+            return T(0);
+         return image[plane_index(desc.layout, desc.channels, desc.height, desc.width, c, y - desc.pad_h, x - desc.pad_w)];
+      }
+
+   inline conv2d_algorithm choose_conv2d_algorithm(const conv2d_desc& desc, const size_t& n_filters)
+   {
+      const bool winograd_shape = desc.kernel_h == 3 && desc.kernel_w == 3
+         && desc.stride_h == 1 && desc.stride_w == 1
+         && desc.dilation_h == 1 && desc.dilation_w == 1;
+
+      if ( winograd_shape && desc.channels * n_filters >= 16 && desc.out_height() >= 4 && desc.out_width() >= 4 )
+         return conv2d_algorithm::winograd;
+      if ( desc.channels * desc.kernel_h * desc.kernel_w <= 16 || n_filters <= 2 )
+         return conv2d_algorithm::direct;
+      return conv2d_algorithm::im2col;
+   }
+
+   // One row per output pixel, holding the C x kernel_h x kernel_w patch it sees.
+   template <typename T>
+      mat<T> im2col(const T* image, const conv2d_desc& desc)
+      {
+         const size_t oh = desc.out_height();
+         const size_t ow = desc.out_width();
+         mat<T> cols(oh * ow, desc.channels * desc.kernel_h * desc.kernel_w);
+
+         parallel_for(0, oh, [&](size_t lo, size_t hi) {
+            for ( size_t oy = lo; oy < hi; ++oy )
+               for ( size_t ox = 0; ox < ow; ++ox )
+               {
+                  T* patch = cols.row(oy * ow + ox);
+                  for ( size_t c = 0; c < desc.channels; ++c )
+                     for ( size_t r = 0; r < desc.kernel_h; ++r )
+                        for ( size_t s = 0; s < desc.kernel_w; ++s )
+                           *patch++ = padded_pixel(image, desc, c, oy * desc.stride_h + r * desc.dilation_h, ox * desc.stride_w + s * desc.dilation_w);
+               }
+         });
+
+         return cols;
+      }
+
+   template <typename T>
+      void conv2d_im2col(const mat<T>& input, const mat<T>& filters, const conv2d_desc& desc, mat<T>& out)
+      {
+         const size_t n_pixels = desc.out_height() * desc.out_width();
+         const size_t n_filters = filters.get_n_rows();
+
+         for ( size_t b = 0; b < input.get_n_rows(); ++b )
+         {
+            const mat<T> cols = im2col(input.row(b), desc);
+            T* dst = out.row(b);
+
+            if ( desc.layout == tensor_layout::nchw )
+            {
+               const mat<T> prod = gemm_nt(filters, cols);
+               for ( size_t f = 0; f < n_filters; ++f )
+                  std::copy(prod.row(f), prod.row(f) + n_pixels, dst + f * n_pixels);
+            }
+            else
+            {
+               const mat<T> prod = gemm_nt(cols, filters);
+               for ( size_t p = 0; p < n_pixels; ++p )
+                  std::copy(prod.row(p), prod.row(p) + n_filters, dst + p * n_filters);
+            }
+         }
+      }
+
+   template <typename T>
+      void conv2d_direct(const mat<T>& input, const mat<T>& filters, const conv2d_desc& desc, mat<T>& out)
+      {
+         const size_t oh = desc.out_height();
+         const size_t ow = desc.out_width();
+         const size_t n_filters = filters.get_n_rows();
+
+         parallel_for(0, input.get_n_rows() * n_filters, [&](size_t lo, size_t hi) {
+            for ( size_t job = lo; job < hi; ++job )
+            {
+               const size_t b = job / n_filters;
+               const size_t f = job % n_filters;
+               const T* image = input.row(b);
+               const T* w = filters.row(f);
+               T* dst = out.row(b);
+
+               for ( size_t oy = 0; oy < oh; ++oy )
+                  for ( size_t ox = 0; ox < ow; ++ox )
+                  {
+                     T acc = T(0);
+                     const T* wp = w;
+                     for ( size_t c = 0; c < desc.channels; ++c )
+                        for ( size_t r = 0; r < desc.kernel_h; ++r )
+                           for ( size_t s = 0; s < desc.kernel_w; ++s )
+                              acc += *wp++ * padded_pixel(image, desc, c, oy * desc.stride_h + r * desc.dilation_h, ox * desc.stride_w + s * desc.dilation_w);
+                     dst[plane_index(desc.layout, n_filters, oh, ow, f, oy, ox)] = acc;
+                  }
+            }
+         });
+      }
+
+   // Winograd F(2x2, 3x3). Filters are transformed once to U = G g G^T and each
+   // 4x4 input tile to V = B^T d B. The 16 products M = U V then become 16
+   // independent (filters x channels) by (channels x tiles) GEMMs, and each
+   // output tile is A^T M A.
+   template <typename T>
+      void conv2d_winograd(const mat<T>& input, const mat<T>& filters, const conv2d_desc& desc, mat<T>& out)
+      {
+         const size_t oh = desc.out_height();
+         const size_t ow = desc.out_width();
+         const size_t n_filters = filters.get_n_rows();
+         const size_t n_channels = desc.channels;
+         const size_t tiles_y = (oh + 1) / 2;
+         const size_t tiles_x = (ow + 1) / 2;
+         const size_t n_tiles = tiles_y * tiles_x;
+
+         std::vector<mat<T>> u(16, mat<T>(n_filters, n_channels));
+         parallel_for(0, n_filters, [&](size_t lo, size_t hi) {
+            for ( size_t f = lo; f < hi; ++f )
+               for ( size_t c = 0; c < n_channels; ++c )
+               {
+                  const T* g = filters.row(f) + c * 9;
+                  T gg[4][3];
+                  for ( size_t s = 0; s < 3; ++s )
+                  {
+                     gg[0][s] = g[s];
+                     gg[1][s] = T(0.5) * (g[s] + g[3 + s] + g[6 + s]);
+                     gg[2][s] = T(0.5) * (g[s] - g[3 + s] + g[6 + s]);
+                     gg[3][s] = g[6 + s];
+                  }
+                  for ( size_t r = 0; r < 4; ++r )
+                  {
+                     u[r * 4 + 0].row(f)[c] = gg[r][0];
+                     u[r * 4 + 1].row(f)[c] = T(0.5) * (gg[r][0] + gg[r][1] + gg[r][2]);
+                     u[r * 4 + 2].row(f)[c] = T(0.5) * (gg[r][0] - gg[r][1] + gg[r][2]);
+                     u[r * 4 + 3].row(f)[c] = gg[r][2];
+                  }
+               }
+         });
+
+         std::vector<mat<T>> v(16, mat<T>(n_tiles, n_channels));
+         for ( size_t b = 0; b < input.get_n_rows(); ++b )
+         {
+            const T* image = input.row(b);
+            T* dst = out.row(b);
+
+            parallel_for(0, n_tiles, [&](size_t lo, size_t hi) {
+               for ( size_t t = lo; t < hi; ++t )
+               {
+                  const size_t y0 = (t / tiles_x) * 2;
+                  const size_t x0 = (t % tiles_x) * 2;
+                  for ( size_t c = 0; c < n_channels; ++c )
+                  {
+                     T d[4][4];
+                     for ( size_t r = 0; r < 4; ++r )
+                        for ( size_t s = 0; s < 4; ++s )
+                           d[r][s] = padded_pixel(image, desc, c, y0 + r, x0 + s);
+
+                     T bd[4][4];
+                     for ( size_t s = 0; s < 4; ++s )
+                     {
+                        bd[0][s] = d[0][s] - d[2][s];
+                        bd[1][s] = d[1][s] + d[2][s];
+                        bd[2][s] = d[2][s] - d[1][s];
+                        bd[3][s] = d[1][s] - d[3][s];
+                     }
+                     for ( size_t r = 0; r < 4; ++r )
+                     {
+                        v[r * 4 + 0].row(t)[c] = bd[r][0] - bd[r][2];
+                        v[r * 4 + 1].row(t)[c] = bd[r][1] + bd[r][2];
+                        v[r * 4 + 2].row(t)[c] = bd[r][2] - bd[r][1];
+                        v[r * 4 + 3].row(t)[c] = bd[r][1] - bd[r][3];
+                     }
+                  }
+               }
+            });
+
+            std::vector<mat<T>> m;
+            m.reserve(16);
+            for ( size_t xi = 0; xi < 16; ++xi )
+               m.push_back(gemm_nt(u[xi], v[xi]));
+
+            parallel_for(0, n_filters, [&](size_t lo, size_t hi) {
+               for ( size_t f = lo; f < hi; ++f )
+                  for ( size_t t = 0; t < n_tiles; ++t )
+                  {
+                     T am[2][4];
+                     for ( size_t s = 0; s < 4; ++s )
+                     {
+                        am[0][s] = m[s].row(f)[t] + m[4 + s].row(f)[t] + m[8 + s].row(f)[t];
+                        am[1][s] = m[4 + s].row(f)[t] - m[8 + s].row(f)[t] - m[12 + s].row(f)[t];
+                     }
+
+                     const size_t y0 = (t / tiles_x) * 2;
+                     const size_t x0 = (t % tiles_x) * 2;
+                     for ( size_t r = 0; r < 2 && y0 + r < oh; ++r )
+                     {
+                        const T y[2] = { am[r][0] + am[r][1] + am[r][2], am[r][1] - am[r][2] - am[r][3] };
+                        for ( size_t s = 0; s < 2 && x0 + s < ow; ++s )
+                           dst[plane_index(desc.layout, n_filters, oh, ow, f, y0 + r, x0 + s)] = y[s];
+                     }
+                  }
+            });
+         }
+      }
+
+   // Convolves every image (row) of input with every filter (row) of filters.
+   // The result has one row per image holding n_filters x out_height x
+   // out_width values in the same layout as the input. The descriptor is
+   // checked against the operands per Policy.
+   template <typename Policy = default_policy, typename T>
+      policy_result<Policy, mat<T>> conv2d(const mat<T>& input, const mat<T>& filters, const conv2d_desc& desc, conv2d_algorithm algorithm = conv2d_algorithm::automatic)
+      {
+         if constexpr ( Policy::checked )
+         {
+            if ( input.get_n_cols() != desc.channels * desc.height * desc.width )
+               return Policy::template failure<mat<T>>({ mat_errc::descriptor_mismatch, { input.get_n_cols(), desc.channels * desc.height * desc.width }, "Input" });
+            if ( filters.get_n_cols() != desc.channels * desc.kernel_h * desc.kernel_w )
+               return Policy::template failure<mat<T>>({ mat_errc::descriptor_mismatch, { filters.get_n_cols(), desc.channels * desc.kernel_h * desc.kernel_w }, "Filter" });
+            if ( desc.kernel_h == 0 || desc.kernel_w == 0 || desc.stride_h == 0 || desc.stride_w == 0 || desc.dilation_h == 0 || desc.dilation_w == 0 )
+               return Policy::template failure<mat<T>>({ mat_errc::nonpositive_size, {}, "Kernel size, stride and dilation" });
+            if ( desc.height + 2 * desc.pad_h < desc.dilation_h * (desc.kernel_h - 1) + 1 || desc.width + 2 * desc.pad_w < desc.dilation_w * (desc.kernel_w - 1) + 1 )
+               return Policy::template failure<mat<T>>({ mat_errc::kernel_too_large });
+         }
+
+         if ( algorithm == conv2d_algorithm::automatic )
+            algorithm = choose_conv2d_algorithm(desc, filters.get_n_rows());
+         if constexpr ( Policy::checked )
+         {
+            if ( algorithm == conv2d_algorithm::winograd && !(desc.kernel_h == 3 && desc.kernel_w == 3 && desc.stride_h == 1 && desc.stride_w == 1 && desc.dilation_h == 1 && desc.dilation_w == 1) )
+               return Policy::template failure<mat<T>>({ mat_errc::winograd_unsupported });
+         }
+
+         mat<T> out(input.get_n_rows(), filters.get_n_rows() * desc.out_height() * desc.out_width());
+
+         switch ( algorithm )
+         {
+            case conv2d_algorithm::winograd:
+               conv2d_winograd(input, filters, desc, out);
+               break;
+            case conv2d_algorithm::direct:
+               conv2d_direct(input, filters, desc, out);
+               break;
+            default:
+               conv2d_im2col(input, filters, desc, out);
+               break;
+         }
+
+         return out;
+      }
+}
+#endif
@@ -0,0 +1,307 @@
+#ifndef DECOMP
+#define DECOMP
+#include <algorithm>
+#include <cmath>
+#include <concepts>
+#include <limits>
+#include <numeric>
+#include <vector>
+#include "mat.cpp"
+#include "gemm.cpp"
+
+namespace lawcat
+{
+   template <typename T>
+      struct qr_result
+      {
+         mat<T> q;
+         mat<T> r;
+      };
+
+   // Thin Householder QR of an m x n matrix: q is m x k with orthonormal
+   // columns and r is k x n upper triangular, k = min(m, n). The reflectors are
+   // applied to the transpose so that every update runs along a row.
+   template <std::floating_point T>
+      qr_result<T> qr_thin(const mat<T>& m_a)
+      {
+         const size_t m = m_a.get_n_rows();
+         const size_t n = m_a.get_n_cols();
+         const size_t k = std::min(m, n);
+
+         mat<T> at = transpose(m_a);
+         std::vector<std::vector<T>> reflectors(k);
+
+         for ( size_t j = 0; j < k; ++j )
+         {
+            T* col = at.row(j);
+            T norm = T(0);
+            for ( size_t i = j; i < m; ++i )
+               norm += col[i] * col[i];
+            norm = std::sqrt(norm);
+
+            if ( norm == T(0) )
+               continue;
+
+            std::vector<T>& v = reflectors[j];
+            v.assign(col + j, col + m);
+
+            const T alpha = col[j] > T(0) ? -norm : norm;
+            v[0] -= alpha;
+            T v_norm = T(0);
+            for ( const T& x : v )
+               v_norm += x * x;
+            v_norm = std::sqrt(v_norm);
+            if ( v_norm == T(0) )
+            {
+               v.clear();
+               continue;
+            }
+            for ( T& x : v )
+               x /= v_norm;
+
+            for ( size_t c = j; c < n; ++c )
+            {
+               T* dst = at.row(c) + j;
+               T dot = T(0);
+               for ( size_t i = 0; i < v.size(); ++i )
+                  dot += v[i] * dst[i];
+               for ( size_t i = 0; i < v.size(); ++i )
+                  dst[i] -= T(2) * dot * v[i];
+            }
+         }
+
+         qr_result<T> out { mat<T>(m, k), mat<T>(k, n) };
+         for ( size_t i = 0; i < k; ++i )
+            for ( size_t c = 0; c < n; ++c )
+               out.r.row(i)[c] = c >= i ? at.row(c)[i] : T(0);
+
+         // Q = H_0 H_1 ... H_{k-1} applied to the first k unit vectors, again
+         // one row of Q^T at a time.
+         mat<T> qt(k, m);
+         qt.fill(T(0));
+         for ( size_t c = 0; c < k; ++c )
+         {
+            T* e = qt.row(c);
+            e[c] = T(1);
+            for ( size_t j = k; j-- > 0; )
+            {
+               const std::vector<T>& v = reflectors[j];
+               if ( v.empty() )
+                  continue;
+               T dot = T(0);
+               for ( size_t i = 0; i < v.size(); ++i )
+                  dot += v[i] * e[j + i];
+               for ( size_t i = 0; i < v.size(); ++i )
+                  e[j + i] -= T(2) * dot * v[i];
+            }
+         }
+         out.q = transpose(qt);
+
+         return out;
+      }
+
+   template <typename T>
+      struct svd_result
+      {
+         mat<T> u;
+         std::vector<T> s;
+         mat<T> v;
+      };
+
+   // Thin SVD by one-sided (Hestenes) Jacobi: m_a = u diag(s) v^T with u m x k,
+   // v n x k, k = min(m, n) and s sorted in decreasing order. Accurate and
+   // simple, meant for the small cores produced by low-rank recompression.
+   template <std::floating_point T>
+      svd_result<T> svd_jacobi(const mat<T>& m_a, const size_t& max_sweeps = 60)
+      {
+         const bool wide = m_a.get_n_cols() > m_a.get_n_rows();
+         const mat<T> a = wide ? transpose(m_a) : m_a;
+         const size_t m = a.get_n_rows();
+         const size_t n = a.get_n_cols();
+
+         // Rows of w are the columns of a; rows of vt accumulate the rotations.
+         mat<T> w = transpose(a);
+         mat<T> vt(n, n);
+         vt.fill(T(0));
+         for ( size_t i = 0; i < n; ++i )
+            vt.row(i)[i] = T(1);
+
+         const T eps = std::numeric_limits<T>::epsilon();
+         for ( size_t sweep = 0; sweep < max_sweeps; ++sweep )
+         {
+            bool rotated = false;
+            for ( size_t p = 0; p + 1 < n; ++p )
+               for ( size_t q = p + 1; q < n; ++q )
+               {
+                  T* wp = w.row(p);
+                  T* wq = w.row(q);
+                  T alpha = T(0);
+                  T beta = T(0);
+                  T gamma = T(0);
+                  for ( size_t i = 0; i < m; ++i )
+                  {
+                     alpha += wp[i] * wp[i];
+                     beta += wq[i] * wq[i];
+                     gamma += wp[i] * wq[i];
+                  }
+                  if ( std::abs(gamma) <= eps * std::sqrt(alpha * beta) || gamma == T(0) )
+                     continue;
+
+                  rotated = true;
+                  const T zeta = (beta - alpha) / (T(2) * gamma);
+                  const T t = std::copysign(T(1), zeta) / (std::abs(zeta) + std::sqrt(T(1) + zeta * zeta));
+                  const T c = T(1) / std::sqrt(T(1) + t * t);
+                  const T s = c * t;
+
+                  for ( size_t i = 0; i < m; ++i )
+                  {
+                     const T x = wp[i];
+                     const T y = wq[i];
+                     wp[i] = c * x - s * y;
+                     wq[i] = s * x + c * y;
+                  }
+                  T* vp = vt.row(p);
+                  T* vq = vt.row(q);
+                  for ( size_t i = 0; i < n; ++i )
+                  {
+                     const T x = vp[i];
+                     const T y = vq[i];
+                     vp[i] = c * x - s * y;
+                     vq[i] = s * x + c * y;
+                  }
+               }
+            if ( !rotated )
+               break;
+         }
+
+         std::vector<T> sigma(n);
+         for ( size_t j = 0; j < n; ++j )
+         {
+            T acc = T(0);
+            for ( size_t i = 0; i < m; ++i )
+               acc += w.row(j)[i] * w.row(j)[i];
+            sigma[j] = std::sqrt(acc);
+         }
+
+         std::vector<size_t> order(n);
+         std::iota(order.begin(), order.end(), 0);
+         std::sort(order.begin(), order.end(), [&](size_t x, size_t y) { return sigma[x] > sigma[y]; });
+
+         svd_result<T> out { mat<T>(m, n), std::vector<T>(n), mat<T>(n, n) };
+         for ( size_t k = 0; k < n; ++k )
+         {
+            const size_t j = order[k];
+            out.s[k] = sigma[j];
+            for ( size_t i = 0; i < m; ++i )
+               out.u.row(i)[k] = sigma[j] > T(0) ? w.row(j)[i] / sigma[j] : (i == k ? T(1) : T(0));
+            for ( size_t i = 0; i < n; ++i )
+               out.v.row(i)[k] = vt.row(j)[i];
+         }
+
+         if ( wide )
+            std::swap(out.u, out.v);
+         return out;
+      }
+
+   template <typename T>
+      struct lu_result
+      {
+         mat<T> lu;
+         std::vector<size_t> pivots;
+      };
+
+   // LU with partial pivoting of a square matrix, P A = L U. L (unit diagonal)
+   // and U share lu. pivots follow the LAPACK convention (row k was swapped
+   // with row pivots[k]), so permutation_matrix::from_pivots rebuilds P. The
+   // shape and singularity are checked per Policy.
+   template <typename Policy = default_policy, std::floating_point T>
+      policy_result<Policy, lu_result<T>> lu_factor(const mat<T>& m_a)
+      {
+         if constexpr ( Policy::checked )
+         {
+            if ( m_a.get_n_rows() != m_a.get_n_cols() )
+               return Policy::template failure<lu_result<T>>({ mat_errc::non_square, { m_a.get_n_rows(), m_a.get_n_cols() }, "LU factor" });
+         }
+
+         const size_t n = m_a.get_n_rows();
+         lu_result<T> out { m_a, std::vector<size_t>(n) };
+         mat<T>& a = out.lu;
+
+         for ( size_t k = 0; k < n; ++k )
+         {
+            size_t p = k;
+            for ( size_t i = k + 1; i < n; ++i )
+               if ( std::abs(a.row(i)[k]) > std::abs(a.row(p)[k]) )
+                  p = i;
+            if constexpr ( Policy::checked )
+            {
+               if ( a.row(p)[k] == T(0) )
+                  return Policy::template failure<lu_result<T>>({ mat_errc::singular_matrix });
+            }
+
+            a.template swap_rows<unchecked_policy>(k, p);
+            out.pivots[k] = p;
+
+            const T* pivot_row = a.row(k);
+            const T inv = T(1) / pivot_row[k];
+            for ( size_t i = k + 1; i < n; ++i )
+            {
+               T* r = a.row(i);
+               const T l = r[k] * inv;
+               r[k] = l;
+               for ( size_t j = k + 1; j < n; ++j )
+                  r[j] -= l * pivot_row[j];
+            }
+         }
+
+         return out;
+      }
+
+   // Solves A X = B for every column of B at once. The shape of B is checked
+   // per Policy.
+   template <typename Policy = default_policy, std::floating_point T>
+      policy_result<Policy, mat<T>> lu_solve(const lu_result<T>& f, const mat<T>& m_b)
+      {
+         const size_t n = f.lu.get_n_rows();
+         if constexpr ( Policy::checked )
+         {
+            if ( m_b.get_n_rows() != n )
+               return Policy::template failure<mat<T>>({ mat_errc::solve_mismatch, { n, m_b.get_n_rows(), m_b.get_n_cols() } });
+         }
+
+         const size_t r = m_b.get_n_cols();
+         mat<T> x = m_b;
+         for ( size_t k = 0; k < n; ++k )
+            x.template swap_rows<unchecked_policy>(k, f.pivots[k]);
+
+         for ( size_t i = 0; i < n; ++i )
+         {
+            T* xi = x.row(i);
+            for ( size_t k = 0; k < i; ++k )
+            {
+               const T l = f.lu.row(i)[k];
+               const T* xk = x.row(k);
+               for ( size_t j = 0; j < r; ++j )
+                  xi[j] -= l * xk[j];
+            }
+         }
+
+         for ( size_t i = n; i-- > 0; )
+         {
+            T* xi = x.row(i);
+            for ( size_t k = i + 1; k < n; ++k )
+            {
+               const T u = f.lu.row(i)[k];
+               const T* xk = x.row(k);
+               for ( size_t j = 0; j < r; ++j )
+                  xi[j] -= u * xk[j];
+            }
+            const T inv = T(1) / f.lu.row(i)[i];
+            for ( size_t j = 0; j < r; ++j )
+               xi[j] *= inv;
+         }
+
+         return x;
+      }
+}
+#endif
@@ -0,0 +1,117 @@
+#ifndef DERIVED
+#define DERIVED
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "mat.cpp"
+#include "parallel.cpp"
+#include "tracked.cpp"
+
+namespace lawcat
+{
+   // A matrix computed elementwise from two tracked inputs and kept up to
+   // date lazily. value() recomputes only the row blocks either input changed
+   // since the last refresh, so the work follows the size of the change.
+   //
+   // Like any consumer of a tracked_mat, it remembers the epoch it closed on
+   // each input when it last caught up.
+   template <typename T, typename Op>
+      class derived_mat
+      {
+         public:
+            derived_mat(tracked_mat<T>& m_a, tracked_mat<T>& m_b, Op op);
+
+            size_t get_n_rows() const { return this->out.get_n_rows(); }
+            size_t get_n_cols() const { return this->out.get_n_cols(); }
+
+            // Brings the result up to date and returns it.
+            const mat<T>& value() { this->refresh(); return this->out; }
+
+            // Recomputes stale blocks and returns how many there were.
+            size_t refresh();
+
+         private:
+            tracked_mat<T>& a;
+            tracked_mat<T>& b;
+            Op op;
+            mat<T> out;
+            uint64_t seen_a = 0;
+            uint64_t seen_b = 0;
+      };
+
+   template <typename T, typename Op>
+      derived_mat<T, Op>::derived_mat(tracked_mat<T>& m_a, tracked_mat<T>& m_b, Op op)
+         : a(m_a), b(m_b), op(std::move(op)), out(m_a.get_n_rows(), m_a.get_n_cols())
+      {
+         check_matrix_dimensions(m_a.get_n_rows(), m_a.get_n_cols(), m_b.get_n_rows(), m_b.get_n_cols());
+      }
+
+   template <typename T, typename Op>
+      size_t derived_mat<T, Op>::refresh()
+      {
+         // Stale blocks on a's grid; b may use a different block size.
+         const size_t block_rows = this->a.get_block_rows();
+         std::vector<bool> stale(this->a.get_n_blocks(), false);
+         for ( const size_t& blk : this->a.dirty_blocks(this->seen_a) )
+            stale[blk] = true;
+         for ( const size_t& blk : this->b.dirty_blocks(this->seen_b) )
+         {
+            const auto [first, last] = this->b.block_range(blk);
+            for ( size_t k = first / block_rows; k <= (last - 1) / block_rows; ++k )
+               stale[k] = true;
+         }
+
+         std::vector<size_t> work;
+         for ( size_t k = 0; k < stale.size(); ++k )
+            if ( stale[k] )
+               work.push_back(k);
+
+         const size_t n_cols = this->out.get_n_cols();
+         parallel_for(0, work.size(), 1, [&](size_t lo, size_t hi) {
+            for ( size_t w = lo; w < hi; ++w )
+            {
+               const auto [first, last] = this->a.block_range(work[w]);
+               for ( size_t i = first; i < last; ++i )
+               {
+                  const T* x = this->a.value().row(i);
+                  const T* y = this->b.value().row(i);
+                  T* z = this->out.row(i);
+                  for ( size_t j = 0; j < n_cols; ++j )
+                     z[j] = this->op(x[j], y[j]);
+               }
+            }
+         });
+
+         this->seen_a = this->a.advance();
+         this->seen_b = &this->b == &this->a ? this->seen_a : this->b.advance();
+         return work.size();
+      }
+
+   template <typename T>
+      struct sum_op
+      {
+         T operator()(const T& x, const T& y) const { return x + y; }
+      };
+
+   template <typename T>
+      struct hadamard_op
+      {
+         T operator()(const T& x, const T& y) const { return x * y; }
+      };
+
+   // C = A + B, maintained incrementally.
+   template <typename T>
+      derived_mat<T, sum_op<T>> derived_sum(tracked_mat<T>& m_a, tracked_mat<T>& m_b)
+      {
+         return derived_mat<T, sum_op<T>>(m_a, m_b, sum_op<T> {});
+      }
+
+   // C = A .* B, maintained incrementally.
+   template <typename T>
+      derived_mat<T, hadamard_op<T>> derived_hadamard(tracked_mat<T>& m_a, tracked_mat<T>& m_b)
+      {
+         return derived_mat<T, hadamard_op<T>>(m_a, m_b, hadamard_op<T> {});
+      }
+}
+#endif
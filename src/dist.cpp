@@ -0,0 +1,161 @@
+#ifndef DIST
+#define DIST
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <utility>
+#include <vector>
+#include "mat.cpp"
+#include "gemm.cpp"
+#include "parallel.cpp"
+
+namespace lawcat
+{
+   enum class distance_metric
+   {
+      euclidean,
+      sqeuclidean,
+      cosine
+   };
+
+   template <typename T>
+      std::vector<T> row_sq_norms(const mat<T>& m_a)
+      {
+         std::vector<T> out(m_a.get_n_rows());
+         for ( size_t i = 0; i < m_a.get_n_rows(); ++i )
+         {
+            const T* r = m_a.row(i);
+            T acc = T(0);
+            for ( size_t j = 0; j < m_a.get_n_cols(); ++j )
+               acc += r[j] * r[j];
+            out[i] = acc;
+         }
+         return out;
+      }
+
+   // Turns a dot product and the two squared norms into a distance.
+   template <typename T>
+      T distance_from_dot(const T& dot, const T& sq_norm_a, const T& sq_norm_b, const distance_metric& metric)
+      {
+         switch ( metric )
+         {
+            case distance_metric::sqeuclidean:
+               return std::max(T(0), sq_norm_a + sq_norm_b - T(2) * dot);
+            case distance_metric::euclidean:
+               return std::sqrt(std::max(T(0), sq_norm_a + sq_norm_b - T(2) * dot));
+            case distance_metric::cosine:
+            {
+               const T denom = std::sqrt(sq_norm_a) * std::sqrt(sq_norm_b);
+               if ( denom == T(0) )
+                  return T(1);
+               return std::clamp(T(1) - dot / denom, T(0), T(2));
+            }
+         }
+         return T(0);
+      }
+
+   template <typename Policy = default_policy>
+      inline policy_result<Policy> check_feature_dimensions(const size_t& n_cols_a, const size_t& n_cols_b)
+      {
+         return check<Policy>(n_cols_a == n_cols_b, { mat_errc::feature_mismatch, { n_cols_a, n_cols_b } });
+      }
+
+   // All-pairs distances between the rows of m_a and the rows of m_b using
+   // |a|^2 + |b|^2 - 2ab^T, with the norm correction applied per GEMM tile.
+   // Row lengths are checked per Policy.
+   template <typename Policy = default_policy, typename T>
+      policy_result<Policy, mat<T>> cdist(const mat<T>& m_a, const mat<T>& m_b, const distance_metric& metric = distance_metric::euclidean)
+      {
+         if constexpr ( Policy::checked )
+         {
+            if ( m_a.get_n_cols() != m_b.get_n_cols() )
+               return Policy::template failure<mat<T>>({ mat_errc::feature_mismatch, { m_a.get_n_cols(), m_b.get_n_cols() } });
+         }
+
+         const std::vector<T> norms_a = row_sq_norms(m_a);
+         const std::vector<T> norms_b = row_sq_norms(m_b);
+         mat<T> out(m_a.get_n_rows(), m_b.get_n_rows());
+
+         parallel_for(0, m_a.get_n_rows(), gemm_tile_m, [&](size_t lo, size_t hi) {
+            gemm_nt_tiles(m_a.rows() + lo, hi - lo, m_b.rows(), m_b.get_n_rows(), m_a.get_n_cols(),
+               [&](size_t i0, size_t j0, size_t mb, size_t nb, const T* tile, size_t ld) {
+                  for ( size_t i = 0; i < mb; ++i )
+                  {
+                     const size_t gi = lo + i0 + i;
+                     T* out_row = out.row(gi) + j0;
+                     for ( size_t j = 0; j < nb; ++j )
+                        out_row[j] = distance_from_dot(tile[i * ld + j], norms_a[gi], norms_b[j0 + j], metric);
+                  }
+               });
+         });
+
+         return out;
+      }
+
+   template <typename T>
+      struct knn_result
+      {
+         mat<size_t> indices;
+         mat<T> distances;
+      };
+
+   // For every row of queries, finds the k nearest rows of refs. Each query keeps
+   // a bounded max-heap that is updated from inside the GEMM tile loop, so only
+   // one tile of distances exists at a time. Results are sorted by distance.
+   // Row lengths and k are checked per Policy.
+   template <typename Policy = default_policy, typename T>
+      policy_result<Policy, knn_result<T>> knn(const mat<T>& queries, const mat<T>& refs, const size_t& k, const distance_metric& metric = distance_metric::euclidean)
+      {
+         if constexpr ( Policy::checked )
+         {
+            if ( queries.get_n_cols() != refs.get_n_cols() )
+               return Policy::template failure<knn_result<T>>({ mat_errc::feature_mismatch, { queries.get_n_cols(), refs.get_n_cols() } });
+            if ( k == 0 || k > refs.get_n_rows() )
+               return Policy::template failure<knn_result<T>>({ mat_errc::k_out_of_range });
+         }
+
+         using entry = std::pair<T, size_t>;
+         const size_t n_queries = queries.get_n_rows();
+         const std::vector<T> norms_q = row_sq_norms(queries);
+         const std::vector<T> norms_r = row_sq_norms(refs);
+         knn_result<T> out { mat<size_t>(n_queries, k), mat<T>(n_queries, k) };
+
+         parallel_for(0, n_queries, gemm_tile_m, [&](size_t lo, size_t hi) {
+            std::vector<std::priority_queue<entry>> heaps(hi - lo);
+
+            gemm_nt_tiles(queries.rows() + lo, hi - lo, refs.rows(), refs.get_n_rows(), queries.get_n_cols(),
+               [&](size_t i0, size_t j0, size_t mb, size_t nb, const T* tile, size_t ld) {
+                  for ( size_t i = 0; i < mb; ++i )
+                  {
+                     std::priority_queue<entry>& heap = heaps[i0 + i];
+                     const T norm_q = norms_q[lo + i0 + i];
+                     for ( size_t j = 0; j < nb; ++j )
+                     {
+                        const T d = distance_from_dot(tile[i * ld + j], norm_q, norms_r[j0 + j], metric);
+                        if ( heap.size() < k )
+                           heap.emplace(d, j0 + j);
+                        else if ( d < heap.top().first )
+                        {
+                           heap.pop();
+                           heap.emplace(d, j0 + j);
+                        }
+                     }
+                  }
+               });
+
+            for ( size_t i = 0; i < hi - lo; ++i )
+            {
+               std::priority_queue<entry>& heap = heaps[i];
+               for ( size_t r = k; r-- > 0; )
+               {
+                  out.distances.row(lo + i)[r] = heap.top().first;
+                  out.indices.row(lo + i)[r] = heap.top().second;
+                  heap.pop();
+               }
+            }
+         });
+
+         return out;
+      }
+}
+#endif
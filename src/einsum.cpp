@@ -0,0 +1,515 @@
+#ifndef EINSUM
+#define EINSUM
+#include <algorithm>
+#include <cctype>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "mat.cpp"
+#include "gemm.cpp"
+#include "parallel.cpp"
+#include "tensor.cpp"
+
+namespace lawcat
+{
+   enum class einsum_strategy
+   {
+      automatic,
+      greedy,
+      optimal
+   };
+
+   // Operands with more inputs than this fall back to the greedy planner when
+   // the strategy is automatic; the subset DP is O(3^n).
+   inline constexpr size_t einsum_optimal_limit = 8;
+
+   // A contraction order in static single assignment form: operands are
+   // numbered 0..n-1, and step s contracts steps[s].first with steps[s].second
+   // into a new operand numbered n + s.
+   struct einsum_path
+   {
+      std::vector<std::pair<size_t, size_t>> steps;
+      double flops = 0;
+   };
+
+   struct einsum_spec
+   {
+      std::vector<std::string> inputs;
+      std::string output;
+   };
+
+   // Parses "ij,jk->ik". Labels are single letters. Without "->" the output
+   // holds every label that appears exactly once, in alphabetical order.
+   inline einsum_spec parse_einsum(const std::string& spec)
+   {
+      einsum_spec out;
+      std::string lhs;
+      const size_t arrow = spec.find("->");
+
+      for ( const char c : spec.substr(0, arrow) )
+         if ( !std::isspace(static_cast<unsigned char>(c)) )
+            lhs.push_back(c);
+
+      size_t start = 0;
+      while ( true )
+      {
+         const size_t comma = lhs.find(',', start);
+         out.inputs.push_back(lhs.substr(start, comma - start));
+         if ( comma == std::string::npos )
+            break;
+         start = comma + 1;
+      }
+
+      for ( const std::string& in : out.inputs )
+         for ( const char c : in )
+            if ( !std::isalpha(static_cast<unsigned char>(c)) )
+               default_policy::failure({ mat_errc::einsum_label_not_letter });
+
+      if ( arrow != std::string::npos )
+      {
+         for ( const char c : spec.substr(arrow + 2) )
+            if ( !std::isspace(static_cast<unsigned char>(c)) )
+            {
+               if ( !std::isalpha(static_cast<unsigned char>(c)) || out.output.find(c) != std::string::npos )
+                  default_policy::failure({ mat_errc::einsum_output_labels });
+               if ( lhs.find(c) == std::string::npos )
+                  default_policy::failure({ mat_errc::einsum_unknown_output_label });
+               out.output.push_back(c);
+            }
+      }
+      else
+      {
+         std::map<char, size_t> counts;
+         for ( const char c : lhs )
+            if ( c != ',' )
+               ++counts[c];
+         for ( const auto& [c, n] : counts )
+            if ( n == 1 )
+               out.output.push_back(c);
+      }
+
+      return out;
+   }
+
+   namespace detail
+   {
+      inline std::string label_union(const std::string& a, const std::string& b)
+      {
+         std::string out = a;
+         for ( const char c : b )
+            if ( out.find(c) == std::string::npos )
+               out.push_back(c);
+         return out;
+      }
+
+      inline std::string label_filter(const std::string& labels, const std::string& keep)
+      {
+         std::string out;
+         for ( const char c : labels )
+            if ( keep.find(c) != std::string::npos && out.find(c) == std::string::npos )
+               out.push_back(c);
+         return out;
+      }
+
+      inline double label_size(const std::string& labels, const std::map<char, size_t>& sizes)
+      {
+         double s = 1;
+         for ( const char c : labels )
+            s *= double(sizes.at(c));
+         return s;
+      }
+
+      // Labels that must survive a contraction: the output plus every label of
+      // an operand that is not part of it.
+      inline std::string needed_labels(const std::vector<std::string>& inputs, const std::vector<bool>& excluded, const std::string& output)
+      {
+         std::string out = output;
+         for ( size_t i = 0; i < inputs.size(); ++i )
+            if ( !excluded[i] )
+               out = label_union(out, inputs[i]);
+         return out;
+      }
+   }
+
+   // Exhaustive search over subsets for the order with the fewest multiply-adds.
+   inline einsum_path plan_einsum_optimal(const std::vector<std::string>& inputs, const std::string& output, const std::map<char, size_t>& sizes)
+   {
+      const size_t n = inputs.size();
+      const size_t full = (size_t(1) << n) - 1;
+      std::vector<double> best(full + 1, std::numeric_limits<double>::infinity());
+      std::vector<size_t> split(full + 1, 0);
+      std::vector<std::string> labels(full + 1);
+
+      for ( size_t s = 1; s <= full; ++s )
+      {
+         std::vector<bool> inside(n);
+         std::string all;
+         for ( size_t i = 0; i < n; ++i )
+         {
+            inside[i] = (s >> i) & 1;
+            if ( inside[i] )
+               all = detail::label_union(all, inputs[i]);
+         }
+         labels[s] = detail::label_filter(all, detail::needed_labels(inputs, inside, output));
+         if ( (s & (s - 1)) == 0 )
+            best[s] = 0;
+      }
+
+      for ( size_t s = 1; s <= full; ++s )
+      {
+         if ( (s & (s - 1)) == 0 )
+            continue;
+         const size_t low = s & (~s + 1);
+         for ( size_t a = (s - 1) & s; a > 0; a = (a - 1) & s )
+         {
+            if ( !(a & low) )
+               continue;
+            const size_t b = s ^ a;
+            const double cost = best[a] + best[b] + detail::label_size(detail::label_union(labels[a], labels[b]), sizes);
+            if ( cost < best[s] )
+            {
+               best[s] = cost;
+               split[s] = a;
+            }
+         }
+      }
+
+      einsum_path path;
+      path.flops = best[full];
+      size_t next = n;
+      const auto emit = [&](const auto& self, size_t s) -> size_t {
+         if ( (s & (s - 1)) == 0 )
+         {
+            size_t i = 0;
+            while ( !((s >> i) & 1) )
+               ++i;
+            return i;
+         }
+         const size_t a = self(self, split[s]);
+         const size_t b = self(self, s ^ split[s]);
+         path.steps.emplace_back(a, b);
+         return next++;
+      };
+      emit(emit, full);
+      return path;
+   }
+
+   // Repeatedly contracts the pair whose result shrinks the working set the
+   // most, breaking ties on the cost of the contraction itself.
+   inline einsum_path plan_einsum_greedy(const std::vector<std::string>& inputs, const std::string& output, const std::map<char, size_t>& sizes)
+   {
+      einsum_path path;
+      std::vector<std::string> live = inputs;
+      std::vector<size_t> ids(inputs.size());
+      for ( size_t i = 0; i < ids.size(); ++i )
+         ids[i] = i;
+      size_t next = inputs.size();
+
+      while ( live.size() > 1 )
+      {
+         size_t best_i = 0;
+         size_t best_j = 1;
+         std::pair<double, double> best_score = { std::numeric_limits<double>::infinity(), 0 };
+         std::string best_labels;
+
+         for ( size_t i = 0; i < live.size(); ++i )
+            for ( size_t j = i + 1; j < live.size(); ++j )
+            {
+               std::vector<bool> excluded(live.size(), false);
+               excluded[i] = excluded[j] = true;
+               const std::string all = detail::label_union(live[i], live[j]);
+               const std::string result = detail::label_filter(all, detail::needed_labels(live, excluded, output));
+               const double growth = detail::label_size(result, sizes) - detail::label_size(live[i], sizes) - detail::label_size(live[j], sizes);
+               const std::pair<double, double> score = { growth, detail::label_size(all, sizes) };
+               if ( score < best_score )
+               {
+                  best_score = score;
+                  best_i = i;
+                  best_j = j;
+                  best_labels = result;
+               }
+            }
+
+         path.steps.emplace_back(ids[best_i], ids[best_j]);
+         path.flops += best_score.second;
+         live.erase(live.begin() + best_j);
+         ids.erase(ids.begin() + best_j);
+         live[best_i] = best_labels;
+         ids[best_i] = next++;
+      }
+
+      return path;
+   }
+
+   namespace detail
+   {
+      template <typename T>
+         struct labelled
+         {
+            tensor<T> value;
+            std::string labels;
+         };
+
+      // Sums out every label of x that is not in keep.
+      template <typename T>
+         labelled<T> sum_out(const labelled<T>& x, const std::string& keep)
+         {
+            const std::string kept = label_filter(x.labels, keep);
+            if ( kept.size() == x.labels.size() )
+               return x;
+
+            std::vector<size_t> axes;
+            std::vector<size_t> out_shape;
+            for ( const char c : kept )
+            {
+               axes.push_back(x.labels.find(c));
+               out_shape.push_back(x.value.get_shape()[axes.back()]);
+            }
+            for ( size_t d = 0; d < x.labels.size(); ++d )
+               if ( kept.find(x.labels[d]) == std::string::npos )
+                  axes.push_back(d);
+
+            const tensor<T> ordered = x.value.permute(axes);
+            tensor<T> out(out_shape);
+            out.fill(T(0));
+
+            const size_t run = ordered.get_numel() / std::max<size_t>(1, out.get_numel());
+            const T* src = ordered.data();
+            T* dst = out.data();
+            size_t count = 0;
+            if ( run > 0 )
+               ordered.for_each_offset([&](size_t off) {
+                  dst[count / run] += src[off];
+                  ++count;
+               });
+
+            return { out, kept };
+         }
+
+      // Returns x permuted into label order, copying only when the permuted
+      // view is not already dense.
+      template <typename T>
+         tensor<T> arrange(const labelled<T>& x, const std::string& order)
+         {
+            std::vector<size_t> axes;
+            for ( const char c : order )
+               axes.push_back(x.labels.find(c));
+            const tensor<T> view = x.value.permute(axes);
+            return view.is_contiguous() ? view : view.contiguous();
+         }
+
+      template <typename T>
+         bool arranged_densely(const labelled<T>& x, const std::string& order)
+         {
+            std::vector<size_t> axes;
+            for ( const char c : order )
+               axes.push_back(x.labels.find(c));
+            return x.value.permute(axes).is_contiguous();
+         }
+
+      // Contracts a and b, keeping the labels in keep. Labels shared by both
+      // and kept are batch labels, shared and dropped are summed by the GEMM.
+      // With a laid out [batch, free_a, sum] each batch of a is an M x K
+      // row-major block; b is used as [batch, free_b, sum] (N x K, for
+      // gemm_nt_tiles) or [batch, sum, free_b] (K x N, for gemm_nn_tiles),
+      // whichever needs no copy.
+      template <typename T>
+         labelled<T> contract_pair(const labelled<T>& a_in, const labelled<T>& b_in, const std::string& keep, const std::map<char, size_t>& sizes)
+         {
+            const labelled<T> a = sum_out(a_in, label_union(keep, b_in.labels));
+            const labelled<T> b = sum_out(b_in, label_union(keep, a.labels));
+
+            std::string batch, summed, free_a, free_b;
+            for ( const char c : a.labels )
+            {
+               if ( b.labels.find(c) == std::string::npos )
+                  free_a.push_back(c);
+               else if ( keep.find(c) != std::string::npos )
+                  batch.push_back(c);
+               else
+                  summed.push_back(c);
+            }
+            for ( const char c : b.labels )
+               if ( a.labels.find(c) == std::string::npos )
+                  free_b.push_back(c);
+
+            const bool b_nn = !arranged_densely(b, batch + free_b + summed) && arranged_densely(b, batch + summed + free_b);
+            const tensor<T> ta = arrange(a, batch + free_a + summed);
+            const tensor<T> tb = arrange(b, b_nn ? batch + summed + free_b : batch + free_b + summed);
+
+            const size_t n_batch = size_t(label_size(batch, sizes));
+            const size_t m = size_t(label_size(free_a, sizes));
+            const size_t n = size_t(label_size(free_b, sizes));
+            const size_t k = size_t(label_size(summed, sizes));
+
+            std::vector<size_t> out_shape;
+            for ( const char c : batch + free_a + free_b )
+               out_shape.push_back(sizes.at(c));
+            tensor<T> out(out_shape);
+
+            const T* a_base = ta.data();
+            const T* b_base = tb.data();
+            T* c_base = out.data();
+            const size_t m_blocks = (m + gemm_tile_m - 1) / gemm_tile_m;
+
+            if ( k == 0 )
+               out.fill(T(0));
+            else
+               parallel_for(0, n_batch * m_blocks, [&](size_t lo, size_t hi) {
+                  std::vector<const T*> a_rows;
+                  std::vector<const T*> b_rows(b_nn ? k : n);
+                  size_t loaded_batch = size_t(-1);
+
+                  for ( size_t job = lo; job < hi; ++job )
+                  {
+                     const size_t bi = job / m_blocks;
+                     const size_t i0 = (job % m_blocks) * gemm_tile_m;
+                     const size_t mb = std::min(gemm_tile_m, m - i0);
+
+                     a_rows.resize(mb);
+                     for ( size_t i = 0; i < mb; ++i )
+                        a_rows[i] = a_base + (bi * m + i0 + i) * k;
+                     if ( bi != loaded_batch )
+                     {
+                        const size_t ld = b_nn ? n : k;
+                        for ( size_t r = 0; r < b_rows.size(); ++r )
+                           b_rows[r] = b_base + bi * n * k + r * ld;
+                        loaded_batch = bi;
+                     }
+
+                     const auto store = [&](size_t t_i0, size_t j0, size_t t_mb, size_t nb, const T* tile, size_t ld) {
+                        for ( size_t i = 0; i < t_mb; ++i )
+                           std::copy(tile + i * ld, tile + i * ld + nb, c_base + (bi * m + i0 + t_i0 + i) * n + j0);
+                     };
+
+                     if ( b_nn )
+                        gemm_nn_tiles(a_rows.data(), mb, b_rows.data(), n, k, store);
+                     else
+                        gemm_nt_tiles(a_rows.data(), mb, b_rows.data(), n, k, store);
+                  }
+               });
+
+            return { out, batch + free_a + free_b };
+         }
+   }
+
+   namespace detail
+   {
+      // Operand labels and label sizes as einsum evaluates them: repeated
+      // labels within an operand are folded into its diagonal first.
+      // diagonals[i] lists the axis pairs folded in operand i, in order.
+      struct einsum_operands
+      {
+         std::vector<std::string> labels;
+         std::vector<std::vector<std::pair<size_t, size_t>>> diagonals;
+         std::map<char, size_t> sizes;
+      };
+
+      template <typename T>
+         einsum_operands reduce_operands(const einsum_spec& parsed, const std::vector<tensor<T>>& operands)
+         {
+            if ( parsed.inputs.size() != operands.size() )
+               default_policy::failure({ mat_errc::einsum_operand_count, { parsed.inputs.size(), operands.size() } });
+
+            einsum_operands out;
+            for ( size_t i = 0; i < operands.size(); ++i )
+            {
+               if ( parsed.inputs[i].size() != operands[i].get_rank() )
+                  default_policy::failure({ mat_errc::einsum_rank_mismatch, { i, operands[i].get_rank() }, parsed.inputs[i] });
+
+               std::string labels = parsed.inputs[i];
+               std::vector<size_t> shape = operands[i].get_shape();
+               std::vector<std::pair<size_t, size_t>> diagonals;
+               for ( size_t p = 0; p < labels.size(); ++p )
+                  for ( size_t q = labels.size(); q-- > p + 1; )
+                     if ( labels[q] == labels[p] )
+                     {
+                        if ( shape[p] != shape[q] )
+                           default_policy::failure({ mat_errc::einsum_repeated_size_mismatch, {}, std::string(1, labels[p]) });
+                        diagonals.emplace_back(p, q);
+                        labels.erase(q, 1);
+                        shape.erase(shape.begin() + q);
+                     }
+
+               for ( size_t d = 0; d < labels.size(); ++d )
+               {
+                  const auto [it, inserted] = out.sizes.emplace(labels[d], shape[d]);
+                  if ( !inserted && it->second != shape[d] )
+                     default_policy::failure({ mat_errc::einsum_size_mismatch, { it->second, shape[d] }, std::string(1, labels[d]) });
+               }
+
+               out.labels.push_back(labels);
+               out.diagonals.push_back(diagonals);
+            }
+            return out;
+         }
+
+      inline einsum_path choose_path(const einsum_operands& ops, const std::string& output, einsum_strategy strategy)
+      {
+         const size_t n = ops.labels.size();
+         if ( n < 2 )
+            return {};
+         if ( strategy == einsum_strategy::automatic )
+            strategy = n <= einsum_optimal_limit ? einsum_strategy::optimal : einsum_strategy::greedy;
+         return strategy == einsum_strategy::optimal ? plan_einsum_optimal(ops.labels, output, ops.sizes) : plan_einsum_greedy(ops.labels, output, ops.sizes);
+      }
+   }
+
+   // Evaluates an Einstein summation such as "bij,bjk->bik" over any number
+   // of operands. Repeated labels within one operand select its diagonal.
+   // Contractions run pairwise in the order chosen by the planner, each as a
+   // batched GEMM on the tiled kernels.
+   template <typename T>
+      tensor<T> einsum(const std::string& spec, const std::vector<tensor<T>>& operands, einsum_strategy strategy = einsum_strategy::automatic)
+      {
+         const einsum_spec parsed = parse_einsum(spec);
+         const detail::einsum_operands ops = detail::reduce_operands(parsed, operands);
+
+         std::vector<std::optional<detail::labelled<T>>> work;
+         for ( size_t i = 0; i < operands.size(); ++i )
+         {
+            detail::labelled<T> x { operands[i], ops.labels[i] };
+            for ( const auto& [p, q] : ops.diagonals[i] )
+               x.value = x.value.diagonal(p, q);
+            work.push_back(x);
+         }
+
+         const std::map<char, size_t>& sizes = ops.sizes;
+         const einsum_path path = detail::choose_path(ops, parsed.output, strategy);
+
+         for ( const auto& [i, j] : path.steps )
+         {
+            std::string keep = parsed.output;
+            for ( size_t o = 0; o < work.size(); ++o )
+               if ( o != i && o != j && work[o] )
+                  keep = detail::label_union(keep, work[o]->labels);
+
+            work.push_back(detail::contract_pair(*work[i], *work[j], keep, sizes));
+            work[i].reset();
+            work[j].reset();
+         }
+
+         const detail::labelled<T> last = detail::sum_out(*work.back(), parsed.output);
+         return detail::arrange(last, parsed.output).contiguous();
+      }
+
+   template <typename T, typename... Rest>
+      tensor<T> einsum(const std::string& spec, const tensor<T>& first, const Rest&... rest)
+      {
+         return einsum(spec, std::vector<tensor<T>> { first, rest... });
+      }
+
+   // The order einsum would use for these operands, without evaluating it.
+   // Operands are reduced to their repeated-label diagonals first, exactly as
+   // einsum does, so the path and cost are those of the evaluation.
+   template <typename T>
+      einsum_path plan_einsum(const std::string& spec, const std::vector<tensor<T>>& operands, einsum_strategy strategy = einsum_strategy::automatic)
+      {
+         const einsum_spec parsed = parse_einsum(spec);
+         return detail::choose_path(detail::reduce_operands(parsed, operands), parsed.output, strategy);
+      }
+}
+#endif
@@ -0,0 +1,372 @@
+#ifndef ERRORS
+#define ERRORS
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <source_location>
+#include <stdexcept>
+#include <string>
+#include <version>
+#if defined(__cpp_lib_expected) && __cpp_lib_expected >= 202202L
+#include <expected>
+#endif
+
+namespace lawcat
+{
+   class dimension_mismatch_error : public std::runtime_error
+   {
+      public:
+         explicit dimension_mismatch_error(const std::string& message, const std::source_location& location = std::source_location::current())
+            : std::runtime_error(message + " at " + location.file_name() + ":" + std::to_string(location.line()) + ".") {}
+   };
+
+   // Codes are grouped by the exception throw_policy reports them as: shape
+   // mismatches as dimension_mismatch_error, bad arguments as
+   // std::invalid_argument, failures of the data or the environment as
+   // std::runtime_error and calls made out of order as std::logic_error.
+   enum class mat_errc
+   {
+      dimension_mismatch,
+      product_mismatch,
+      transposed_product_mismatch,
+      feature_mismatch,
+      parameter_mismatch,
+      row_extent_mismatch,
+      column_extent_mismatch,
+      block_count_mismatch,
+      attention_width_mismatch,
+      attention_length_mismatch,
+      causal_length_mismatch,
+      descriptor_mismatch,
+      non_square,
+      solve_mismatch,
+      einsum_rank_mismatch,
+      einsum_repeated_size_mismatch,
+      einsum_size_mismatch,
+      spectrum_mismatch,
+      operator_vector_mismatch,
+      operator_product_mismatch,
+      operator_apply_mismatch,
+      operator_row_mismatch,
+      khatri_rao_mismatch,
+      factor_mismatch,
+      sketch_input_mismatch,
+      statistics_mismatch,
+      tensor_rank_mismatch,
+      reshape_mismatch,
+
+      row_out_of_range,
+      column_out_of_range,
+      pivot_out_of_range,
+      not_a_permutation,
+      index_out_of_range,
+      tile_out_of_range,
+      view_out_of_range,
+      tensor_index_out_of_range,
+      tensor_index_rank_mismatch,
+      slice_out_of_range,
+      axis_permutation_rank_mismatch,
+      invalid_axis_permutation,
+      invalid_diagonal_axes,
+      nonpositive_size,
+      kernel_too_large,
+      winograd_unsupported,
+      k_out_of_range,
+      einsum_label_not_letter,
+      einsum_output_labels,
+      einsum_unknown_output_label,
+      einsum_operand_count,
+      empty_circulant,
+      empty_toeplitz,
+      not_power_of_two,
+      srht_dimension,
+      sparse_embedding_nnz,
+      foreign_expression,
+      covariance_merge,
+      covariance_not_tracked,
+      chunk_count_mismatch,
+      read_only,
+      no_checkpoints,
+
+      singular_matrix,
+      reader_slots_exhausted,
+      corrupt_data,
+      chunk_size_mismatch,
+      unknown_codec,
+      writer_died,
+      segment_poisoned,
+      io_failure,
+
+      not_factorized
+   };
+
+   // What went wrong, kept as plain values so that reporting costs nothing
+   // until someone asks for the message. sizes holds the numbers involved, in
+   // the order the message names them; subject names what the message is
+   // about where a number will not do, such as a label, an operator or a
+   // file. io_failure carries its whole message in subject.
+   struct mat_error
+   {
+      mat_errc code;
+      std::array<size_t, 4> sizes {};
+      std::string subject {};
+
+      std::string message() const
+      {
+         const auto n = [this](const size_t& i) { return std::to_string(this->sizes[i]); };
+         const auto dims = [&n](const size_t& r, const size_t& c) { return n(r) + "x" + n(c); };
+         switch ( this->code )
+         {
+            case mat_errc::dimension_mismatch:
+               return "Cannot perform addition between a " + dims(0, 1) + " matrix and a " + dims(2, 3) + " matrix.";
+            case mat_errc::product_mismatch:
+               return "Cannot multiply a " + dims(0, 1) + " matrix by a " + dims(2, 3) + " matrix.";
+            case mat_errc::transposed_product_mismatch:
+               return "Cannot multiply a " + dims(0, 1) + " matrix by the transpose of a " + dims(2, 3) + " matrix.";
+            case mat_errc::feature_mismatch:
+               return "Cannot compute distances between rows of length " + n(0) + " and rows of length " + n(1) + ".";
+            case mat_errc::parameter_mismatch:
+               return "Normalisation parameters must be empty or have one entry per column (" + n(0) + ").";
+            case mat_errc::row_extent_mismatch:
+               return "Expected " + n(0) + " rows, got " + n(1) + ".";
+            case mat_errc::column_extent_mismatch:
+               return "Expected " + n(0) + " columns, got " + n(1) + ".";
+            case mat_errc::block_count_mismatch:
+               return "Cannot multiply block-diagonal matrices with " + n(0) + " and " + n(1) + " blocks.";
+            case mat_errc::attention_width_mismatch:
+               return "Queries and keys must have the same width, got " + n(0) + " and " + n(1) + ".";
+            case mat_errc::attention_length_mismatch:
+               return "Keys and values must have the same number of rows, got " + n(0) + " and " + n(1) + ".";
+            case mat_errc::causal_length_mismatch:
+               return "Causal attention needs at least as many keys as queries, got " + n(0) + " and " + n(1) + ".";
+            case mat_errc::descriptor_mismatch:
+               return this->subject + " rows hold " + n(0) + " values but the descriptor expects " + n(1) + ".";
+            case mat_errc::non_square:
+               return "Cannot " + this->subject + " a non-square " + dims(0, 1) + " matrix.";
+            case mat_errc::solve_mismatch:
+               return "Cannot solve a " + dims(0, 0) + " system with a " + dims(1, 2) + " right-hand side.";
+            case mat_errc::einsum_rank_mismatch:
+               return "einsum operand " + n(0) + " has rank " + n(1) + " but is labelled '" + this->subject + "'.";
+            case mat_errc::einsum_repeated_size_mismatch:
+               return "einsum label '" + this->subject + "' is repeated with different sizes.";
+            case mat_errc::einsum_size_mismatch:
+               return "einsum label '" + this->subject + "' has sizes " + n(0) + " and " + n(1) + ".";
+            case mat_errc::spectrum_mismatch:
+               return "A real signal of length " + n(0) + " needs " + n(1) + " coefficients, got " + n(2) + ".";
+            case mat_errc::operator_vector_mismatch:
+               return "Cannot multiply a " + dims(0, 1) + " " + this->subject + " by a vector of length " + n(2) + ".";
+            case mat_errc::operator_product_mismatch:
+               return "Cannot multiply a " + dims(0, 1) + " " + this->subject + " by a " + dims(2, 3) + " matrix.";
+            case mat_errc::operator_apply_mismatch:
+               return "Cannot apply a " + dims(0, 1) + " " + this->subject + " to a " + dims(2, 3) + " matrix.";
+            case mat_errc::operator_row_mismatch:
+               return "Cannot apply a " + dims(0, 1) + " " + this->subject + " to rows of length " + n(2) + ".";
+            case mat_errc::khatri_rao_mismatch:
+               return "Cannot form the Khatri-Rao product of a " + dims(0, 1) + " matrix and a " + dims(2, 3) + " matrix.";
+            case mat_errc::factor_mismatch:
+               return "Low-rank factors must have the same number of columns, got " + n(0) + " and " + n(1) + ".";
+            case mat_errc::sketch_input_mismatch:
+               return this->subject + " expects rows of length " + n(0) + ", got " + n(1) + ".";
+            case mat_errc::statistics_mismatch:
+               return "Cannot merge statistics over " + n(0) + " columns with statistics over " + n(1) + " columns.";
+            case mat_errc::tensor_rank_mismatch:
+               return "Only rank 2 tensors convert to a matrix, got rank " + n(0) + ".";
+            case mat_errc::reshape_mismatch:
+               return "Cannot reshape " + n(0) + " elements into " + n(1) + ".";
+
+            case mat_errc::row_out_of_range:
+               return "ERROR: Row lies outside the bounds of the matrix.";
+            case mat_errc::column_out_of_range:
+               return "ERROR: Column lies outside the bounds of the matrix.";
+            case mat_errc::pivot_out_of_range:
+               return "ERROR: Pivot lies outside the bounds of the matrix.";
+            case mat_errc::not_a_permutation:
+               return "ERROR: Not a permutation.";
+            case mat_errc::index_out_of_range:
+               return "ERROR: Index lies outside the bounds of the matrix.";
+            case mat_errc::tile_out_of_range:
+               return "ERROR: Tile lies outside the bounds of the matrix.";
+            case mat_errc::view_out_of_range:
+               return "ERROR: View lies outside the bounds of the matrix.";
+            case mat_errc::tensor_index_out_of_range:
+               return "ERROR: Index lies outside the bounds of the tensor.";
+            case mat_errc::tensor_index_rank_mismatch:
+               return "ERROR: Index rank does not match the tensor rank.";
+            case mat_errc::slice_out_of_range:
+               return "ERROR: Slice lies outside the bounds of the tensor.";
+            case mat_errc::axis_permutation_rank_mismatch:
+               return "ERROR: Permutation rank does not match the tensor rank.";
+            case mat_errc::invalid_axis_permutation:
+               return "ERROR: Invalid axis permutation.";
+            case mat_errc::invalid_diagonal_axes:
+               return "ERROR: Invalid diagonal axes.";
+            case mat_errc::nonpositive_size:
+               return "ERROR: " + this->subject + " must be positive.";
+            case mat_errc::kernel_too_large:
+               return "ERROR: Kernel is larger than the padded input.";
+            case mat_errc::winograd_unsupported:
+               return "ERROR: Winograd convolution requires a 3x3 kernel with unit stride and dilation.";
+            case mat_errc::k_out_of_range:
+               return "ERROR: k must lie between 1 and the number of reference rows.";
+            case mat_errc::einsum_label_not_letter:
+               return "ERROR: einsum labels must be letters.";
+            case mat_errc::einsum_output_labels:
+               return "ERROR: einsum output labels must be distinct letters.";
+            case mat_errc::einsum_unknown_output_label:
+               return "ERROR: einsum output label does not appear in any input.";
+            case mat_errc::einsum_operand_count:
+               return "ERROR: einsum expression names " + n(0) + " operands but " + n(1) + " were given.";
+            case mat_errc::empty_circulant:
+               return "ERROR: A circulant matrix needs a non-empty first column.";
+            case mat_errc::empty_toeplitz:
+               return "ERROR: A Toeplitz matrix needs a non-empty first row and column.";
+            case mat_errc::not_power_of_two:
+               return "ERROR: Walsh-Hadamard transform length must be a power of two.";
+            case mat_errc::srht_dimension:
+               return "ERROR: SRHT output dimension must lie between 1 and the padded input dimension.";
+            case mat_errc::sparse_embedding_nnz:
+               return "ERROR: Sparse embedding needs 1 <= nnz <= k.";
+            case mat_errc::foreign_expression:
+               return "ERROR: Expression belongs to a different graph.";
+            case mat_errc::covariance_merge:
+               return "ERROR: Cannot merge statistics without covariance into ones that track it.";
+            case mat_errc::covariance_not_tracked:
+               return "ERROR: Covariance was not tracked.";
+            case mat_errc::chunk_count_mismatch:
+               return "ERROR: Chunk count does not match the matrix and tile sizes.";
+            case mat_errc::read_only:
+               return "ERROR: Cannot write to shared memory " + this->subject + " attached read-only.";
+            case mat_errc::no_checkpoints:
+               return "ERROR: No checkpoints to " + this->subject + ".";
+
+            case mat_errc::singular_matrix:
+               return "ERROR: Matrix is singular.";
+            case mat_errc::reader_slots_exhausted:
+               return "ERROR: All " + n(0) + " reader slots are in use.";
+            case mat_errc::corrupt_data:
+               return "ERROR: Corrupt compressed data.";
+            case mat_errc::chunk_size_mismatch:
+               return "ERROR: Compressed chunk does not match the expected size.";
+            case mat_errc::unknown_codec:
+               return "ERROR: Unknown compression method.";
+            case mat_errc::writer_died:
+               return "ERROR: The writer of shared memory " + this->subject + " died during an update.";
+            case mat_errc::segment_poisoned:
+               return "ERROR: Shared memory " + this->subject + " was left half-written by a failed update.";
+            case mat_errc::io_failure:
+               return this->subject;
+
+            case mat_errc::not_factorized:
+               return "ERROR: HODLR matrix must be factorized before solving.";
+         }
+         return "ERROR: Unknown matrix error.";
+      }
+   };
+
+   // Error policies. Every operation that checks its arguments takes a
+   // Policy template parameter, defaulting to default_policy; operators
+   // forward to a named form that does. A policy decides what an operation
+   // producing V returns, Policy::result<V>, and what happens on failure:
+   //
+   //    throw_policy      V; throws the exception the code's group names
+   //    expected_policy   std::expected<V, mat_error> (C++23)
+   //    abort_policy      V; prints the message and aborts
+   //    unchecked_policy  V; performs no check at all
+   //
+   // Constructors, file and shared-memory I/O and corrupt data have no
+   // result to carry an error in, so they report through default_policy.
+   // default_policy is throw_policy, or abort_policy when compiled with
+   // -fno-exceptions, in which case no throw expression is compiled.
+#if defined(__cpp_exceptions)
+   struct throw_policy
+   {
+      template <typename V = void>
+         using result = V;
+      static constexpr bool checked = true;
+
+      static void success() {}
+      template <typename V = void>
+         [[noreturn]] static V failure(const mat_error& error, const std::source_location& location = std::source_location::current())
+         {
+            if ( error.code >= mat_errc::not_factorized )
+               throw std::logic_error(error.message());
+            if ( error.code >= mat_errc::singular_matrix )
+               throw std::runtime_error(error.message());
+            if ( error.code >= mat_errc::row_out_of_range )
+               throw std::invalid_argument(error.message());
+            throw dimension_mismatch_error(error.message(), location);
+         }
+   };
+#endif
+
+#if defined(__cpp_lib_expected) && __cpp_lib_expected >= 202202L
+   struct expected_policy
+   {
+      template <typename V = void>
+         using result = std::expected<V, mat_error>;
+      static constexpr bool checked = true;
+
+      static result<> success() { return {}; }
+      template <typename V = void>
+         static result<V> failure(const mat_error& error) { return std::unexpected(error); }
+   };
+#endif
+
+   struct abort_policy
+   {
+      template <typename V = void>
+         using result = V;
+      static constexpr bool checked = true;
+
+      static void success() {}
+      template <typename V = void>
+         [[noreturn]] static V failure(const mat_error& error)
+         {
+            std::fprintf(stderr, "%s\n", error.message().c_str());
+            std::abort();
+         }
+   };
+
+   struct unchecked_policy
+   {
+      template <typename V = void>
+         using result = V;
+      static constexpr bool checked = false;
+
+      static void success() {}
+   };
+
+#if defined(__cpp_exceptions)
+   using default_policy = throw_policy;
+#else
+   using default_policy = abort_policy;
+#endif
+
+   template <typename Policy, typename V = void>
+      using policy_result = typename Policy::template result<V>;
+
+   // Reports error through Policy unless ok, for operations returning nothing.
+   template <typename Policy>
+      inline policy_result<Policy> check(const bool& ok, const mat_error& error)
+      {
+         if constexpr ( Policy::checked )
+         {
+            if ( !ok )
+               return Policy::template failure<>(error);
+         }
+         return Policy::success();
+      }
+
+   template <typename Policy = default_policy>
+      inline policy_result<Policy> check_matrix_dimensions(const size_t& n_rows_a, const size_t& n_cols_a, const size_t& n_rows_b, const size_t& n_cols_b)
+      {
+         return check<Policy>(n_rows_a == n_rows_b && n_cols_a == n_cols_b, { mat_errc::dimension_mismatch, { n_rows_a, n_cols_a, n_rows_b, n_cols_b } });
+      }
+
+   template <typename Policy = default_policy>
+      inline policy_result<Policy> check_product_dimensions(const size_t& n_rows_a, const size_t& n_cols_a, const size_t& n_rows_b, const size_t& n_cols_b)
+      {
+         return check<Policy>(n_cols_a == n_rows_b, { mat_errc::product_mismatch, { n_rows_a, n_cols_a, n_rows_b, n_cols_b } });
+      }
+}
+#endif
@@ -0,0 +1,231 @@
+#ifndef EXTENTS
+#define EXTENTS
+#include <array>
+#include <cstddef>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include "mat.cpp"
+#include "gemm.cpp"
+
+namespace lawcat
+{
+   inline constexpr size_t dynamic_extent = std::dynamic_extent;
+
+   // Row and column counts where either may be fixed at compile time. Only
+   // the dynamic ones are stored.
+   template <size_t R, size_t C>
+      class extents
+      {
+         public:
+            static constexpr size_t static_rows = R;
+            static constexpr size_t static_cols = C;
+
+            constexpr extents(const size_t& n_rows, const size_t& n_cols)
+            {
+               if constexpr ( R == dynamic_extent )
+                  this->dyn[0] = n_rows;
+               else if ( n_rows != R )
+                  default_policy::failure({ mat_errc::row_extent_mismatch, { R, n_rows } });
+
+               if constexpr ( C == dynamic_extent )
+                  this->dyn[R == dynamic_extent ? 1 : 0] = n_cols;
+               else if ( n_cols != C )
+                  default_policy::failure({ mat_errc::column_extent_mismatch, { C, n_cols } });
+            }
+
+            constexpr size_t rows() const
+            {
+               if constexpr ( R == dynamic_extent )
+                  return this->dyn[0];
+               else
+                  return R;
+            }
+
+            constexpr size_t cols() const
+            {
+               if constexpr ( C == dynamic_extent )
+                  return this->dyn[R == dynamic_extent ? 1 : 0];
+               else
+                  return C;
+            }
+
+         private:
+            static constexpr size_t n_dynamic = (R == dynamic_extent) + (C == dynamic_extent);
+            struct no_storage {};
+            [[no_unique_address]] std::conditional_t<n_dynamic == 0, no_storage, std::array<size_t, n_dynamic>> dyn {};
+      };
+
+   // Extent of the result of combining two matching extents.
+   inline constexpr size_t merge_extent(const size_t& a, const size_t& b)
+   {
+      return a != dynamic_extent ? a : b;
+   }
+
+   // A mat whose shape is partly or fully known at compile time.
+   //
+   // Operations between two sized_mats check statically known dimensions
+   // with static_assert and only test at runtime the ones that are dynamic on
+   // either side; with both shapes fixed no check is emitted at all. Static
+   // loop bounds are compile-time constants, so short rows can be unrolled
+   // and vectorised. Storage is an ordinary mat, reachable through base() for
+   // the rest of the library.
+   template <typename T, size_t R, size_t C = R>
+      class sized_mat
+      {
+         public:
+            static constexpr size_t static_rows = R;
+            static constexpr size_t static_cols = C;
+
+            sized_mat() requires ( R != dynamic_extent && C != dynamic_extent ) : shape(R, C), m(R, C) {}
+            sized_mat(const size_t& n_rows, const size_t& n_cols) : shape(n_rows, n_cols), m(n_rows, n_cols) {}
+            // Checks the static dimensions of m_a once.
+            explicit sized_mat(mat<T> m_a) : shape(m_a.get_n_rows(), m_a.get_n_cols()), m(std::move(m_a)) {}
+
+            constexpr size_t get_n_rows() const { return this->shape.rows(); }
+            constexpr size_t get_n_cols() const { return this->shape.cols(); }
+
+            const T& get(const size_t& row, const size_t& col) const { return this->m.get(row, col); }
+            template <typename Policy = default_policy>
+               policy_result<Policy> set(const size_t& row, const size_t col, const T& value) { return this->m.template set<Policy>(row, col, value); }
+            T* row(const size_t& i) { return this->m.row(i); }
+            const T* row(const size_t& i) const { return this->m.row(i); }
+            void fill(const T& value);
+
+            mat<T>& base() { return this->m; }
+            const mat<T>& base() const { return this->m; }
+
+            template <size_t R2, size_t C2>
+               sized_mat<T, merge_extent(R, R2), merge_extent(C, C2)> operator+(const sized_mat<T, R2, C2>& other) const;
+            template <size_t R2, size_t C2>
+               sized_mat<T, merge_extent(R, R2), merge_extent(C, C2)> operator-(const sized_mat<T, R2, C2>& other) const;
+            template <size_t R2, size_t C2>
+               void operator+=(const sized_mat<T, R2, C2>& other);
+            template <size_t R2, size_t C2>
+               void operator-=(const sized_mat<T, R2, C2>& other);
+            template <size_t R2, size_t C2>
+               bool operator==(const sized_mat<T, R2, C2>& other) const;
+
+            template <size_t R2, size_t C2>
+               static sized_mat<T, merge_extent(R, R2), merge_extent(C, C2)> hadamard_product(const sized_mat<T, R, C>& m_a, const sized_mat<T, R2, C2>& m_b);
+
+            // Verifies at compile time what is known and at runtime the rest.
+            template <size_t R2, size_t C2>
+               void check_same_shape(const sized_mat<T, R2, C2>& other) const;
+
+         private:
+            [[no_unique_address]] extents<R, C> shape;
+            mat<T> m;
+
+            template <size_t R2, size_t C2, typename F>
+               sized_mat<T, merge_extent(R, R2), merge_extent(C, C2)> elementwise(const sized_mat<T, R2, C2>& other, F&& fn) const;
+      };
+
+   template <typename T, size_t R, size_t C>
+      template <size_t R2, size_t C2>
+         void sized_mat<T, R, C>::check_same_shape(const sized_mat<T, R2, C2>& other) const
+         {
+            static_assert(R == dynamic_extent || R2 == dynamic_extent || R == R2, "Row extents differ.");
+            static_assert(C == dynamic_extent || C2 == dynamic_extent || C == C2, "Column extents differ.");
+
+            constexpr bool rows_dynamic = R == dynamic_extent || R2 == dynamic_extent;
+            constexpr bool cols_dynamic = C == dynamic_extent || C2 == dynamic_extent;
+            if constexpr ( rows_dynamic || cols_dynamic )
+               check_matrix_dimensions(this->get_n_rows(), this->get_n_cols(), other.get_n_rows(), other.get_n_cols());
+         }
+
+   template <typename T, size_t R, size_t C>
+      void sized_mat<T, R, C>::fill(const T& value)
+      {
+         for ( size_t i = 0; i < this->get_n_rows(); ++i )
+         {
+            T* r = this->m.row(i);
+            for ( size_t j = 0; j < this->get_n_cols(); ++j )
+               r[j] = value;
+         }
+      }
+
+   template <typename T, size_t R, size_t C>
+      template <size_t R2, size_t C2, typename F>
+         sized_mat<T, merge_extent(R, R2), merge_extent(C, C2)> sized_mat<T, R, C>::elementwise(const sized_mat<T, R2, C2>& other, F&& fn) const
+         {
+            this->check_same_shape(other);
+            sized_mat<T, merge_extent(R, R2), merge_extent(C, C2)> out(this->get_n_rows(), this->get_n_cols());
+            const size_t n_cols = out.get_n_cols();
+            for ( size_t i = 0; i < out.get_n_rows(); ++i )
+            {
+               const T* x = this->row(i);
+               const T* y = other.row(i);
+               T* z = out.row(i);
+               for ( size_t j = 0; j < n_cols; ++j )
+                  z[j] = fn(x[j], y[j]);
+            }
+            return out;
+         }
+
+   template <typename T, size_t R, size_t C>
+      template <size_t R2, size_t C2>
+         sized_mat<T, merge_extent(R, R2), merge_extent(C, C2)> sized_mat<T, R, C>::operator+(const sized_mat<T, R2, C2>& other) const
+         {
+            return this->elementwise(other, [](const T& x, const T& y) { return x + y; });
+         }
+
+   template <typename T, size_t R, size_t C>
+      template <size_t R2, size_t C2>
+         sized_mat<T, merge_extent(R, R2), merge_extent(C, C2)> sized_mat<T, R, C>::operator-(const sized_mat<T, R2, C2>& other) const
+         {
+            return this->elementwise(other, [](const T& x, const T& y) { return x - y; });
+         }
+
+   template <typename T, size_t R, size_t C>
+      template <size_t R2, size_t C2>
+         sized_mat<T, merge_extent(R, R2), merge_extent(C, C2)> sized_mat<T, R, C>::hadamard_product(const sized_mat<T, R, C>& m_a, const sized_mat<T, R2, C2>& m_b)
+         {
+            return m_a.elementwise(m_b, [](const T& x, const T& y) { return x * y; });
+         }
+
+   template <typename T, size_t R, size_t C>
+      template <size_t R2, size_t C2>
+         void sized_mat<T, R, C>::operator+=(const sized_mat<T, R2, C2>& other)
+         {
+            this->check_same_shape(other);
+            for ( size_t i = 0; i < this->get_n_rows(); ++i )
+            {
+               T* x = this->row(i);
+               const T* y = other.row(i);
+               for ( size_t j = 0; j < this->get_n_cols(); ++j )
+                  x[j] += y[j];
+            }
+         }
+
+   template <typename T, size_t R, size_t C>
+      template <size_t R2, size_t C2>
+         void sized_mat<T, R, C>::operator-=(const sized_mat<T, R2, C2>& other)
+         {
+            this->check_same_shape(other);
+            for ( size_t i = 0; i < this->get_n_rows(); ++i )
+            {
+               T* x = this->row(i);
+               const T* y = other.row(i);
+               for ( size_t j = 0; j < this->get_n_cols(); ++j )
+                  x[j] -= y[j];
+            }
+         }
+
+   template <typename T, size_t R, size_t C>
+      template <size_t R2, size_t C2>
+         bool sized_mat<T, R, C>::operator==(const sized_mat<T, R2, C2>& other) const
+         {
+            return this->m == other.base();
+         }
+
+   // Matrix product; inner extents must agree statically when both are known.
+   template <typename T, size_t R, size_t K, size_t K2, size_t C>
+      sized_mat<T, R, C> gemm(const sized_mat<T, R, K>& m_a, const sized_mat<T, K2, C>& m_b)
+      {
+         static_assert(K == dynamic_extent || K2 == dynamic_extent || K == K2, "Inner extents differ.");
+         return sized_mat<T, R, C>(gemm(m_a.base(), m_b.base()));
+      }
+}
+#endif
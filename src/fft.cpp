@@ -0,0 +1,619 @@
+#ifndef FFT
+#define FFT
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <complex>
+#include <concepts>
+#include <memory>
+#include <mutex>
+#include <numbers>
+#include <unordered_map>
+#include <vector>
+#include "mat.cpp"
+#include "gemm.cpp"
+#include "parallel.cpp"
+
+namespace lawcat
+{
+   // Mixed-radix decimation-in-time FFT. The length is factored into radix 4
+   // and 2 stages first, then odd factors, each with a precomputed twiddle
+   // table. Radix 2 and 4 have dedicated butterflies; any other factor uses a
+   // generic O(p^2) butterfly, so lengths with large prime factors still work
+   // but are slow (see next_fast_size). Plans are immutable once built and can
+   // be shared between threads. The inverse transform is scaled by 1 / n.
+   template <std::floating_point T>
+      class fft_plan
+      {
+         public:
+            using complex = std::complex<T>;
+
+            explicit fft_plan(const size_t& n);
+
+            size_t size() const { return this->n; }
+
+            // in and out must not overlap.
+            void forward(const complex* in, complex* out) const;
+            void inverse(const complex* in, complex* out) const;
+
+         private:
+            // Generic butterflies up to this radix use scratch on the stack.
+            static constexpr size_t stack_radix = 64;
+
+            size_t n;
+            std::vector<size_t> factors;
+            std::vector<complex> twiddles;
+            // Largest radix handled by butterfly_generic, 0 if none. Plans are
+            // shared between threads, so the scratch it needs is sized here
+            // but owned by each forward() call.
+            size_t max_radix = 0;
+
+            void work(complex* out, const complex* in, const size_t& fstride, const size_t* factor, complex* scratch) const;
+            void butterfly_2(complex* out, const size_t& fstride, const size_t& m) const;
+            void butterfly_4(complex* out, const size_t& fstride, const size_t& m) const;
+            void butterfly_generic(complex* out, const size_t& fstride, const size_t& m, const size_t& p, complex* scratch) const;
+      };
+
+   template <std::floating_point T>
+      fft_plan<T>::fft_plan(const size_t& n)
+      {
+         if ( n == 0 )
+            default_policy::failure({ mat_errc::nonpositive_size, {}, "FFT length" });
+
+         this->n = n;
+         this->twiddles.resize(n);
+         for ( size_t i = 0; i < n; ++i )
+            this->twiddles[i] = std::polar(T(1), T(-2) * std::numbers::pi_v<T> * T(i) / T(n));
+
+         size_t rest = n;
+         size_t p = 4;
+         while ( rest > 1 )
+         {
+            while ( rest % p != 0 )
+            {
+               if ( p == 4 )
+                  p = 2;
+               else if ( p == 2 )
+                  p = 3;
+               else
+                  p += 2;
+               if ( p * p > rest )
+                  p = rest;
+            }
+            rest /= p;
+            if ( p != 2 && p != 4 )
+               this->max_radix = std::max(this->max_radix, p);
+            this->factors.push_back(p);
+            this->factors.push_back(rest);
+         }
+         if ( this->factors.empty() )
+         {
+            this->factors.push_back(1);
+            this->factors.push_back(1);
+         }
+      }
+
+   template <std::floating_point T>
+      void fft_plan<T>::forward(const complex* in, complex* out) const
+      {
+         if ( this->n == 1 )
+         {
+            out[0] = in[0];
+            return;
+         }
+         if ( this->max_radix <= stack_radix )
+         {
+            std::array<complex, stack_radix> scratch;
+            this->work(out, in, 1, this->factors.data(), scratch.data());
+         }
+         else
+         {
+            std::vector<complex> scratch(this->max_radix);
+            this->work(out, in, 1, this->factors.data(), scratch.data());
+         }
+      }
+
+   // ifft(x) = conj(fft(conj(x))) / n
+   template <std::floating_point T>
+      void fft_plan<T>::inverse(const complex* in, complex* out) const
+      {
+         std::vector<complex> tmp(in, in + this->n);
+         for ( complex& z : tmp )
+            z = std::conj(z);
+         this->forward(tmp.data(), out);
+
+         const T scale = T(1) / T(this->n);
+         for ( size_t i = 0; i < this->n; ++i )
+            out[i] = std::conj(out[i]) * scale;
+      }
+
+   template <std::floating_point T>
+      void fft_plan<T>::work(complex* out, const complex* in, const size_t& fstride, const size_t* factor, complex* scratch) const
+      {
+         const size_t p = factor[0];
+         const size_t m = factor[1];
+
+         if ( m == 1 )
+            for ( size_t k = 0; k < p; ++k )
+               out[k] = in[k * fstride];
+         else
+            for ( size_t q = 0; q < p; ++q )
+               this->work(out + q * m, in + q * fstride, fstride * p, factor + 2, scratch);
+
+         switch ( p )
+         {
+            case 2:
+               this->butterfly_2(out, fstride, m);
+               break;
+            case 4:
+               this->butterfly_4(out, fstride, m);
+               break;
+            default:
+               this->butterfly_generic(out, fstride, m, p, scratch);
+               break;
+         }
+      }
+
+   template <std::floating_point T>
+      void fft_plan<T>::butterfly_2(complex* out, const size_t& fstride, const size_t& m) const
+      {
+         for ( size_t k = 0; k < m; ++k )
+         {
+            const complex t = out[k + m] * this->twiddles[k * fstride];
+            out[k + m] = out[k] - t;
+            out[k] += t;
+         }
+      }
+
+   template <std::floating_point T>
+      void fft_plan<T>::butterfly_4(complex* out, const size_t& fstride, const size_t& m) const
+      {
+         for ( size_t k = 0; k < m; ++k )
+         {
+            const complex s0 = out[k + m] * this->twiddles[k * fstride];
+            const complex s1 = out[k + 2 * m] * this->twiddles[2 * k * fstride];
+            const complex s2 = out[k + 3 * m] * this->twiddles[3 * k * fstride];
+
+            const complex s5 = out[k] - s1;
+            const complex s3 = s0 + s2;
+            const complex s4 = s0 - s2;
+            out[k] += s1;
+            out[k + 2 * m] = out[k] - s3;
+            out[k] += s3;
+            out[k + m] = complex(s5.real() + s4.imag(), s5.imag() - s4.real());
+            out[k + 3 * m] = complex(s5.real() - s4.imag(), s5.imag() + s4.real());
+         }
+      }
+
+   template <std::floating_point T>
+      void fft_plan<T>::butterfly_generic(complex* out, const size_t& fstride, const size_t& m, const size_t& p, complex* scratch) const
+      {
+         for ( size_t u = 0; u < m; ++u )
+         {
+            for ( size_t q = 0; q < p; ++q )
+               scratch[q] = out[u + q * m];
+
+            for ( size_t q1 = 0; q1 < p; ++q1 )
+            {
+               const size_t k = u + q1 * m;
+               size_t tw = 0;
+               complex acc = scratch[0];
+               for ( size_t q2 = 1; q2 < p; ++q2 )
+               {
+                  tw += fstride * k;
+                  tw %= this->n;
+                  acc += scratch[q2] * this->twiddles[tw];
+               }
+               out[k] = acc;
+            }
+         }
+      }
+
+   // Real-input transform returning the n / 2 + 1 non-redundant coefficients.
+   // Even lengths run a complex FFT of length n / 2 on the packed signal.
+   template <std::floating_point T>
+      class rfft_plan
+      {
+         public:
+            using complex = std::complex<T>;
+
+            explicit rfft_plan(const size_t& n)
+               : n(n), half(n % 2 == 0 ? std::make_unique<fft_plan<T>>(n / 2) : nullptr), full(n % 2 == 0 ? nullptr : std::make_unique<fft_plan<T>>(n))
+            {
+               if ( this->half )
+                  for ( size_t k = 0; k <= n / 2; ++k )
+                     this->twiddles.push_back(std::polar(T(1), T(-2) * std::numbers::pi_v<T> * T(k) / T(n)));
+            }
+
+            size_t size() const { return this->n; }
+            size_t spectrum_size() const { return this->n / 2 + 1; }
+
+            void forward(const T* in, complex* out) const;
+            void inverse(const complex* in, T* out) const;
+
+         private:
+            size_t n;
+            std::unique_ptr<fft_plan<T>> half;
+            std::unique_ptr<fft_plan<T>> full;
+            std::vector<complex> twiddles;
+      };
+
+   template <std::floating_point T>
+      void rfft_plan<T>::forward(const T* in, complex* out) const
+      {
+         if ( this->full )
+         {
+            std::vector<complex> x(in, in + this->n);
+            std::vector<complex> y(this->n);
+            this->full->forward(x.data(), y.data());
+            std::copy(y.begin(), y.begin() + this->spectrum_size(), out);
+            return;
+         }
+
+         const size_t h = this->n / 2;
+         std::vector<complex> z(h);
+         std::vector<complex> zf(h);
+         for ( size_t k = 0; k < h; ++k )
+            z[k] = complex(in[2 * k], in[2 * k + 1]);
+         this->half->forward(z.data(), zf.data());
+
+         for ( size_t k = 0; k <= h; ++k )
+         {
+            const complex a = zf[k % h];
+            const complex b = std::conj(zf[(h - k) % h]);
+            const complex even = T(0.5) * (a + b);
+            const complex odd = complex(0, T(-0.5)) * (a - b);
+            out[k] = even + this->twiddles[k] * odd;
+         }
+      }
+
+   template <std::floating_point T>
+      void rfft_plan<T>::inverse(const complex* in, T* out) const
+      {
+         if ( this->full )
+         {
+            std::vector<complex> x(this->n);
+            std::copy(in, in + this->spectrum_size(), x.begin());
+            for ( size_t k = this->spectrum_size(); k < this->n; ++k )
+               x[k] = std::conj(in[this->n - k]);
+            std::vector<complex> y(this->n);
+            this->full->inverse(x.data(), y.data());
+            for ( size_t k = 0; k < this->n; ++k )
+               out[k] = y[k].real();
+            return;
+         }
+
+         const size_t h = this->n / 2;
+         std::vector<complex> z(h);
+         std::vector<complex> zt(h);
+         for ( size_t k = 0; k < h; ++k )
+         {
+            const complex a = in[k];
+            const complex b = std::conj(in[h - k]);
+            const complex even = T(0.5) * (a + b);
+            const complex odd = T(0.5) * (a - b) * std::conj(this->twiddles[k]);
+            z[k] = even + complex(0, 1) * odd;
+         }
+         this->half->inverse(z.data(), zt.data());
+
+         for ( size_t k = 0; k < h; ++k )
+         {
+            out[2 * k] = zt[k].real();
+            out[2 * k + 1] = zt[k].imag();
+         }
+      }
+
+   // Process-wide cache so repeated transforms of one length share a plan.
+   template <std::floating_point T>
+      std::shared_ptr<const fft_plan<T>> cached_fft_plan(const size_t& n)
+      {
+         static std::mutex lock;
+         static std::unordered_map<size_t, std::shared_ptr<const fft_plan<T>>> plans;
+
+         std::lock_guard<std::mutex> guard(lock);
+         std::shared_ptr<const fft_plan<T>>& plan = plans[n];
+         if ( !plan )
+            plan = std::make_shared<const fft_plan<T>>(n);
+         return plan;
+      }
+
+   template <std::floating_point T>
+      std::shared_ptr<const rfft_plan<T>> cached_rfft_plan(const size_t& n)
+      {
+         static std::mutex lock;
+         static std::unordered_map<size_t, std::shared_ptr<const rfft_plan<T>>> plans;
+
+         std::lock_guard<std::mutex> guard(lock);
+         std::shared_ptr<const rfft_plan<T>>& plan = plans[n];
+         if ( !plan )
+            plan = std::make_shared<const rfft_plan<T>>(n);
+         return plan;
+      }
+
+   // Smallest length >= n whose only prime factors are 2, 3 and 5.
+   inline size_t next_fast_size(const size_t& n)
+   {
+      for ( size_t m = std::max<size_t>(n, 1); ; ++m )
+      {
+         size_t r = m;
+         for ( const size_t p : { 2, 3, 5 } )
+            while ( r % p == 0 )
+               r /= p;
+         if ( r == 1 )
+            return m;
+      }
+   }
+
+   template <std::floating_point T>
+      std::vector<std::complex<T>> fft(const std::vector<std::complex<T>>& x)
+      {
+         std::vector<std::complex<T>> out(x.size());
+         if ( !x.empty() )
+            cached_fft_plan<T>(x.size())->forward(x.data(), out.data());
+         return out;
+      }
+
+   template <std::floating_point T>
+      std::vector<std::complex<T>> ifft(const std::vector<std::complex<T>>& x)
+      {
+         std::vector<std::complex<T>> out(x.size());
+         if ( !x.empty() )
+            cached_fft_plan<T>(x.size())->inverse(x.data(), out.data());
+         return out;
+      }
+
+   template <std::floating_point T>
+      std::vector<std::complex<T>> rfft(const std::vector<T>& x)
+      {
+         std::vector<std::complex<T>> out(x.size() / 2 + 1);
+         if ( !x.empty() )
+            cached_rfft_plan<T>(x.size())->forward(x.data(), out.data());
+         return out;
+      }
+
+   // n is the length of the real signal, which the spectrum alone cannot tell.
+   // The number of coefficients is checked per Policy.
+   template <typename Policy = default_policy, std::floating_point T>
+      policy_result<Policy, std::vector<T>> irfft(const std::vector<std::complex<T>>& x, const size_t& n)
+      {
+         if constexpr ( Policy::checked )
+         {
+            if ( x.size() != n / 2 + 1 )
+               return Policy::template failure<std::vector<T>>({ mat_errc::spectrum_mismatch, { n, n / 2 + 1, x.size() } });
+         }
+         std::vector<T> out(n);
+         cached_rfft_plan<T>(n)->inverse(x.data(), out.data());
+         return out;
+      }
+
+   template <std::floating_point T>
+      void fft_rows_inplace(mat<std::complex<T>>& m_a, const bool& inverse)
+      {
+         const std::shared_ptr<const fft_plan<T>> plan = cached_fft_plan<T>(m_a.get_n_cols());
+         parallel_for(0, m_a.get_n_rows(), [&](size_t lo, size_t hi) {
+            std::vector<std::complex<T>> tmp(m_a.get_n_cols());
+            for ( size_t i = lo; i < hi; ++i )
+            {
+               if ( inverse )
+                  plan->inverse(m_a.row(i), tmp.data());
+               else
+                  plan->forward(m_a.row(i), tmp.data());
+               std::copy(tmp.begin(), tmp.end(), m_a.row(i));
+            }
+         });
+      }
+
+   // 2D transforms run the rows in parallel, transpose, run the former columns
+   // in parallel and transpose back.
+   template <std::floating_point T>
+      mat<std::complex<T>> fft2(const mat<std::complex<T>>& m_a)
+      {
+         if ( m_a.get_n_rows() == 0 || m_a.get_n_cols() == 0 )
+            return m_a;
+         mat<std::complex<T>> rows = m_a;
+         fft_rows_inplace(rows, false);
+         mat<std::complex<T>> cols = transpose(rows);
+         fft_rows_inplace(cols, false);
+         return transpose(cols);
+      }
+
+   template <std::floating_point T>
+      mat<std::complex<T>> ifft2(const mat<std::complex<T>>& m_a)
+      {
+         if ( m_a.get_n_rows() == 0 || m_a.get_n_cols() == 0 )
+            return m_a;
+         mat<std::complex<T>> rows = m_a;
+         fft_rows_inplace(rows, true);
+         mat<std::complex<T>> cols = transpose(rows);
+         fft_rows_inplace(cols, true);
+         return transpose(cols);
+      }
+
+   // Full linear convolution, length a.size() + b.size() - 1.
+   template <std::floating_point T>
+      std::vector<T> fft_convolve(const std::vector<T>& a, const std::vector<T>& b)
+      {
+         if ( a.empty() || b.empty() )
+            return {};
+
+         const size_t n_out = a.size() + b.size() - 1;
+         const size_t n = next_fast_size(n_out);
+         const std::shared_ptr<const rfft_plan<T>> plan = cached_rfft_plan<T>(n);
+
+         std::vector<T> pa(n, T(0));
+         std::vector<T> pb(n, T(0));
+         std::copy(a.begin(), a.end(), pa.begin());
+         std::copy(b.begin(), b.end(), pb.begin());
+
+         std::vector<std::complex<T>> fa(plan->spectrum_size());
+         std::vector<std::complex<T>> fb(plan->spectrum_size());
+         plan->forward(pa.data(), fa.data());
+         plan->forward(pb.data(), fb.data());
+         for ( size_t k = 0; k < fa.size(); ++k )
+            fa[k] *= fb[k];
+
+         plan->inverse(fa.data(), pa.data());
+         pa.resize(n_out);
+         return pa;
+      }
+
+   // Full 2D linear convolution, (ra + rb - 1) x (ca + cb - 1).
+   template <std::floating_point T>
+      mat<T> fft_convolve2d(const mat<T>& m_a, const mat<T>& m_b)
+      {
+         using complex = std::complex<T>;
+         if ( m_a.get_n_rows() == 0 || m_a.get_n_cols() == 0 || m_b.get_n_rows() == 0 || m_b.get_n_cols() == 0 )
+            return mat<T>(0, 0);
+
+         const size_t out_rows = m_a.get_n_rows() + m_b.get_n_rows() - 1;
+         const size_t out_cols = m_a.get_n_cols() + m_b.get_n_cols() - 1;
+         const size_t n_rows = next_fast_size(out_rows);
+         const size_t n_cols = next_fast_size(out_cols);
+
+         mat<complex> fa(n_rows, n_cols);
+         mat<complex> fb(n_rows, n_cols);
+         fa.fill(complex(0));
+         fb.fill(complex(0));
+         for ( size_t i = 0; i < m_a.get_n_rows(); ++i )
+            for ( size_t j = 0; j < m_a.get_n_cols(); ++j )
+               fa.row(i)[j] = m_a.get(i, j);
+         for ( size_t i = 0; i < m_b.get_n_rows(); ++i )
+            for ( size_t j = 0; j < m_b.get_n_cols(); ++j )
+               fb.row(i)[j] = m_b.get(i, j);
+
+         mat<complex> prod = mat<complex>::hadamard_product(fft2(fa), fft2(fb));
+         const mat<complex> spatial = ifft2(prod);
+
+         mat<T> out(out_rows, out_cols);
+         for ( size_t i = 0; i < out_rows; ++i )
+            for ( size_t j = 0; j < out_cols; ++j )
+               out.row(i)[j] = spatial.get(i, j).real();
+         return out;
+      }
+
+   // n x n circulant matrix given by its first column. Products cost
+   // O(n log n) through the diagonalisation C = F^-1 diag(F c) F.
+   template <std::floating_point T>
+      class circulant
+      {
+         public:
+            explicit circulant(const std::vector<T>& first_col)
+               : n(checked_size(first_col)), plan(cached_rfft_plan<T>(this->n)), spectrum(this->n / 2 + 1)
+            {
+               this->plan->forward(first_col.data(), this->spectrum.data());
+            }
+
+            size_t size() const { return this->n; }
+
+            // The length of x is checked per Policy.
+            template <typename Policy = default_policy>
+               policy_result<Policy, std::vector<T>> matvec(const std::vector<T>& x) const
+               {
+                  if constexpr ( Policy::checked )
+                  {
+                     if ( x.size() != this->n )
+                        return Policy::template failure<std::vector<T>>({ mat_errc::operator_vector_mismatch, { this->n, this->n, x.size() }, "circulant matrix" });
+                  }
+
+                  std::vector<std::complex<T>> fx(this->spectrum.size());
+                  this->plan->forward(x.data(), fx.data());
+                  for ( size_t k = 0; k < fx.size(); ++k )
+                     fx[k] *= this->spectrum[k];
+
+                  std::vector<T> out(this->n);
+                  this->plan->inverse(fx.data(), out.data());
+                  return out;
+               }
+
+         private:
+            size_t n;
+            std::shared_ptr<const rfft_plan<T>> plan;
+            std::vector<std::complex<T>> spectrum;
+
+            // Runs before the plan is built, so an empty column never reaches it.
+            static size_t checked_size(const std::vector<T>& first_col)
+            {
+               if ( first_col.empty() )
+                  default_policy::failure({ mat_errc::empty_circulant });
+               return first_col.size();
+            }
+      };
+
+   // n x m Toeplitz matrix given by its first column (n) and first row (m),
+   // embedded in a circulant of fast length >= n + m - 1. first_row[0] is
+   // ignored in favour of first_col[0].
+   template <std::floating_point T>
+      class toeplitz
+      {
+         public:
+            toeplitz(const std::vector<T>& first_col, const std::vector<T>& first_row)
+               : n_rows(first_col.size()), n_cols(first_row.size()), embedding(embed(first_col, first_row)) {}
+
+            size_t get_n_rows() const { return this->n_rows; }
+            size_t get_n_cols() const { return this->n_cols; }
+
+            // The length of x is checked per Policy.
+            template <typename Policy = default_policy>
+               policy_result<Policy, std::vector<T>> matvec(const std::vector<T>& x) const
+               {
+                  if constexpr ( Policy::checked )
+                  {
+                     if ( x.size() != this->n_cols )
+                        return Policy::template failure<std::vector<T>>({ mat_errc::operator_vector_mismatch, { this->n_rows, this->n_cols, x.size() }, "Toeplitz matrix" });
+                  }
+
+                  std::vector<T> padded(this->embedding.size(), T(0));
+                  std::copy(x.begin(), x.end(), padded.begin());
+                  std::vector<T> y = this->embedding.template matvec<unchecked_policy>(padded);
+                  y.resize(this->n_rows);
+                  return y;
+               }
+
+            // Toeplitz times a dense n_cols x k matrix, one column per parallel
+            // job. Shapes are checked per Policy.
+            template <typename Policy = default_policy>
+               policy_result<Policy, mat<T>> multiply(const mat<T>& other) const
+               {
+                  if constexpr ( Policy::checked )
+                  {
+                     if ( other.get_n_rows() != this->n_cols )
+                        return Policy::template failure<mat<T>>({ mat_errc::operator_product_mismatch, { this->n_rows, this->n_cols, other.get_n_rows(), other.get_n_cols() }, "Toeplitz matrix" });
+                  }
+
+                  mat<T> out(this->n_rows, other.get_n_cols());
+                  parallel_for(0, other.get_n_cols(), [&](size_t lo, size_t hi) {
+                     std::vector<T> x(this->n_cols);
+                     for ( size_t j = lo; j < hi; ++j )
+                     {
+                        for ( size_t i = 0; i < this->n_cols; ++i )
+                           x[i] = other.get(i, j);
+                        const std::vector<T> y = this->template matvec<unchecked_policy>(x);
+                        for ( size_t i = 0; i < this->n_rows; ++i )
+                           out.row(i)[j] = y[i];
+                     }
+                  });
+                  return out;
+               }
+
+            mat<T> operator*(const mat<T>& other) const { return this->multiply(other); }
+
+         private:
+            size_t n_rows;
+            size_t n_cols;
+            circulant<T> embedding;
+
+            static circulant<T> embed(const std::vector<T>& first_col, const std::vector<T>& first_row)
+            {
+               if ( first_col.empty() || first_row.empty() )
+                  default_policy::failure({ mat_errc::empty_toeplitz });
+
+               const size_t len = next_fast_size(first_col.size() + first_row.size() - 1);
+               std::vector<T> c(len, T(0));
+               std::copy(first_col.begin(), first_col.end(), c.begin());
+               for ( size_t j = 1; j < first_row.size(); ++j )
+                  c[len - j] = first_row[j];
+               return circulant<T>(c);
+            }
+      };
+}
+#endif
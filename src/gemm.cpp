@@ -0,0 +1,181 @@
+#ifndef GEMM
+#define GEMM
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "mat.cpp"
+#include "parallel.cpp"
+#include "small.cpp"
+
+namespace lawcat
+{
+   // Tile sizes for the blocked kernels. A tile of C is gemm_tile_m x gemm_tile_n
+   // and the shared dimension is consumed gemm_tile_k elements at a time.
+   inline constexpr size_t gemm_tile_m = 64;
+   inline constexpr size_t gemm_tile_n = 128;
+   inline constexpr size_t gemm_tile_k = 256;
+
+   // Packs rows [j0, j0 + nb) x columns [p0, p0 + kb) of b into a k-major panel so
+   // that the inner loop of the kernel below runs over contiguous memory.
+   template <typename T>
+      void pack_b_panel(const T* const* b, const size_t& j0, const size_t& nb, const size_t& p0, const size_t& kb, T* panel)
+      {
+         for ( size_t j = 0; j < nb; ++j )
+         {
+            const T* b_row = b[j0 + j] + p0;
+            for ( size_t p = 0; p < kb; ++p )
+               panel[p * nb + j] = b_row[p];
+         }
+      }
+
+   // c[i * ldc + j] += sum_p a[i0 + i][p0 + p] * panel[p * nb + j]
+   template <typename T>
+      void gemm_panel_kernel(const T* const* a, const size_t& i0, const size_t& mb, const size_t& p0, const size_t& kb, const T* panel, const size_t& nb, T* c, const size_t& ldc)
+      {
+         for ( size_t i = 0; i < mb; ++i )
+         {
+            const T* a_row = a[i0 + i] + p0;
+            T* c_row = c + i * ldc;
+            for ( size_t p = 0; p < kb; ++p )
+            {
+               const T a_ip = a_row[p];
+               const T* panel_row = panel + p * nb;
+               for ( size_t j = 0; j < nb; ++j )
+                  c_row[j] += a_ip * panel_row[j];
+            }
+         }
+      }
+
+   // Same as pack_b_panel, but with b stored k x n (one row per shared index).
+   template <typename T>
+      void pack_b_panel_nn(const T* const* b, const size_t& j0, const size_t& nb, const size_t& p0, const size_t& kb, T* panel)
+      {
+         for ( size_t p = 0; p < kb; ++p )
+            std::copy(b[p0 + p] + j0, b[p0 + p] + j0 + nb, panel + p * nb);
+      }
+
+   template <bool b_transposed, typename T, typename Epilogue>
+      void gemm_tiles(const T* const* a, const size_t& m, const T* const* b, const size_t& n, const size_t& k, Epilogue&& epilogue)
+      {
+         std::vector<T> tile(gemm_tile_m * gemm_tile_n);
+         std::vector<T> panel(gemm_tile_k * gemm_tile_n);
+
+         for ( size_t j0 = 0; j0 < n; j0 += gemm_tile_n )
+         {
+            const size_t nb = std::min(gemm_tile_n, n - j0);
+            for ( size_t i0 = 0; i0 < m; i0 += gemm_tile_m )
+            {
+               const size_t mb = std::min(gemm_tile_m, m - i0);
+               std::fill(tile.begin(), tile.end(), T(0));
+
+               for ( size_t p0 = 0; p0 < k; p0 += gemm_tile_k )
+               {
+                  const size_t kb = std::min(gemm_tile_k, k - p0);
+                  if constexpr ( b_transposed )
+                     pack_b_panel(b, j0, nb, p0, kb, panel.data());
+                  else
+                     pack_b_panel_nn(b, j0, nb, p0, kb, panel.data());
+                  gemm_panel_kernel(a, i0, mb, p0, kb, panel.data(), nb, tile.data(), nb);
+               }
+
+               epilogue(i0, j0, mb, nb, static_cast<const T*>(tile.data()), nb);
+            }
+         }
+      }
+
+   // Computes A * B^T one tile at a time without ever materialising the full
+   // product. a and b are row-pointer tables (m x k and n x k). For every tile
+   // epilogue(i0, j0, mb, nb, tile, ld) is called, where tile[i * ld + j] holds
+   // (A * B^T)[i0 + i][j0 + j].
+   template <typename T, typename Epilogue>
+      void gemm_nt_tiles(const T* const* a, const size_t& m, const T* const* b, const size_t& n, const size_t& k, Epilogue&& epilogue)
+      {
+         gemm_tiles<true>(a, m, b, n, k, std::forward<Epilogue>(epilogue));
+      }
+
+   // As gemm_nt_tiles for A * B, with b a k x n row-pointer table.
+   template <typename T, typename Epilogue>
+      void gemm_nn_tiles(const T* const* a, const size_t& m, const T* const* b, const size_t& n, const size_t& k, Epilogue&& epilogue)
+      {
+         gemm_tiles<false>(a, m, b, n, k, std::forward<Epilogue>(epilogue));
+      }
+
+   template <typename T>
+      mat<T> transpose(const mat<T>& m_a)
+      {
+         constexpr size_t block = 32;
+         const size_t n_rows = m_a.get_n_rows();
+         const size_t n_cols = m_a.get_n_cols();
+         mat<T> out(n_cols, n_rows);
+
+         for ( size_t i0 = 0; i0 < n_rows; i0 += block )
+            for ( size_t j0 = 0; j0 < n_cols; j0 += block )
+               for ( size_t i = i0; i < std::min(n_rows, i0 + block); ++i )
+                  for ( size_t j = j0; j < std::min(n_cols, j0 + block); ++j )
+                     out.row(j)[i] = m_a.row(i)[j];
+
+         return out;
+      }
+
+   // A * B^T, parallel over blocks of rows of A. Shapes are checked per Policy.
+   template <typename Policy = default_policy, typename T>
+      policy_result<Policy, mat<T>> gemm_nt(const mat<T>& m_a, const mat<T>& m_b)
+      {
+         if constexpr ( Policy::checked )
+         {
+            if ( m_a.get_n_cols() != m_b.get_n_cols() )
+               return Policy::template failure<mat<T>>({ mat_errc::transposed_product_mismatch, { m_a.get_n_rows(), m_a.get_n_cols(), m_b.get_n_rows(), m_b.get_n_cols() } });
+         }
+
+         const size_t m = m_a.get_n_rows();
+         const size_t n = m_b.get_n_rows();
+         const size_t k = m_a.get_n_cols();
+         mat<T> out(m, n);
+
+         parallel_for(0, m, gemm_tile_m, [&](size_t lo, size_t hi) {
+            gemm_nt_tiles(m_a.rows() + lo, hi - lo, m_b.rows(), n, k,
+               [&](size_t i0, size_t j0, size_t mb, size_t nb, const T* tile, size_t ld) {
+                  for ( size_t i = 0; i < mb; ++i )
+                     std::copy(tile + i * ld, tile + i * ld + nb, out.row(lo + i0 + i) + j0);
+               });
+         });
+
+         return out;
+      }
+
+   // Shapes are checked per Policy.
+   template <typename Policy = default_policy, typename T>
+      policy_result<Policy, mat<T>> gemm(const mat<T>& m_a, const mat<T>& m_b)
+      {
+         if constexpr ( Policy::checked )
+         {
+            if ( m_a.get_n_cols() != m_b.get_n_rows() )
+               return Policy::template failure<mat<T>>({ mat_errc::product_mismatch, { m_a.get_n_rows(), m_a.get_n_cols(), m_b.get_n_rows(), m_b.get_n_cols() } });
+         }
+
+         const size_t m = m_a.get_n_rows();
+         const size_t n = m_b.get_n_cols();
+         const size_t k = m_a.get_n_cols();
+         mat<T> out(m, n);
+
+         // Narrow products skip the tiled path; rows are still split across threads.
+         if ( is_small(n) && is_small(k) )
+         {
+            parallel_for(0, m, 1024, [&](size_t lo, size_t hi) {
+               small_gemm(m_a.rows() + lo, m_b.rows(), out.rows() + lo, hi - lo, n, k);
+            });
+            return out;
+         }
+
+         parallel_for(0, m, gemm_tile_m, [&](size_t lo, size_t hi) {
+            gemm_nn_tiles(m_a.rows() + lo, hi - lo, m_b.rows(), n, k,
+               [&](size_t i0, size_t j0, size_t mb, size_t nb, const T* tile, size_t ld) {
+                  for ( size_t i = 0; i < mb; ++i )
+                     std::copy(tile + i * ld, tile + i * ld + nb, out.row(lo + i0 + i) + j0);
+               });
+         });
+
+         return out;
+      }
+}
+#endif
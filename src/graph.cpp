@@ -0,0 +1,443 @@
+#ifndef GRAPH
+#define GRAPH
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <map>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "mat.cpp"
+#include "gemm.cpp"
+#include "parallel.cpp"
+
+namespace lawcat
+{
+   enum class graph_op
+   {
+      input,
+      add,
+      sub,
+      hadamard,
+      scale,
+      matmul
+   };
+
+   // Deferred evaluation of mat expressions.
+   //
+   // Operations on graph::expr handles are recorded into a DAG instead of
+   // running. Recording hash-conses every node, so repeated subexpressions
+   // (including a + b vs b + a) become one node. evaluate() then
+   //
+   //   - drops nodes the requested outputs do not depend on,
+   //   - fuses chains of elementwise nodes whose result has a single consumer
+   //     into one pass that streams each row through small scratch registers,
+   //   - materialises only inputs, matmuls, shared and requested nodes, and
+   //     recycles an intermediate's buffer once its last consumer has run.
+   //
+   // Every step runs across threads with parallel_for. Inputs are held by
+   // reference and must outlive evaluation. Recording and evaluate() check
+   // that expressions belong to this graph and that shapes fit per Policy;
+   // the expr operators use default_policy.
+   template <typename T>
+      class graph
+      {
+         public:
+            class expr
+            {
+               public:
+                  size_t get_id() const { return this->id; }
+                  size_t get_n_rows() const { return this->g->nodes[this->id].n_rows; }
+                  size_t get_n_cols() const { return this->g->nodes[this->id].n_cols; }
+
+                  friend expr operator+(const expr& a, const expr& b) { return a.g->add(a, b); }
+                  friend expr operator-(const expr& a, const expr& b) { return a.g->sub(a, b); }
+                  friend expr operator*(const expr& a, const T& s) { return a.g->scale(a, s); }
+                  friend expr operator*(const T& s, const expr& a) { return a.g->scale(a, s); }
+
+               private:
+                  friend class graph<T>;
+                  expr(graph<T>* g, const size_t& id) : g(g), id(id) {}
+
+                  graph<T>* g;
+                  size_t id;
+            };
+
+            expr input(const mat<T>& m_a);
+            template <typename Policy = default_policy>
+               policy_result<Policy, expr> add(const expr& a, const expr& b) { return this->template binary<Policy>(graph_op::add, a, b); }
+            template <typename Policy = default_policy>
+               policy_result<Policy, expr> sub(const expr& a, const expr& b) { return this->template binary<Policy>(graph_op::sub, a, b); }
+            template <typename Policy = default_policy>
+               policy_result<Policy, expr> hadamard(const expr& a, const expr& b) { return this->template binary<Policy>(graph_op::hadamard, a, b); }
+            template <typename Policy = default_policy>
+               policy_result<Policy, expr> scale(const expr& a, const T& s);
+            template <typename Policy = default_policy>
+               policy_result<Policy, expr> matmul(const expr& a, const expr& b);
+
+            // Number of distinct nodes recorded so far.
+            size_t size() const { return this->nodes.size(); }
+
+            template <typename Policy = default_policy>
+               policy_result<Policy, std::vector<mat<T>>> evaluate(const std::vector<expr>& outputs);
+            template <typename Policy = default_policy>
+               policy_result<Policy, mat<T>> evaluate(const expr& output)
+               {
+                  if constexpr ( Policy::checked )
+                  {
+                     if ( !this->owns(output) )
+                        return Policy::template failure<mat<T>>({ mat_errc::foreign_expression });
+                  }
+                  return std::move(this->template evaluate<unchecked_policy>(std::vector<expr> { output })[0]);
+               }
+
+         private:
+            struct node
+            {
+               graph_op op;
+               size_t a;
+               size_t b;
+               T scalar;
+               size_t n_rows;
+               size_t n_cols;
+               const mat<T>* source;
+            };
+
+            using scalar_bytes = std::array<unsigned char, sizeof(T)>;
+            using node_key = std::tuple<graph_op, size_t, size_t, scalar_bytes>;
+
+            // One instruction of a fused elementwise pass. Operands are the
+            // indices of earlier instructions; loads read a materialised node.
+            struct instr
+            {
+               graph_op op;
+               size_t x;
+               size_t y;
+               T scalar;
+               const mat<T>* source;
+            };
+
+            static constexpr size_t fused_chunk = 256;
+
+            std::vector<node> nodes;
+            std::map<node_key, size_t> memo;
+            std::map<const mat<T>*, size_t> input_memo;
+
+            template <typename Policy>
+               policy_result<Policy, expr> binary(const graph_op& op, const expr& a, const expr& b);
+            expr record(const node& n);
+            bool owns(const expr& e) const { return e.g == this && e.id < this->nodes.size(); }
+
+            static bool elementwise(const graph_op& op) { return op != graph_op::input && op != graph_op::matmul; }
+            size_t compile(const size_t& id, const std::vector<bool>& materialised, const std::vector<const mat<T>*>& buffers, std::vector<instr>& program, const bool& root = true) const;
+            static void run_fused(const std::vector<instr>& program, mat<T>& out);
+      };
+
+   template <typename T>
+      typename graph<T>::expr graph<T>::record(const node& n)
+      {
+         scalar_bytes bytes {};
+         std::memcpy(bytes.data(), &n.scalar, sizeof(T));
+         const node_key key { n.op, n.a, n.b, bytes };
+
+         auto found = this->memo.find(key);
+         if ( found != this->memo.end() )
+            return expr(this, found->second);
+
+         this->nodes.push_back(n);
+         this->memo.emplace(key, this->nodes.size() - 1);
+         return expr(this, this->nodes.size() - 1);
+      }
+
+   template <typename T>
+      typename graph<T>::expr graph<T>::input(const mat<T>& m_a)
+      {
+         auto found = this->input_memo.find(&m_a);
+         if ( found != this->input_memo.end() )
+            return expr(this, found->second);
+
+         this->nodes.push_back({ graph_op::input, 0, 0, T(0), m_a.get_n_rows(), m_a.get_n_cols(), &m_a });
+         this->input_memo.emplace(&m_a, this->nodes.size() - 1);
+         return expr(this, this->nodes.size() - 1);
+      }
+
+   template <typename T>
+      template <typename Policy>
+         policy_result<Policy, typename graph<T>::expr> graph<T>::binary(const graph_op& op, const expr& a, const expr& b)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( !this->owns(a) || !this->owns(b) )
+                  return Policy::template failure<expr>({ mat_errc::foreign_expression });
+            }
+            const node& na = this->nodes[a.id];
+            const node& nb = this->nodes[b.id];
+            if constexpr ( Policy::checked )
+            {
+               if ( na.n_rows != nb.n_rows || na.n_cols != nb.n_cols )
+                  return Policy::template failure<expr>({ mat_errc::dimension_mismatch, { na.n_rows, na.n_cols, nb.n_rows, nb.n_cols } });
+            }
+
+            // Commutative operands are ordered so a + b and b + a share a node.
+            size_t x = a.id;
+            size_t y = b.id;
+            if ( op != graph_op::sub && y < x )
+               std::swap(x, y);
+            return this->record({ op, x, y, T(0), na.n_rows, na.n_cols, nullptr });
+         }
+
+   template <typename T>
+      template <typename Policy>
+         policy_result<Policy, typename graph<T>::expr> graph<T>::scale(const expr& a, const T& s)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( !this->owns(a) )
+                  return Policy::template failure<expr>({ mat_errc::foreign_expression });
+            }
+            const node& na = this->nodes[a.id];
+            return this->record({ graph_op::scale, a.id, a.id, s, na.n_rows, na.n_cols, nullptr });
+         }
+
+   template <typename T>
+      template <typename Policy>
+         policy_result<Policy, typename graph<T>::expr> graph<T>::matmul(const expr& a, const expr& b)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( !this->owns(a) || !this->owns(b) )
+                  return Policy::template failure<expr>({ mat_errc::foreign_expression });
+            }
+            const node& na = this->nodes[a.id];
+            const node& nb = this->nodes[b.id];
+            if constexpr ( Policy::checked )
+            {
+               if ( na.n_cols != nb.n_rows )
+                  return Policy::template failure<expr>({ mat_errc::product_mismatch, { na.n_rows, na.n_cols, nb.n_rows, nb.n_cols } });
+            }
+            return this->record({ graph_op::matmul, a.id, b.id, T(0), na.n_rows, nb.n_cols, nullptr });
+         }
+
+   // Emits the pass for node id in post-order. Materialised operands become
+   // loads; the root is materialised too but is computed here.
+   template <typename T>
+      size_t graph<T>::compile(const size_t& id, const std::vector<bool>& materialised, const std::vector<const mat<T>*>& buffers, std::vector<instr>& program, const bool& root) const
+      {
+         const node& n = this->nodes[id];
+         if ( materialised[id] && !root )
+         {
+            program.push_back({ graph_op::input, 0, 0, T(0), buffers[id] });
+            return program.size() - 1;
+         }
+
+         const size_t x = this->compile(n.a, materialised, buffers, program, false);
+         const size_t y = n.op == graph_op::scale ? x : this->compile(n.b, materialised, buffers, program, false);
+         program.push_back({ n.op, x, y, n.scalar, nullptr });
+         return program.size() - 1;
+      }
+
+   template <typename T>
+      void graph<T>::run_fused(const std::vector<instr>& program, mat<T>& out)
+      {
+         const size_t n_cols = out.get_n_cols();
+         parallel_for(0, out.get_n_rows(), 16, [&](size_t lo, size_t hi) {
+            std::vector<T> scratch(program.size() * fused_chunk);
+            std::vector<const T*> val(program.size());
+
+            for ( size_t i = lo; i < hi; ++i )
+               for ( size_t c0 = 0; c0 < n_cols; c0 += fused_chunk )
+               {
+                  const size_t len = std::min(fused_chunk, n_cols - c0);
+                  for ( size_t k = 0; k < program.size(); ++k )
+                  {
+                     const instr& in = program[k];
+                     if ( in.op == graph_op::input )
+                     {
+                        val[k] = in.source->row(i) + c0;
+                        continue;
+                     }
+
+                     T* dst = k + 1 == program.size() ? out.row(i) + c0 : scratch.data() + k * fused_chunk;
+                     const T* x = val[in.x];
+                     const T* y = val[in.y];
+                     switch ( in.op )
+                     {
+                        case graph_op::add:
+                           for ( size_t j = 0; j < len; ++j )
+                              dst[j] = x[j] + y[j];
+                           break;
+                        case graph_op::sub:
+                           for ( size_t j = 0; j < len; ++j )
+                              dst[j] = x[j] - y[j];
+                           break;
+                        case graph_op::hadamard:
+                           for ( size_t j = 0; j < len; ++j )
+                              dst[j] = x[j] * y[j];
+                           break;
+                        case graph_op::scale:
+                           for ( size_t j = 0; j < len; ++j )
+                              dst[j] = in.scalar * x[j];
+                           break;
+                        default:
+                           break;
+                     }
+                     val[k] = dst;
+                  }
+               }
+         });
+      }
+
+   template <typename T>
+      template <typename Policy>
+         policy_result<Policy, std::vector<mat<T>>> graph<T>::evaluate(const std::vector<expr>& outputs)
+         {
+            const size_t n_nodes = this->nodes.size();
+            std::vector<bool> is_output(n_nodes, false);
+            for ( const expr& e : outputs )
+            {
+               if constexpr ( Policy::checked )
+               {
+                  if ( !this->owns(e) )
+                     return Policy::template failure<std::vector<mat<T>>>({ mat_errc::foreign_expression });
+               }
+               is_output[e.id] = true;
+            }
+
+            // Dead-node elimination: ids are a topological order, so one backward
+            // sweep marks everything the outputs depend on.
+            std::vector<bool> live(is_output);
+            std::vector<size_t> uses(n_nodes, 0);
+            std::vector<bool> feeds_matmul(n_nodes, false);
+            for ( size_t id = n_nodes; id-- > 0; )
+            {
+               const node& n = this->nodes[id];
+               if ( !live[id] || n.op == graph_op::input )
+                  continue;
+               live[n.a] = true;
+               ++uses[n.a];
+               if ( n.op != graph_op::scale )
+               {
+                  live[n.b] = true;
+                  ++uses[n.b];
+               }
+               if ( n.op == graph_op::matmul )
+                  feeds_matmul[n.a] = feeds_matmul[n.b] = true;
+            }
+
+            // Fusion: an elementwise node is folded into its consumer unless it
+            // is requested, shared or read by a matmul.
+            std::vector<bool> materialised(n_nodes, false);
+            for ( size_t id = 0; id < n_nodes; ++id )
+               materialised[id] = live[id] && (!elementwise(this->nodes[id].op) || is_output[id] || uses[id] != 1 || feeds_matmul[id]);
+
+            // Leaves read by each step, and the last step that reads each node.
+            std::vector<size_t> steps;
+            for ( size_t id = 0; id < n_nodes; ++id )
+               if ( materialised[id] && this->nodes[id].op != graph_op::input )
+                  steps.push_back(id);
+
+            std::vector<std::vector<size_t>> leaves(n_nodes);
+            std::vector<size_t> last_use(n_nodes, 0);
+            for ( size_t s = 0; s < steps.size(); ++s )
+            {
+               std::vector<size_t> stack { steps[s] };
+               while ( !stack.empty() )
+               {
+                  const size_t id = stack.back();
+                  stack.pop_back();
+                  const node& n = this->nodes[id];
+                  const size_t n_operands = n.op == graph_op::scale ? 1 : 2;
+                  for ( size_t k = 0; k < n_operands; ++k )
+                  {
+                     const size_t operand = k == 0 ? n.a : n.b;
+                     if ( materialised[operand] )
+                     {
+                        leaves[steps[s]].push_back(operand);
+                        last_use[operand] = s;
+                     }
+                     else
+                        stack.push_back(operand);
+                  }
+               }
+            }
+
+            // Buffer planning: intermediates come from a pool of released
+            // buffers of the same shape, and return to it after their last read.
+            std::vector<mat<T>> owned;
+            owned.reserve(steps.size());
+            std::vector<const mat<T>*> buffers(n_nodes, nullptr);
+            std::vector<size_t> owner_slot(n_nodes, size_t(-1));
+            std::vector<size_t> pool;
+            for ( size_t id = 0; id < n_nodes; ++id )
+               if ( live[id] && this->nodes[id].op == graph_op::input )
+                  buffers[id] = this->nodes[id].source;
+
+            for ( size_t s = 0; s < steps.size(); ++s )
+            {
+               const size_t id = steps[s];
+               const node& n = this->nodes[id];
+
+               size_t slot = size_t(-1);
+               if ( !is_output[id] )
+                  for ( size_t p = 0; p < pool.size(); ++p )
+                     if ( owned[pool[p]].get_n_rows() == n.n_rows && owned[pool[p]].get_n_cols() == n.n_cols )
+                     {
+                        slot = pool[p];
+                        pool.erase(pool.begin() + p);
+                        break;
+                     }
+               if ( slot == size_t(-1) )
+               {
+                  owned.emplace_back(n.n_rows, n.n_cols);
+                  slot = owned.size() - 1;
+               }
+               mat<T>& out = owned[slot];
+               owner_slot[id] = slot;
+               buffers[id] = &out;
+
+               if ( n.op == graph_op::matmul )
+               {
+                  const mat<T>& a = *buffers[n.a];
+                  const mat<T>& b = *buffers[n.b];
+                  parallel_for(0, n.n_rows, gemm_tile_m, [&](size_t lo, size_t hi) {
+                     gemm_nn_tiles(a.rows() + lo, hi - lo, b.rows(), n.n_cols, a.get_n_cols(),
+                        [&](size_t i0, size_t j0, size_t mb, size_t nb, const T* tile, size_t ld) {
+                           for ( size_t i = 0; i < mb; ++i )
+                              std::copy(tile + i * ld, tile + i * ld + nb, out.row(lo + i0 + i) + j0);
+                        });
+                  });
+               }
+               else
+               {
+                  std::vector<instr> program;
+                  this->compile(id, materialised, buffers, program);
+                  run_fused(program, out);
+               }
+
+               for ( const size_t& leaf : leaves[id] )
+                  if ( last_use[leaf] == s && !is_output[leaf] && owner_slot[leaf] != size_t(-1) )
+                  {
+                     pool.push_back(owner_slot[leaf]);
+                     owner_slot[leaf] = size_t(-1);
+                  }
+            }
+
+            std::vector<mat<T>> results;
+            results.reserve(outputs.size());
+            std::vector<bool> moved(owned.size(), false);
+            for ( const expr& e : outputs )
+            {
+               const size_t slot = owner_slot[e.id];
+               if ( slot != size_t(-1) && !moved[slot] )
+               {
+                  results.push_back(std::move(owned[slot]));
+                  moved[slot] = true;
+                  buffers[e.id] = &results.back();
+               }
+               else
+                  results.push_back(*buffers[e.id]);
+            }
+            return results;
+         }
+}
+#endif
@@ -0,0 +1,377 @@
+#ifndef HODLR
+#define HODLR
+#include <algorithm>
+#include <concepts>
+#include <numeric>
+#include <optional>
+#include <vector>
+#include "mat.cpp"
+#include "decomp.cpp"
+#include "gemm.cpp"
+#include "lowrank.cpp"
+#include "parallel.cpp"
+
+namespace lawcat
+{
+   // Hierarchically off-diagonal low-rank approximation of an n x n kernel
+   // matrix K[i][j] = kernel(i, j) over n points.
+   //
+   // The points are ordered by a cluster tree of bounding-box bisections, so
+   // every node of the tree owns a contiguous range of the permuted indices.
+   // Leaves keep their diagonal block dense; every inner node keeps its two
+   // off-diagonal blocks as low_rank factors built by ACA to the given
+   // tolerance. Only O(n log n * k) kernel entries are evaluated and matvec
+   // costs O(n log n * k).
+   //
+   // factorize() prepares a direct solver using the recursive Woodbury
+   // identity: with D = diag(A11, A22), A = D + blockdiag(U1, U2) M and only
+   // a small (k1 + k2) x (k1 + k2) system per node has to be LU factored.
+   template <std::floating_point T>
+      class hodlr
+      {
+         public:
+            template <typename Kernel>
+               hodlr(const mat<T>& points, Kernel&& kernel, const T& tol, const size_t& leaf_size = 64);
+
+            size_t size() const { return this->perm.size(); }
+            size_t max_rank() const;
+            const std::vector<size_t>& get_permutation() const { return this->perm; }
+
+            // x and the result are n x r, in the original point order. Shapes,
+            // and for solve() that factorize() has run, are checked per Policy.
+            template <typename Policy = default_policy>
+               policy_result<Policy, mat<T>> matvec(const mat<T>& x) const;
+            template <typename Policy = default_policy>
+               policy_result<Policy, std::vector<T>> matvec(const std::vector<T>& x) const;
+
+            void factorize();
+            bool is_factorized() const { return this->factorized; }
+            template <typename Policy = default_policy>
+               policy_result<Policy, mat<T>> solve(const mat<T>& b) const;
+            template <typename Policy = default_policy>
+               policy_result<Policy, std::vector<T>> solve(const std::vector<T>& b) const;
+
+         private:
+            struct node
+            {
+               size_t begin;
+               size_t end;
+               size_t left = 0;
+               size_t right = 0;
+               bool leaf = true;
+
+               // Leaf: the dense diagonal block and its LU factors.
+               std::optional<mat<T>> dense;
+               std::optional<lu_result<T>> dense_lu;
+
+               // Inner node: A12 = U1 V2^T and A21 = U2 V1^T, plus the Woodbury
+               // terms W1 = A11^-1 U1, W2 = A22^-1 U2 and the LU of S.
+               std::optional<low_rank<T>> a12;
+               std::optional<low_rank<T>> a21;
+               std::optional<mat<T>> w1;
+               std::optional<mat<T>> w2;
+               std::optional<lu_result<T>> s_lu;
+            };
+
+            std::vector<node> nodes;
+            std::vector<size_t> perm;
+            bool factorized = false;
+
+            size_t build_tree(const mat<T>& points, const size_t& begin, const size_t& end, const size_t& leaf_size);
+            void apply(const size_t& id, const mat<T>& x, mat<T>& y) const;
+            mat<T> solve_node(const size_t& id, const mat<T>& b) const;
+            mat<T> to_permuted(const mat<T>& x) const;
+            mat<T> from_permuted(const mat<T>& x) const;
+      };
+
+   template <typename T>
+      mat<T> row_block(const mat<T>& m_a, const size_t& begin, const size_t& end)
+      {
+         mat<T> out(end - begin, m_a.get_n_cols());
+         for ( size_t i = begin; i < end; ++i )
+            std::copy(m_a.row(i), m_a.row(i) + m_a.get_n_cols(), out.row(i - begin));
+         return out;
+      }
+
+   template <std::floating_point T>
+      template <typename Kernel>
+         hodlr<T>::hodlr(const mat<T>& points, Kernel&& kernel, const T& tol, const size_t& leaf_size)
+         {
+            if ( leaf_size == 0 )
+               default_policy::failure({ mat_errc::nonpositive_size, {}, "HODLR leaf size" });
+
+            this->perm.resize(points.get_n_rows());
+            std::iota(this->perm.begin(), this->perm.end(), 0);
+            if ( this->perm.empty() )
+               return;
+            this->build_tree(points, 0, this->perm.size(), leaf_size);
+
+            // Blocks are independent once the tree is known.
+            parallel_for(0, this->nodes.size(), [&](size_t lo, size_t hi) {
+               for ( size_t id = lo; id < hi; ++id )
+               {
+                  node& nd = this->nodes[id];
+                  if ( nd.leaf )
+                  {
+                     mat<T> block(nd.end - nd.begin, nd.end - nd.begin);
+                     for ( size_t i = nd.begin; i < nd.end; ++i )
+                        for ( size_t j = nd.begin; j < nd.end; ++j )
+                           block.row(i - nd.begin)[j - nd.begin] = kernel(this->perm[i], this->perm[j]);
+                     nd.dense = std::move(block);
+                     continue;
+                  }
+
+                  const node& l = this->nodes[nd.left];
+                  const node& r = this->nodes[nd.right];
+                  nd.a12 = low_rank<T>::aca(l.end - l.begin, r.end - r.begin,
+                     [&](size_t i, size_t j) { return kernel(this->perm[l.begin + i], this->perm[r.begin + j]); }, tol);
+                  nd.a21 = low_rank<T>::aca(r.end - r.begin, l.end - l.begin,
+                     [&](size_t i, size_t j) { return kernel(this->perm[r.begin + i], this->perm[l.begin + j]); }, tol);
+               }
+            });
+         }
+
+   // Splits at the median of the widest bounding-box dimension. Children are
+   // always appended after their parent.
+   template <std::floating_point T>
+      size_t hodlr<T>::build_tree(const mat<T>& points, const size_t& begin, const size_t& end, const size_t& leaf_size)
+      {
+         const size_t id = this->nodes.size();
+         this->nodes.push_back(node { begin, end });
+         if ( end - begin <= leaf_size )
+            return id;
+
+         size_t dim = 0;
+         T widest = T(-1);
+         for ( size_t d = 0; d < points.get_n_cols(); ++d )
+         {
+            T lo = points.get(this->perm[begin], d);
+            T hi = lo;
+            for ( size_t i = begin; i < end; ++i )
+            {
+               lo = std::min(lo, points.get(this->perm[i], d));
+               hi = std::max(hi, points.get(this->perm[i], d));
+            }
+            if ( hi - lo > widest )
+            {
+               widest = hi - lo;
+               dim = d;
+            }
+         }
+
+         const size_t mid = begin + (end - begin) / 2;
+         std::nth_element(this->perm.begin() + begin, this->perm.begin() + mid, this->perm.begin() + end,
+            [&](size_t a, size_t b) { return points.get(a, dim) < points.get(b, dim); });
+
+         const size_t left = this->build_tree(points, begin, mid, leaf_size);
+         const size_t right = this->build_tree(points, mid, end, leaf_size);
+         this->nodes[id].left = left;
+         this->nodes[id].right = right;
+         this->nodes[id].leaf = false;
+         return id;
+      }
+
+   template <std::floating_point T>
+      size_t hodlr<T>::max_rank() const
+      {
+         size_t k = 0;
+         for ( const node& nd : this->nodes )
+            if ( !nd.leaf )
+               k = std::max({ k, nd.a12->get_rank(), nd.a21->get_rank() });
+         return k;
+      }
+
+   template <std::floating_point T>
+      mat<T> hodlr<T>::to_permuted(const mat<T>& x) const
+      {
+         mat<T> out(x.get_n_rows(), x.get_n_cols());
+         for ( size_t p = 0; p < this->size(); ++p )
+            std::copy(x.row(this->perm[p]), x.row(this->perm[p]) + x.get_n_cols(), out.row(p));
+         return out;
+      }
+
+   template <std::floating_point T>
+      mat<T> hodlr<T>::from_permuted(const mat<T>& x) const
+      {
+         mat<T> out(x.get_n_rows(), x.get_n_cols());
+         for ( size_t p = 0; p < this->size(); ++p )
+            std::copy(x.row(p), x.row(p) + x.get_n_cols(), out.row(this->perm[p]));
+         return out;
+      }
+
+   // y[begin, end) += A_node x[begin, end), in permuted order.
+   template <std::floating_point T>
+      void hodlr<T>::apply(const size_t& id, const mat<T>& x, mat<T>& y) const
+      {
+         const node& nd = this->nodes[id];
+         const auto accumulate = [&](const mat<T>& part, const size_t& begin) {
+            for ( size_t i = 0; i < part.get_n_rows(); ++i )
+               for ( size_t j = 0; j < part.get_n_cols(); ++j )
+                  y.row(begin + i)[j] += part.row(i)[j];
+         };
+
+         if ( nd.leaf )
+         {
+            accumulate(gemm(*nd.dense, row_block(x, nd.begin, nd.end)), nd.begin);
+            return;
+         }
+
+         const node& l = this->nodes[nd.left];
+         const node& r = this->nodes[nd.right];
+         this->apply(nd.left, x, y);
+         this->apply(nd.right, x, y);
+         accumulate(*nd.a12 * row_block(x, r.begin, r.end), l.begin);
+         accumulate(*nd.a21 * row_block(x, l.begin, l.end), r.begin);
+      }
+
+   template <std::floating_point T>
+      template <typename Policy>
+         policy_result<Policy, mat<T>> hodlr<T>::matvec(const mat<T>& x) const
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( x.get_n_rows() != this->size() )
+                  return Policy::template failure<mat<T>>({ mat_errc::operator_apply_mismatch, { this->size(), this->size(), x.get_n_rows(), x.get_n_cols() }, "HODLR matrix" });
+            }
+
+            const mat<T> xp = this->to_permuted(x);
+            mat<T> yp(x.get_n_rows(), x.get_n_cols());
+            yp.fill(T(0));
+            if ( !this->nodes.empty() )
+               this->apply(0, xp, yp);
+            return this->from_permuted(yp);
+         }
+
+   template <std::floating_point T>
+      template <typename Policy>
+         policy_result<Policy, std::vector<T>> hodlr<T>::matvec(const std::vector<T>& x) const
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( x.size() != this->size() )
+                  return Policy::template failure<std::vector<T>>({ mat_errc::operator_apply_mismatch, { this->size(), this->size(), x.size(), 1 }, "HODLR matrix" });
+            }
+
+            mat<T> xm(x.size(), 1);
+            for ( size_t i = 0; i < x.size(); ++i )
+               xm.row(i)[0] = x[i];
+            const mat<T> y = this->template matvec<unchecked_policy>(xm);
+            std::vector<T> out(y.get_n_rows());
+            for ( size_t i = 0; i < out.size(); ++i )
+               out[i] = y.get(i, 0);
+            return out;
+         }
+
+   // Children are stored after their parent, so a reverse sweep factors them
+   // before the node whose Woodbury terms need their solves.
+   template <std::floating_point T>
+      void hodlr<T>::factorize()
+      {
+         for ( size_t id = this->nodes.size(); id-- > 0; )
+         {
+            node& nd = this->nodes[id];
+            if ( nd.leaf )
+            {
+               nd.dense_lu = lu_factor(*nd.dense);
+               continue;
+            }
+
+            nd.w1 = this->solve_node(nd.left, nd.a12->get_u());
+            nd.w2 = this->solve_node(nd.right, nd.a21->get_u());
+
+            const size_t k1 = nd.a12->get_rank();
+            const size_t k2 = nd.a21->get_rank();
+            const mat<T> top = gemm(transpose(nd.a12->get_v()), *nd.w2);
+            const mat<T> bottom = gemm(transpose(nd.a21->get_v()), *nd.w1);
+
+            mat<T> s(k1 + k2, k1 + k2);
+            s.fill(T(0));
+            for ( size_t i = 0; i < k1 + k2; ++i )
+               s.row(i)[i] = T(1);
+            for ( size_t i = 0; i < k1; ++i )
+               std::copy(top.row(i), top.row(i) + k2, s.row(i) + k1);
+            for ( size_t i = 0; i < k2; ++i )
+               std::copy(bottom.row(i), bottom.row(i) + k1, s.row(k1 + i));
+            nd.s_lu = lu_factor(s);
+         }
+         this->factorized = true;
+      }
+
+   template <std::floating_point T>
+      mat<T> hodlr<T>::solve_node(const size_t& id, const mat<T>& b) const
+      {
+         const node& nd = this->nodes[id];
+         if ( nd.leaf )
+            return lu_solve(*nd.dense_lu, b);
+
+         const node& l = this->nodes[nd.left];
+         const size_t n1 = l.end - l.begin;
+         const size_t r = b.get_n_cols();
+         const mat<T> z1 = this->solve_node(nd.left, row_block(b, 0, n1));
+         const mat<T> z2 = this->solve_node(nd.right, row_block(b, n1, b.get_n_rows()));
+
+         const size_t k1 = nd.a12->get_rank();
+         const size_t k2 = nd.a21->get_rank();
+         const mat<T> t1 = gemm(transpose(nd.a12->get_v()), z2);
+         const mat<T> t2 = gemm(transpose(nd.a21->get_v()), z1);
+         mat<T> t(k1 + k2, r);
+         for ( size_t i = 0; i < k1; ++i )
+            std::copy(t1.row(i), t1.row(i) + r, t.row(i));
+         for ( size_t i = 0; i < k2; ++i )
+            std::copy(t2.row(i), t2.row(i) + r, t.row(k1 + i));
+
+         const mat<T> w = lu_solve(*nd.s_lu, t);
+         const mat<T> c1 = gemm(*nd.w1, row_block(w, 0, k1));
+         const mat<T> c2 = gemm(*nd.w2, row_block(w, k1, k1 + k2));
+
+         mat<T> x(b.get_n_rows(), r);
+         for ( size_t i = 0; i < n1; ++i )
+            for ( size_t j = 0; j < r; ++j )
+               x.row(i)[j] = z1.row(i)[j] - c1.row(i)[j];
+         for ( size_t i = n1; i < b.get_n_rows(); ++i )
+            for ( size_t j = 0; j < r; ++j )
+               x.row(i)[j] = z2.row(i - n1)[j] - c2.row(i - n1)[j];
+         return x;
+      }
+
+   template <std::floating_point T>
+      template <typename Policy>
+         policy_result<Policy, mat<T>> hodlr<T>::solve(const mat<T>& b) const
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( !this->factorized )
+                  return Policy::template failure<mat<T>>({ mat_errc::not_factorized });
+               if ( b.get_n_rows() != this->size() )
+                  return Policy::template failure<mat<T>>({ mat_errc::operator_apply_mismatch, { this->size(), this->size(), b.get_n_rows(), b.get_n_cols() }, "HODLR matrix" });
+            }
+
+            const mat<T> bp = this->to_permuted(b);
+            if ( this->nodes.empty() )
+               return b;
+            return this->from_permuted(this->solve_node(0, bp));
+         }
+
+   template <std::floating_point T>
+      template <typename Policy>
+         policy_result<Policy, std::vector<T>> hodlr<T>::solve(const std::vector<T>& b) const
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( !this->factorized )
+                  return Policy::template failure<std::vector<T>>({ mat_errc::not_factorized });
+               if ( b.size() != this->size() )
+                  return Policy::template failure<std::vector<T>>({ mat_errc::operator_apply_mismatch, { this->size(), this->size(), b.size(), 1 }, "HODLR matrix" });
+            }
+
+            mat<T> bm(b.size(), 1);
+            for ( size_t i = 0; i < b.size(); ++i )
+               bm.row(i)[0] = b[i];
+            const mat<T> x = this->template solve<unchecked_policy>(bm);
+            std::vector<T> out(x.get_n_rows());
+            for ( size_t i = 0; i < out.size(); ++i )
+               out[i] = x.get(i, 0);
+            return out;
+         }
+}
+#endif
@@ -0,0 +1,156 @@
+#ifndef IO
+#define IO
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "mat.cpp"
+#include "codec.cpp"
+
+namespace lawcat
+{
+   // On-disk layout (little-endian):
+   //
+   //   "LAWCATM1"                       magic and format version
+   //   u64 element size, rows, cols, tile rows, tile count
+   //   per tile: u64 chunk size, chunk  (see encode_chunk)
+   //
+   // Tiles are the chunks of compressed_mat, so a cold matrix is written and
+   // read back without being decompressed.
+   namespace detail
+   {
+      inline constexpr char io_magic[8] = { 'L', 'A', 'W', 'C', 'A', 'T', 'M', '1' };
+
+      // File errors name the path, so the whole message travels with the error.
+      [[noreturn]] inline void io_fail(const std::string& message)
+      {
+         default_policy::failure({ mat_errc::io_failure, {}, message });
+      }
+
+      inline void io_put_u64(std::ostream& out, const uint64_t& v)
+      {
+         char b[8];
+         for ( size_t i = 0; i < 8; ++i )
+            b[i] = char(uint8_t(v >> (8 * i)));
+         out.write(b, 8);
+      }
+
+      inline uint64_t io_get_u64(std::istream& in)
+      {
+         unsigned char b[8];
+         if ( !in.read(reinterpret_cast<char*>(b), 8) )
+            io_fail("ERROR: Unexpected end of matrix file.");
+         uint64_t v = 0;
+         for ( size_t i = 0; i < 8; ++i )
+            v |= uint64_t(b[i]) << (8 * i);
+         return v;
+      }
+
+      // Bytes between the read position and the end of in.
+      inline uint64_t io_remaining(std::istream& in)
+      {
+         const std::streampos here = in.tellg();
+         in.seekg(0, std::ios::end);
+         const std::streampos end = in.tellg();
+         in.seekg(here);
+         return uint64_t(end - here);
+      }
+
+      template <typename T>
+         void io_write(const std::string& path, const compressed_mat<T>& m_c)
+         {
+            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+            if ( !out )
+               io_fail("ERROR: Cannot open " + path + " for writing.");
+
+            out.write(io_magic, sizeof(io_magic));
+            io_put_u64(out, sizeof(T));
+            io_put_u64(out, m_c.get_n_rows());
+            io_put_u64(out, m_c.get_n_cols());
+            io_put_u64(out, m_c.get_tile_rows());
+            io_put_u64(out, m_c.get_n_tiles());
+            for ( size_t t = 0; t < m_c.get_n_tiles(); ++t )
+            {
+               const std::vector<uint8_t>& chunk = m_c.get_chunk(t);
+               io_put_u64(out, chunk.size());
+               out.write(reinterpret_cast<const char*>(chunk.data()), std::streamsize(chunk.size()));
+            }
+
+            if ( !out.flush() )
+               io_fail("ERROR: Failed writing " + path + ".");
+         }
+   }
+
+   // Writes m_a to path. With compress == false every tile is stored raw, which
+   // is the fastest option for incompressible data.
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      void save(const mat<T>& m_a, const std::string& path, const bool& compress = true)
+      {
+         const compressed_mat<T> m_c(m_a, compressed_mat<T>::default_tile_rows, compress ? codec_method::shuffle_lz : codec_method::stored);
+         detail::io_write(path, m_c);
+      }
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      void save(const compressed_mat<T>& m_c, const std::string& path)
+      {
+         detail::io_write(path, m_c);
+      }
+
+   // Reads a matrix file without decoding it.
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      compressed_mat<T> load_compressed(const std::string& path)
+      {
+         std::ifstream in(path, std::ios::binary);
+         if ( !in )
+            detail::io_fail("ERROR: Cannot open " + path + " for reading.");
+
+         char magic[sizeof(detail::io_magic)];
+         if ( !in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), detail::io_magic) )
+            detail::io_fail("ERROR: " + path + " is not a lawcat matrix file.");
+
+         if ( detail::io_get_u64(in) != sizeof(T) )
+            detail::io_fail("ERROR: Element size in " + path + " does not match the requested type.");
+
+         const uint64_t n_rows = detail::io_get_u64(in);
+         const uint64_t n_cols = detail::io_get_u64(in);
+         const uint64_t tile_rows = detail::io_get_u64(in);
+         const uint64_t n_tiles = detail::io_get_u64(in);
+         if ( tile_rows == 0 || n_tiles != (n_rows + tile_rows - 1) / tile_rows )
+            detail::io_fail("ERROR: Corrupt header in " + path + ".");
+
+         // Every length is checked against what the file still holds before
+         // anything is allocated, so a corrupt header cannot ask for more
+         // memory than the file could fill.
+         uint64_t remaining = detail::io_remaining(in);
+         if ( n_tiles > remaining / 8 )
+            detail::io_fail("ERROR: Unexpected end of matrix file.");
+
+         std::vector<std::vector<uint8_t>> chunks(n_tiles);
+         for ( std::vector<uint8_t>& chunk : chunks )
+         {
+            const uint64_t size = detail::io_get_u64(in);
+            remaining -= 8;
+            if ( size > remaining )
+               detail::io_fail("ERROR: Unexpected end of matrix file.");
+            remaining -= size;
+
+            chunk.resize(size);
+            if ( !in.read(reinterpret_cast<char*>(chunk.data()), std::streamsize(chunk.size())) )
+               detail::io_fail("ERROR: Unexpected end of matrix file.");
+         }
+
+         return compressed_mat<T>(n_rows, n_cols, tile_rows, std::move(chunks));
+      }
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      mat<T> load(const std::string& path)
+      {
+         return load_compressed<T>(path).to_mat();
+      }
+}
+#endif
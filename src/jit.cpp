@@ -0,0 +1,428 @@
+#ifndef JIT
+#define JIT
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define LAWCAT_JIT_X86_64 1
+#endif
+#include "mat.cpp"
+#include "gemm.cpp"
+
+namespace lawcat
+{
+   // Runtime code generation of shape-specialised kernels for x86-64.
+   //
+   // jit_gemm and jit_elementwise emit AVX2/FMA machine code with M, N and K
+   // baked in: the column loop is fully unrolled into ymm accumulators (up to
+   // 13 live at a time, the N % width tail in scalar registers), the K loop
+   // is a counted loop with immediate bounds, and the epilogue is fused into
+   // the stores. Kernels are cached per (type, shape, operation) for the life
+   // of the process and mapped W^X.
+   //
+   // The generator is used only on x86-64 Linux when the CPU reports AVX2 and
+   // FMA, jit_enable(true) is in effect (the default) and LAWCAT_NO_JIT is not
+   // set in the environment. Otherwise, and for shapes it does not handle,
+   // the same calls run the static kernels.
+   enum class jit_epilogue
+   {
+      store,
+      accumulate,
+      // max(x, 0) as std::max(x, T(0)) computes it: NaN and -0 are kept.
+      relu
+   };
+
+   enum class jit_op
+   {
+      add,
+      sub,
+      mul
+   };
+
+   namespace detail
+   {
+      inline std::atomic<bool>& jit_switch()
+      {
+         static std::atomic<bool> on(std::getenv("LAWCAT_NO_JIT") == nullptr);
+         return on;
+      }
+
+      // Largest unrolled column count the generator accepts; wider rows go
+      // to the static kernels rather than producing very large code.
+      inline constexpr size_t jit_max_cols = 4096;
+
+      enum x86_reg : int
+      {
+         rax = 0, rcx = 1, rdx = 2, rbx = 3, rsp = 4, rbp = 5, rsi = 6, rdi = 7,
+         r8 = 8, r9 = 9, r10 = 10, r11 = 11
+      };
+
+      struct x86_mem
+      {
+         int base;
+         int index;
+         int scale;
+         int32_t disp;
+      };
+
+      // Just enough of an x86-64 assembler for the kernels below. Memory
+      // operands always use a 32-bit displacement, and VEX instructions the
+      // three-byte prefix.
+      class x86_emitter
+      {
+         public:
+            std::vector<uint8_t> code;
+
+            size_t here() const { return this->code.size(); }
+
+            void mov_load(const int& dst, const x86_mem& m) { this->rex_w(dst, m.index, m.base); this->byte(0x8B); this->modrm_mem(dst, m); }
+            void mov_imm(const int& dst, const int32_t& v) { this->rex_w(0, -1, dst); this->byte(0xC7); this->byte(0xC0 | (dst & 7)); this->dword(v); }
+            void inc(const int& r) { this->rex_w(0, -1, r); this->byte(0xFF); this->byte(0xC0 | (r & 7)); }
+            void cmp_imm(const int& r, const int32_t& v) { this->rex_w(0, -1, r); this->byte(0x81); this->byte(0xF8 | (r & 7)); this->dword(v); }
+            void jne(const size_t& target)
+            {
+               this->byte(0x0F);
+               this->byte(0x85);
+               this->dword(int32_t(int64_t(target) - int64_t(this->here() + 4)));
+            }
+            void vzeroupper() { this->byte(0xC5); this->byte(0xF8); this->byte(0x77); }
+            void ret() { this->byte(0xC3); }
+
+            // op reg, vvvv, rm (register form).
+            void vex_rr(const uint8_t& op, const int& map, const int& pp, const int& w, const int& l, const int& reg, const int& vvvv, const int& rm)
+            {
+               this->vex(map, pp, w, l, reg, vvvv, 0, rm);
+               this->byte(op);
+               this->byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+            }
+
+            // op reg, vvvv, [m] (memory form).
+            void vex_rm(const uint8_t& op, const int& map, const int& pp, const int& w, const int& l, const int& reg, const int& vvvv, const x86_mem& m)
+            {
+               this->vex(map, pp, w, l, reg, vvvv, m.index < 0 ? 0 : m.index, m.base);
+               this->byte(op);
+               this->modrm_mem(reg, m);
+            }
+
+         private:
+            void byte(const uint8_t& b) { this->code.push_back(b); }
+            void dword(const int32_t& v)
+            {
+               for ( size_t i = 0; i < 4; ++i )
+                  this->byte(uint8_t(uint32_t(v) >> (8 * i)));
+            }
+
+            void rex_w(const int& reg, const int& index, const int& base)
+            {
+               this->byte(0x48 | (((reg >> 3) & 1) << 2) | (((index < 0 ? 0 : index >> 3) & 1) << 1) | ((base >> 3) & 1));
+            }
+
+            void modrm_mem(const int& reg, const x86_mem& m)
+            {
+               if ( m.index < 0 && (m.base & 7) != rsp )
+                  this->byte(0x80 | ((reg & 7) << 3) | (m.base & 7));
+               else
+               {
+                  const int ss = m.scale == 8 ? 3 : m.scale == 4 ? 2 : m.scale == 2 ? 1 : 0;
+                  this->byte(0x80 | ((reg & 7) << 3) | 4);
+                  this->byte((ss << 6) | ((m.index < 0 ? 4 : m.index & 7) << 3) | (m.base & 7));
+               }
+               this->dword(m.disp);
+            }
+
+            void vex(const int& map, const int& pp, const int& w, const int& l, const int& reg, const int& vvvv, const int& x, const int& b)
+            {
+               this->byte(0xC4);
+               this->byte((((~reg >> 3) & 1) << 7) | (((~x >> 3) & 1) << 6) | (((~b >> 3) & 1) << 5) | map);
+               this->byte((w << 7) | ((~vvvv & 15) << 3) | (l << 2) | pp);
+            }
+      };
+
+      // Encoding parameters that differ between float and double.
+      template <typename T>
+         struct avx_type
+         {
+            static constexpr bool is_double = std::is_same_v<T, double>;
+            static constexpr int width = 32 / sizeof(T);
+            static constexpr int w = is_double ? 1 : 0;
+            static constexpr int packed_pp = is_double ? 1 : 0;   // 66 for pd, none for ps
+            static constexpr int scalar_pp = is_double ? 3 : 2;   // F2 for sd, F3 for ss
+            static constexpr uint8_t broadcast_op = is_double ? 0x19 : 0x18;
+         };
+
+      inline constexpr int map_0f = 1;
+      inline constexpr int map_0f38 = 2;
+
+      // Register conventions (System V): rdi = a rows, rsi = b rows, rdx = c
+      // rows; r8 row counter, r10 k counter, rax/r11/r9 current row pointers.
+      // ymm0-12 accumulate, ymm14 holds zero, ymm15 the broadcast of a[i][p].
+      inline constexpr int jit_accumulators = 13;
+
+      template <typename T>
+         std::vector<uint8_t> emit_gemm(const size_t& m, const size_t& n, const size_t& k, const jit_epilogue& epilogue)
+         {
+            using A = avx_type<T>;
+            constexpr int sz = sizeof(T);
+            x86_emitter e;
+
+            // A slot is one accumulator: a full vector or one tail element.
+            struct slot { bool vector; int col; };
+            std::vector<slot> slots;
+            for ( size_t c = 0; c + A::width <= n; c += A::width )
+               slots.push_back({ true, int(c) });
+            for ( size_t c = n - n % A::width; c < n; ++c )
+               slots.push_back({ false, int(c) });
+
+            e.vex_rr(0x57, map_0f, 0, 0, 1, 14, 14, 14);               // vxorps ymm14, ymm14, ymm14
+            e.mov_imm(r8, 0);
+            const size_t row_loop = e.here();
+            e.mov_load(rax, { rdi, r8, 8, 0 });
+            e.mov_load(r9, { rdx, r8, 8, 0 });
+
+            for ( size_t s0 = 0; s0 < slots.size(); s0 += jit_accumulators )
+            {
+               const size_t s1 = std::min(slots.size(), s0 + jit_accumulators);
+               for ( size_t s = s0; s < s1; ++s )
+                  e.vex_rr(0x57, map_0f, 0, 0, 1, int(s - s0), int(s - s0), int(s - s0));
+
+               e.mov_imm(r10, 0);
+               const size_t k_loop = e.here();
+               e.vex_rm(A::broadcast_op, map_0f38, 1, 0, 1, 15, 0, { rax, r10, sz, 0 });
+               e.mov_load(r11, { rsi, r10, 8, 0 });
+               for ( size_t s = s0; s < s1; ++s )
+               {
+                  const int acc = int(s - s0);
+                  const x86_mem src { r11, -1, 1, slots[s].col * sz };
+                  if ( slots[s].vector )
+                     e.vex_rm(0xB8, map_0f38, 1, A::w, 1, acc, 15, src);   // vfmadd231p acc, ymm15, [b + col]
+                  else
+                     e.vex_rm(0xB9, map_0f38, 1, A::w, 0, acc, 15, src);   // vfmadd231s acc, xmm15, [b + col]
+               }
+               e.inc(r10);
+               e.cmp_imm(r10, int32_t(k));
+               e.jne(k_loop);
+
+               for ( size_t s = s0; s < s1; ++s )
+               {
+                  const int acc = int(s - s0);
+                  const x86_mem dst { r9, -1, 1, slots[s].col * sz };
+                  const int pp = slots[s].vector ? A::packed_pp : A::scalar_pp;
+                  const int l = slots[s].vector ? 1 : 0;
+                  if ( epilogue == jit_epilogue::accumulate )
+                     e.vex_rm(0x58, map_0f, pp, 0, l, acc, acc, dst);      // vadd acc, acc, [c + col]
+                  else if ( epilogue == jit_epilogue::relu )
+                     e.vex_rr(0x5F, map_0f, pp, 0, l, acc, 14, acc);       // vmax acc, zero, acc: NaN and -0 pass through
+                  e.vex_rm(0x11, map_0f, pp, 0, l, acc, 0, dst);           // vmovu / vmovs [c + col], acc
+               }
+            }
+
+            e.inc(r8);
+            e.cmp_imm(r8, int32_t(m));
+            e.jne(row_loop);
+            e.vzeroupper();
+            e.ret();
+            return e.code;
+         }
+
+      template <typename T>
+         std::vector<uint8_t> emit_elementwise(const size_t& m, const size_t& n, const jit_op& op)
+         {
+            using A = avx_type<T>;
+            constexpr int sz = sizeof(T);
+            const uint8_t opcode = op == jit_op::add ? 0x58 : op == jit_op::sub ? 0x5C : 0x59;
+            x86_emitter e;
+
+            e.mov_imm(r8, 0);
+            const size_t row_loop = e.here();
+            e.mov_load(rax, { rdi, r8, 8, 0 });
+            e.mov_load(r11, { rsi, r8, 8, 0 });
+            e.mov_load(r9, { rdx, r8, 8, 0 });
+            for ( size_t c = 0; c < n; )
+            {
+               const bool vector = c + A::width <= n;
+               const int pp = vector ? A::packed_pp : A::scalar_pp;
+               const int l = vector ? 1 : 0;
+               const int32_t disp = int32_t(c * sz);
+               e.vex_rm(0x10, map_0f, pp, 0, l, 0, 0, { rax, -1, 1, disp });   // load a
+               e.vex_rm(opcode, map_0f, pp, 0, l, 0, 0, { r11, -1, 1, disp }); // op with b
+               e.vex_rm(0x11, map_0f, pp, 0, l, 0, 0, { r9, -1, 1, disp });    // store c
+               c += vector ? A::width : 1;
+            }
+            e.inc(r8);
+            e.cmp_imm(r8, int32_t(m));
+            e.jne(row_loop);
+            e.vzeroupper();
+            e.ret();
+            return e.code;
+         }
+
+      // Executable copy of generated code, unmapped on destruction.
+      class jit_code
+      {
+         public:
+            explicit jit_code(const std::vector<uint8_t>& code)
+            {
+#if defined(LAWCAT_JIT_X86_64)
+               this->size = code.size();
+               void* p = mmap(nullptr, this->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+               if ( p == MAP_FAILED )
+                  return;
+               std::memcpy(p, code.data(), code.size());
+               if ( mprotect(p, this->size, PROT_READ | PROT_EXEC) != 0 )
+               {
+                  munmap(p, this->size);
+                  return;
+               }
+               this->entry = p;
+#else
+               (void)code;
+#endif
+            }
+            jit_code(const jit_code&) = delete;
+            jit_code& operator=(const jit_code&) = delete;
+            ~jit_code()
+            {
+#if defined(LAWCAT_JIT_X86_64)
+               if ( this->entry != nullptr )
+                  munmap(this->entry, this->size);
+#endif
+            }
+
+            const void* get() const { return this->entry; }
+
+         private:
+            void* entry = nullptr;
+            size_t size = 0;
+      };
+
+      // Kind, element size, m, n, k and operation/epilogue.
+      using jit_key = std::tuple<int, size_t, size_t, size_t, size_t, int>;
+
+      inline std::mutex& jit_cache_lock()
+      {
+         static std::mutex lock;
+         return lock;
+      }
+
+      inline std::map<jit_key, std::unique_ptr<jit_code>>& jit_cache()
+      {
+         static std::map<jit_key, std::unique_ptr<jit_code>> cache;
+         return cache;
+      }
+
+      template <typename F>
+         const void* jit_lookup(const jit_key& key, F&& emit)
+         {
+            std::lock_guard<std::mutex> guard(jit_cache_lock());
+            std::unique_ptr<jit_code>& entry = jit_cache()[key];
+            if ( !entry )
+               entry = std::make_unique<jit_code>(emit());
+            return entry->get();
+         }
+
+      template <typename T>
+         using jit_kernel = void (*)(const T* const*, const T* const*, T* const*);
+   }
+
+   inline bool jit_supported()
+   {
+#if defined(LAWCAT_JIT_X86_64)
+      static const bool ok = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+      return ok;
+#else
+      return false;
+#endif
+   }
+
+   inline void jit_enable(const bool& on) { detail::jit_switch().store(on); }
+   inline bool jit_active() { return jit_supported() && detail::jit_switch().load(); }
+
+   // Number of generated kernels currently cached.
+   inline size_t jit_cache_size()
+   {
+      std::lock_guard<std::mutex> guard(detail::jit_cache_lock());
+      return detail::jit_cache().size();
+   }
+
+   // c = a * b, c += a * b or c = max(a * b, 0), with c already sized m x n.
+   template <typename T>
+      requires std::is_same_v<T, float> || std::is_same_v<T, double>
+      void jit_gemm(const mat<T>& m_a, const mat<T>& m_b, mat<T>& m_c, const jit_epilogue& epilogue = jit_epilogue::store)
+      {
+         const size_t m = m_a.get_n_rows();
+         const size_t k = m_a.get_n_cols();
+         const size_t n = m_b.get_n_cols();
+         check_product_dimensions(m, k, m_b.get_n_rows(), n);
+         check_matrix_dimensions(m_c.get_n_rows(), m_c.get_n_cols(), m, n);
+
+         if ( jit_active() && m > 0 && n > 0 && k > 0 && n <= detail::jit_max_cols && m < (size_t(1) << 31) && k < (size_t(1) << 31) )
+         {
+            const detail::jit_key key { 0, sizeof(T), m, n, k, int(epilogue) };
+            const void* code = detail::jit_lookup(key, [&]() { return detail::emit_gemm<T>(m, n, k, epilogue); });
+            if ( code != nullptr )
+            {
+               reinterpret_cast<detail::jit_kernel<T>>(const_cast<void*>(code))(m_a.rows(), m_b.rows(), m_c.rows());
+               return;
+            }
+         }
+
+         const mat<T> prod = gemm(m_a, m_b);
+         for ( size_t i = 0; i < m; ++i )
+         {
+            const T* p = prod.row(i);
+            T* c = m_c.row(i);
+            for ( size_t j = 0; j < n; ++j )
+               c[j] = epilogue == jit_epilogue::accumulate ? c[j] + p[j] : epilogue == jit_epilogue::relu ? std::max(p[j], T(0)) : p[j];
+         }
+      }
+
+   template <typename T>
+      requires std::is_same_v<T, float> || std::is_same_v<T, double>
+      mat<T> jit_gemm(const mat<T>& m_a, const mat<T>& m_b, const jit_epilogue& epilogue = jit_epilogue::store)
+      {
+         mat<T> out(m_a.get_n_rows(), m_b.get_n_cols());
+         jit_gemm(m_a, m_b, out, epilogue == jit_epilogue::accumulate ? jit_epilogue::store : epilogue);
+         return out;
+      }
+
+   // c = a op b elementwise, with c already sized like a.
+   template <typename T>
+      requires std::is_same_v<T, float> || std::is_same_v<T, double>
+      void jit_elementwise(const jit_op& op, const mat<T>& m_a, const mat<T>& m_b, mat<T>& m_c)
+      {
+         const size_t m = m_a.get_n_rows();
+         const size_t n = m_a.get_n_cols();
+         check_matrix_dimensions(m, n, m_b.get_n_rows(), m_b.get_n_cols());
+         check_matrix_dimensions(m, n, m_c.get_n_rows(), m_c.get_n_cols());
+
+         if ( jit_active() && m > 0 && n > 0 && n <= detail::jit_max_cols && m < (size_t(1) << 31) )
+         {
+            const detail::jit_key key { 1, sizeof(T), m, n, 0, int(op) };
+            const void* code = detail::jit_lookup(key, [&]() { return detail::emit_elementwise<T>(m, n, op); });
+            if ( code != nullptr )
+            {
+               reinterpret_cast<detail::jit_kernel<T>>(const_cast<void*>(code))(m_a.rows(), m_b.rows(), m_c.rows());
+               return;
+            }
+         }
+
+         for ( size_t i = 0; i < m; ++i )
+         {
+            const T* x = m_a.row(i);
+            const T* y = m_b.row(i);
+            T* z = m_c.row(i);
+            for ( size_t j = 0; j < n; ++j )
+               z[j] = op == jit_op::add ? x[j] + y[j] : op == jit_op::sub ? x[j] - y[j] : x[j] * y[j];
+         }
+      }
+}
+#endif
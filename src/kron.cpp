@@ -0,0 +1,147 @@
+#ifndef KRON
+#define KRON
+#include <vector>
+#include "mat.cpp"
+#include "gemm.cpp"
+#include "parallel.cpp"
+
+namespace lawcat
+{
+   // Kronecker product, (m * p) x (n * q). Each output row is a sequence of
+   // scaled copies of one row of m_b.
+   template <typename T>
+      mat<T> kron(const mat<T>& m_a, const mat<T>& m_b)
+      {
+         const size_t p = m_b.get_n_rows();
+         const size_t q = m_b.get_n_cols();
+         mat<T> out(m_a.get_n_rows() * p, m_a.get_n_cols() * q);
+
+         parallel_for(0, m_a.get_n_rows(), [&](size_t lo, size_t hi) {
+            for ( size_t i = lo; i < hi; ++i )
+               for ( size_t k = 0; k < p; ++k )
+               {
+                  const T* b_row = m_b.row(k);
+                  T* dst = out.row(i * p + k);
+                  for ( size_t j = 0; j < m_a.get_n_cols(); ++j )
+                  {
+                     const T a_ij = m_a.row(i)[j];
+                     for ( size_t l = 0; l < q; ++l )
+                        dst[j * q + l] = a_ij * b_row[l];
+                  }
+               }
+         });
+
+         return out;
+      }
+
+   template <typename T>
+      mat<T> outer(const std::vector<T>& u, const std::vector<T>& v)
+      {
+         mat<T> out(u.size(), v.size());
+
+         parallel_for(0, u.size(), [&](size_t lo, size_t hi) {
+            for ( size_t i = lo; i < hi; ++i )
+            {
+               T* dst = out.row(i);
+               for ( size_t j = 0; j < v.size(); ++j )
+                  dst[j] = u[i] * v[j];
+            }
+         });
+
+         return out;
+      }
+
+   // Column-wise Kronecker product of an m x k and an n x k matrix, (m * n) x k.
+   // Shapes are checked per Policy.
+   template <typename Policy = default_policy, typename T>
+      policy_result<Policy, mat<T>> khatri_rao(const mat<T>& m_a, const mat<T>& m_b)
+      {
+         if constexpr ( Policy::checked )
+         {
+            if ( m_a.get_n_cols() != m_b.get_n_cols() )
+               return Policy::template failure<mat<T>>({ mat_errc::khatri_rao_mismatch, { m_a.get_n_rows(), m_a.get_n_cols(), m_b.get_n_rows(), m_b.get_n_cols() } });
+         }
+
+         const size_t n = m_b.get_n_rows();
+         const size_t k = m_a.get_n_cols();
+         mat<T> out(m_a.get_n_rows() * n, k);
+
+         parallel_for(0, m_a.get_n_rows(), [&](size_t lo, size_t hi) {
+            for ( size_t i = lo; i < hi; ++i )
+               for ( size_t j = 0; j < n; ++j )
+               {
+                  const T* a_row = m_a.row(i);
+                  const T* b_row = m_b.row(j);
+                  T* dst = out.row(i * n + j);
+                  for ( size_t c = 0; c < k; ++c )
+                     dst[c] = a_row[c] * b_row[c];
+               }
+         });
+
+         return out;
+      }
+
+   // A (x) B kept as its two factors. With row-major vectorisation,
+   // (A (x) B) vec(X) = vec(A X B^T) for X of shape n_cols(A) x n_cols(B), which
+   // is the column-major identity (A (x) B) vec(X) = vec(B X A^T) transposed.
+   // A product costs two GEMMs and O(mp + nq) memory instead of O(mnpq).
+   template <typename T>
+      class kronecker_operator
+      {
+         public:
+            kronecker_operator(const mat<T>& m_a, const mat<T>& m_b) : a(m_a), b(m_b) {}
+
+            size_t get_n_rows() const { return this->a.get_n_rows() * this->b.get_n_rows(); }
+            size_t get_n_cols() const { return this->a.get_n_cols() * this->b.get_n_cols(); }
+
+            // The length of x is checked per Policy.
+            template <typename Policy = default_policy>
+               policy_result<Policy, std::vector<T>> matvec(const std::vector<T>& x) const
+               {
+                  if constexpr ( Policy::checked )
+                  {
+                     if ( x.size() != this->get_n_cols() )
+                        return Policy::template failure<std::vector<T>>({ mat_errc::operator_vector_mismatch, { this->get_n_rows(), this->get_n_cols(), x.size() }, "Kronecker product" });
+                  }
+
+                  mat<T> xm(this->a.get_n_cols(), this->b.get_n_cols());
+                  for ( size_t j = 0; j < xm.get_n_rows(); ++j )
+                     std::copy(x.begin() + j * xm.get_n_cols(), x.begin() + (j + 1) * xm.get_n_cols(), xm.row(j));
+
+                  const mat<T> y = gemm<unchecked_policy>(this->a, gemm_nt<unchecked_policy>(xm, this->b));
+
+                  std::vector<T> out;
+                  out.reserve(this->get_n_rows());
+                  for ( size_t i = 0; i < y.get_n_rows(); ++i )
+                     out.insert(out.end(), y.row(i), y.row(i) + y.get_n_cols());
+                  return out;
+               }
+
+            // Applies the operator to every row of xs, whose length is checked
+            // per Policy.
+            template <typename Policy = default_policy>
+               policy_result<Policy, mat<T>> apply_rows(const mat<T>& xs) const
+               {
+                  if constexpr ( Policy::checked )
+                  {
+                     if ( xs.get_n_cols() != this->get_n_cols() )
+                        return Policy::template failure<mat<T>>({ mat_errc::operator_row_mismatch, { this->get_n_rows(), this->get_n_cols(), xs.get_n_cols() }, "Kronecker product" });
+                  }
+
+                  mat<T> out(xs.get_n_rows(), this->get_n_rows());
+                  for ( size_t r = 0; r < xs.get_n_rows(); ++r )
+                  {
+                     const std::vector<T> y = this->template matvec<unchecked_policy>(std::vector<T>(xs.row(r), xs.row(r) + xs.get_n_cols()));
+                     std::copy(y.begin(), y.end(), out.row(r));
+                  }
+                  return out;
+               }
+
+            mat<T> to_dense() const { return kron(this->a, this->b); }
+
+         private:
+            mat<T> a;
+            mat<T> b;
+      };
+}
+#endif
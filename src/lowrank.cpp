@@ -0,0 +1,344 @@
+#ifndef LOWRANK
+#define LOWRANK
+#include <algorithm>
+#include <cmath>
+#include <concepts>
+#include <limits>
+#include <vector>
+#include "mat.cpp"
+#include "decomp.cpp"
+#include "gemm.cpp"
+
+namespace lawcat
+{
+   // A = U V^T with U m x k and V n x k. Storage and matvec cost O((m + n) k).
+   // Sums and Hadamard products grow the rank and are recompressed by QR of
+   // both factors and an SVD of the small k x k core, keeping the singular
+   // values above tol times the largest one.
+   template <std::floating_point T>
+      class low_rank
+      {
+         public:
+            static constexpr T default_tol = std::numeric_limits<T>::epsilon() * T(64);
+
+            low_rank(const mat<T>& u, const mat<T>& v, const T& tol = default_tol);
+
+            // Partially pivoted adaptive cross approximation from an entry
+            // oracle entry(i, j). Only O((m + n) k) entries are ever evaluated.
+            template <typename F>
+               static low_rank<T> aca(const size_t& n_rows, const size_t& n_cols, F&& entry, const T& tol, const size_t& max_rank = 0);
+
+            static low_rank<T> from_dense(const mat<T>& m_a, const T& tol, const size_t& max_rank = 0);
+
+            size_t get_n_rows() const { return this->u.get_n_rows(); }
+            size_t get_n_cols() const { return this->v.get_n_rows(); }
+            size_t get_rank() const { return this->u.get_n_cols(); }
+            const mat<T>& get_u() const { return this->u; }
+            const mat<T>& get_v() const { return this->v; }
+            const T& get_tol() const { return this->tol; }
+
+            // Shapes are checked per Policy; the operators use default_policy.
+            template <typename Policy = default_policy>
+               policy_result<Policy, std::vector<T>> matvec(const std::vector<T>& x) const;
+            template <typename Policy = default_policy>
+               policy_result<Policy, mat<T>> multiply(const mat<T>& other) const;
+            mat<T> operator*(const mat<T>& other) const { return this->multiply(other); }
+            mat<T> to_dense() const { return gemm_nt(this->u, this->v); }
+
+            template <typename Policy = default_policy>
+               policy_result<Policy, low_rank<T>> add(const low_rank<T>& other) const;
+            template <typename Policy = default_policy>
+               policy_result<Policy, low_rank<T>> sub(const low_rank<T>& other) const;
+            low_rank<T> operator+(const low_rank<T>& other) const { return this->add(other); }
+            low_rank<T> operator-(const low_rank<T>& other) const { return this->sub(other); }
+            template <typename Policy = default_policy>
+               static policy_result<Policy, low_rank<T>> hadamard_product(const low_rank<T>& lr_a, const low_rank<T>& lr_b);
+
+            T frobenius_norm() const;
+
+            // Singular values at or below tol * max(sigma_max, reference) are
+            // dropped. Passing the norm of the operands as reference lets
+            // cancellation (A - A) collapse to rank zero.
+            void recompress(const T& tol, const size_t& max_rank = 0, const T& reference = T(0));
+
+         private:
+            mat<T> u;
+            mat<T> v;
+            T tol;
+      };
+
+   template <std::floating_point T>
+      low_rank<T>::low_rank(const mat<T>& u, const mat<T>& v, const T& tol) : u(u), v(v), tol(tol)
+      {
+         if ( u.get_n_cols() != v.get_n_cols() )
+            default_policy::failure({ mat_errc::factor_mismatch, { u.get_n_cols(), v.get_n_cols() } });
+      }
+
+   template <std::floating_point T>
+      template <typename F>
+         low_rank<T> low_rank<T>::aca(const size_t& n_rows, const size_t& n_cols, F&& entry, const T& tol, const size_t& max_rank)
+         {
+            const size_t limit = max_rank == 0 ? std::min(n_rows, n_cols) : std::min({ max_rank, n_rows, n_cols });
+            std::vector<std::vector<T>> us;
+            std::vector<std::vector<T>> vs;
+            std::vector<bool> used_row(n_rows, false);
+            T frob_sq = T(0);
+            size_t pivot_row = 0;
+
+            while ( us.size() < limit )
+            {
+               used_row[pivot_row] = true;
+
+               std::vector<T> r(n_cols);
+               for ( size_t j = 0; j < n_cols; ++j )
+               {
+                  r[j] = entry(pivot_row, j);
+                  for ( size_t k = 0; k < us.size(); ++k )
+                     r[j] -= us[k][pivot_row] * vs[k][j];
+               }
+
+               size_t pivot_col = 0;
+               for ( size_t j = 1; j < n_cols; ++j )
+                  if ( std::abs(r[j]) > std::abs(r[pivot_col]) )
+                     pivot_col = j;
+
+               if ( n_cols == 0 || r[pivot_col] == T(0) )
+               {
+                  const auto next = std::find(used_row.begin(), used_row.end(), false);
+                  if ( next == used_row.end() )
+                     break;
+                  pivot_row = size_t(next - used_row.begin());
+                  continue;
+               }
+
+               const T inv = T(1) / r[pivot_col];
+               for ( T& x : r )
+                  x *= inv;
+
+               std::vector<T> c(n_rows);
+               for ( size_t i = 0; i < n_rows; ++i )
+               {
+                  c[i] = entry(i, pivot_col);
+                  for ( size_t k = 0; k < us.size(); ++k )
+                     c[i] -= vs[k][pivot_col] * us[k][i];
+               }
+
+               T u_sq = T(0);
+               T v_sq = T(0);
+               for ( const T& x : c )
+                  u_sq += x * x;
+               for ( const T& x : r )
+                  v_sq += x * x;
+
+               T cross = T(0);
+               for ( size_t k = 0; k < us.size(); ++k )
+               {
+                  T uu = T(0);
+                  T vv = T(0);
+                  for ( size_t i = 0; i < n_rows; ++i )
+                     uu += c[i] * us[k][i];
+                  for ( size_t j = 0; j < n_cols; ++j )
+                     vv += r[j] * vs[k][j];
+                  cross += uu * vv;
+               }
+               frob_sq += u_sq * v_sq + T(2) * cross;
+
+               us.push_back(std::move(c));
+               vs.push_back(std::move(r));
+
+               if ( std::sqrt(u_sq * v_sq) <= tol * std::sqrt(std::max(frob_sq, T(0))) )
+                  break;
+
+               pivot_row = n_rows;
+               for ( size_t i = 0; i < n_rows; ++i )
+                  if ( !used_row[i] && (pivot_row == n_rows || std::abs(us.back()[i]) > std::abs(us.back()[pivot_row])) )
+                     pivot_row = i;
+               if ( pivot_row == n_rows )
+                  break;
+            }
+
+            mat<T> u(n_rows, us.size());
+            mat<T> v(n_cols, vs.size());
+            for ( size_t k = 0; k < us.size(); ++k )
+            {
+               for ( size_t i = 0; i < n_rows; ++i )
+                  u.row(i)[k] = us[k][i];
+               for ( size_t j = 0; j < n_cols; ++j )
+                  v.row(j)[k] = vs[k][j];
+            }
+
+            low_rank<T> out(u, v, tol);
+            out.recompress(tol, max_rank);
+            return out;
+         }
+
+   template <std::floating_point T>
+      low_rank<T> low_rank<T>::from_dense(const mat<T>& m_a, const T& tol, const size_t& max_rank)
+      {
+         return aca(m_a.get_n_rows(), m_a.get_n_cols(), [&](size_t i, size_t j) { return m_a.get(i, j); }, tol, max_rank);
+      }
+
+   template <std::floating_point T>
+      template <typename Policy>
+         policy_result<Policy, std::vector<T>> low_rank<T>::matvec(const std::vector<T>& x) const
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( x.size() != this->get_n_cols() )
+                  return Policy::template failure<std::vector<T>>({ mat_errc::operator_vector_mismatch, { this->get_n_rows(), this->get_n_cols(), x.size() }, "low-rank matrix" });
+            }
+
+            std::vector<T> t(this->get_rank(), T(0));
+            for ( size_t j = 0; j < this->get_n_cols(); ++j )
+            {
+               const T* v_row = this->v.row(j);
+               for ( size_t k = 0; k < t.size(); ++k )
+                  t[k] += v_row[k] * x[j];
+            }
+
+            std::vector<T> y(this->get_n_rows());
+            for ( size_t i = 0; i < y.size(); ++i )
+            {
+               const T* u_row = this->u.row(i);
+               T acc = T(0);
+               for ( size_t k = 0; k < t.size(); ++k )
+                  acc += u_row[k] * t[k];
+               y[i] = acc;
+            }
+            return y;
+         }
+
+   template <std::floating_point T>
+      template <typename Policy>
+         policy_result<Policy, mat<T>> low_rank<T>::multiply(const mat<T>& other) const
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( other.get_n_rows() != this->get_n_cols() )
+                  return Policy::template failure<mat<T>>({ mat_errc::operator_product_mismatch, { this->get_n_rows(), this->get_n_cols(), other.get_n_rows(), other.get_n_cols() }, "low-rank matrix" });
+            }
+
+            return gemm<unchecked_policy>(this->u, gemm<unchecked_policy>(transpose(this->v), other));
+         }
+
+   template <std::floating_point T>
+      template <typename Policy>
+         policy_result<Policy, low_rank<T>> low_rank<T>::add(const low_rank<T>& other) const
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( this->get_n_rows() != other.get_n_rows() || this->get_n_cols() != other.get_n_cols() )
+                  return Policy::template failure<low_rank<T>>({ mat_errc::dimension_mismatch, { this->get_n_rows(), this->get_n_cols(), other.get_n_rows(), other.get_n_cols() } });
+            }
+
+            const size_t k = this->get_rank() + other.get_rank();
+            mat<T> u(this->get_n_rows(), k);
+            mat<T> v(this->get_n_cols(), k);
+            for ( size_t i = 0; i < u.get_n_rows(); ++i )
+            {
+               std::copy(this->u.row(i), this->u.row(i) + this->get_rank(), u.row(i));
+               std::copy(other.u.row(i), other.u.row(i) + other.get_rank(), u.row(i) + this->get_rank());
+            }
+            for ( size_t j = 0; j < v.get_n_rows(); ++j )
+            {
+               std::copy(this->v.row(j), this->v.row(j) + this->get_rank(), v.row(j));
+               std::copy(other.v.row(j), other.v.row(j) + other.get_rank(), v.row(j) + this->get_rank());
+            }
+
+            low_rank<T> out(u, v, std::max(this->tol, other.tol));
+            out.recompress(out.tol, 0, std::max(this->frobenius_norm(), other.frobenius_norm()));
+            return out;
+         }
+
+   template <std::floating_point T>
+      template <typename Policy>
+         policy_result<Policy, low_rank<T>> low_rank<T>::sub(const low_rank<T>& other) const
+         {
+            mat<T> neg_u = other.u;
+            for ( size_t i = 0; i < neg_u.get_n_rows(); ++i )
+               for ( size_t k = 0; k < neg_u.get_n_cols(); ++k )
+                  neg_u.row(i)[k] = -neg_u.row(i)[k];
+            return this->template add<Policy>(low_rank<T>(neg_u, other.v, other.tol));
+         }
+
+   // (U1 V1^T) o (U2 V2^T) = (U1 * U2)(V1 * V2)^T, where * is the row-wise
+   // Kronecker (face-splitting) product. The rank multiplies, then recompresses.
+   template <std::floating_point T>
+      template <typename Policy>
+         policy_result<Policy, low_rank<T>> low_rank<T>::hadamard_product(const low_rank<T>& lr_a, const low_rank<T>& lr_b)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( lr_a.get_n_rows() != lr_b.get_n_rows() || lr_a.get_n_cols() != lr_b.get_n_cols() )
+                  return Policy::template failure<low_rank<T>>({ mat_errc::dimension_mismatch, { lr_a.get_n_rows(), lr_a.get_n_cols(), lr_b.get_n_rows(), lr_b.get_n_cols() } });
+            }
+
+            const size_t ka = lr_a.get_rank();
+            const size_t kb = lr_b.get_rank();
+            const auto face_split = [&](const mat<T>& f_a, const mat<T>& f_b) {
+               mat<T> out(f_a.get_n_rows(), ka * kb);
+               for ( size_t i = 0; i < f_a.get_n_rows(); ++i )
+                  for ( size_t p = 0; p < ka; ++p )
+                     for ( size_t q = 0; q < kb; ++q )
+                        out.row(i)[p * kb + q] = f_a.row(i)[p] * f_b.row(i)[q];
+               return out;
+            };
+
+            low_rank<T> out(face_split(lr_a.u, lr_b.u), face_split(lr_a.v, lr_b.v), std::max(lr_a.tol, lr_b.tol));
+            out.recompress(out.tol);
+            return out;
+         }
+
+   // ||U V^T||_F^2 = trace((U^T U)(V^T V)), O((m + n) k^2).
+   template <std::floating_point T>
+      T low_rank<T>::frobenius_norm() const
+      {
+         const mat<T> uu = gemm(transpose(this->u), this->u);
+         const mat<T> vv = gemm(transpose(this->v), this->v);
+         T acc = T(0);
+         for ( size_t i = 0; i < uu.get_n_rows(); ++i )
+            for ( size_t j = 0; j < uu.get_n_cols(); ++j )
+               acc += uu.get(i, j) * vv.get(j, i);
+         return std::sqrt(std::max(acc, T(0)));
+      }
+
+   template <std::floating_point T>
+      void low_rank<T>::recompress(const T& tol, const size_t& max_rank, const T& reference)
+      {
+         if ( this->get_rank() == 0 )
+            return;
+
+         const qr_result<T> qu = qr_thin(this->u);
+         const qr_result<T> qv = qr_thin(this->v);
+         const svd_result<T> core = svd_jacobi(gemm_nt(qu.r, qv.r));
+
+         // With no rows on either side there are no singular values; the
+         // product is empty and rank 0 represents it exactly.
+         if ( core.s.empty() )
+         {
+            this->u = mat<T>(this->u.get_n_rows(), 0);
+            this->v = mat<T>(this->v.get_n_rows(), 0);
+            return;
+         }
+
+         size_t rank = 0;
+         const T threshold = tol * std::max(core.s[0], reference);
+         while ( rank < core.s.size() && core.s[rank] > threshold )
+            ++rank;
+         if ( max_rank != 0 )
+            rank = std::min(rank, max_rank);
+
+         mat<T> w(core.u.get_n_rows(), rank);
+         mat<T> z(core.v.get_n_rows(), rank);
+         for ( size_t i = 0; i < w.get_n_rows(); ++i )
+            for ( size_t k = 0; k < rank; ++k )
+               w.row(i)[k] = core.u.row(i)[k] * core.s[k];
+         for ( size_t i = 0; i < z.get_n_rows(); ++i )
+            for ( size_t k = 0; k < rank; ++k )
+               z.row(i)[k] = core.v.row(i)[k];
+
+         this->u = gemm(qu.q, w);
+         this->v = gemm(qv.q, z);
+      }
+}
+#endif
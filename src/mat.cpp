@@ -5,25 +5,12 @@
 #include <concepts>
 #include <source_location>
 #include <stdexcept>
+#include <utility>
+#include "errors.cpp"
+#include "small.cpp"
 
 namespace lawcat
 {
-   class dimension_mismatch_error : public std::runtime_error 
-   {
-      public:
-         explicit dimension_mismatch_error(const std::string& message, const std::source_location& location = std::source_location::current())
-            : std::runtime_error(message + " at " + location.file_name() + ":" + std::to_string(location.line()) + ".") {}
-   };
-
-   inline void check_matrix_dimensions(const size_t& n_rows_a, const size_t& n_cols_a, const size_t& n_rows_b, const size_t& n_cols_b) 
-   {
-      if ( n_rows_a != n_rows_b || n_cols_a != n_cols_b ) 
-      {
-         const std::string msg = "Cannot perform addition between a " + std::to_string(n_rows_a) + "x" + std::to_string(n_cols_a) + " matrix and a " + std::to_string(n_rows_b) + "x" + std::to_string(n_cols_b) + " matrix.";
-         throw dimension_mismatch_error(msg);
-      }
-   }
-
    template <typename T>
       concept printable = requires(T value) 
       {
@@ -36,26 +23,69 @@ namespace lawcat
          private:
             size_t n_rows;
             size_t n_cols;
+            size_t row_capacity;
             T** data;
 
          public:
             mat(const size_t& n_rows, const size_t& n_cols);
+            mat(const mat<T>& other);
+            mat(mat<T>&& other) noexcept;
             ~mat();
 
+            mat<T>& operator=(const mat<T>& other);
+            mat<T>& operator=(mat<T>&& other) noexcept;
+
             void fill(const T& value);
-            void set(const size_t& row, const size_t col, const T& value);
+            // Checked per Policy; see errors.cpp.
+            template <typename Policy = default_policy>
+               policy_result<Policy> set(const size_t& row, const size_t col, const T& value);
+            template <typename Policy = default_policy>
+               policy_result<Policy> swap_rows(const size_t& row_a, const size_t& row_b);
+
+            // Growing by rows. Rows are separate allocations, so appending never
+            // moves existing rows; only the row table grows, geometrically.
+            // Pointers from rows() are invalidated when the table grows.
+            size_t capacity() const { return this->row_capacity; }
+            void reserve(const size_t& n_rows);
+            T* append_row();
+            T* append_row(const T* values);
+
+            // Element and row access
+            size_t get_n_rows() const { return this->n_rows; }
+            size_t get_n_cols() const { return this->n_cols; }
+            const T& get(const size_t& row, const size_t& col) const { return this->data[row][col]; }
+            T* row(const size_t& i) { return this->data[i]; }
+            const T* row(const size_t& i) const { return this->data[i]; }
+            T* const* rows() { return this->data; }
+            const T* const* rows() const { return this->data; }
 
             bool print(const std::source_location& location = std::source_location::current()) const;
 
-            // Standard operators
-            mat<T> operator+(const mat<T>& other) const;
-            void operator+=(const mat<T>& other);
-            mat<T> operator-(const mat<T>& other) const;
-            void operator-=(const mat<T>& other);
+            // Standard operators, checked with default_policy
+            mat<T> operator+(const mat<T>& other) const { return add(*this, other); }
+            void operator+=(const mat<T>& other) { this->add_assign(other); }
+            mat<T> operator-(const mat<T>& other) const { return sub(*this, other); }
+            void operator-=(const mat<T>& other) { this->sub_assign(other); }
             bool operator==(const mat<T>& other) const;
 
+            // The same operations checked per Policy, e.g. add<unchecked_policy>
+            // in inner loops that have already validated their shapes.
+            template <typename Policy = default_policy>
+               static policy_result<Policy, mat<T>> add(const mat<T>& m_a, const mat<T>& m_b);
+            template <typename Policy = default_policy>
+               static policy_result<Policy, mat<T>> sub(const mat<T>& m_a, const mat<T>& m_b);
+            template <typename Policy = default_policy>
+               policy_result<Policy> add_assign(const mat<T>& other);
+            template <typename Policy = default_policy>
+               policy_result<Policy> sub_assign(const mat<T>& other);
+
             // Matrix products
-            static mat<T> hadamard_product(const mat<T>& m_a, const mat<T>& m_b);
+            template <typename Policy = default_policy>
+               static policy_result<Policy, mat<T>> hadamard_product(const mat<T>& m_a, const mat<T>& m_b);
+
+         private:
+            static bool same_shape(const mat<T>& m_a, const mat<T>& m_b) { return m_a.n_rows == m_b.n_rows && m_a.n_cols == m_b.n_cols; }
+            static mat_error shape_error(const mat<T>& m_a, const mat<T>& m_b) { return { mat_errc::dimension_mismatch, { m_a.n_rows, m_a.n_cols, m_b.n_rows, m_b.n_cols } }; }
       };
 
    template <typename T>
@@ -63,12 +93,68 @@ namespace lawcat
       {
          this->n_rows = n_rows;
          this->n_cols = n_cols;
+         this->row_capacity = n_rows;
          this->data = new T*[this->n_rows];
 
          for ( size_t i = 0; i < n_rows; ++i )
             this->data[i] = new T[n_cols];
       }
 
+   template <typename T>
+      mat<T>::mat(const mat<T>& other) : mat(other.n_rows, other.n_cols)
+      {
+         for ( size_t i = 0; i < this->n_rows; ++i )
+            for ( size_t j = 0; j < this->n_cols; ++j )
+               this->data[i][j] = other.data[i][j];
+      }
+
+   template <typename T>
+      mat<T>::mat(mat<T>&& other) noexcept
+      {
+         this->n_rows = other.n_rows;
+         this->n_cols = other.n_cols;
+         this->row_capacity = other.row_capacity;
+         this->data = other.data;
+
+         other.n_rows = 0;
+         other.n_cols = 0;
+         other.row_capacity = 0;
+         other.data = nullptr;
+      }
+
+   template <typename T>
+      mat<T>& mat<T>::operator=(const mat<T>& other)
+      {
+         if ( this != &other )
+         {
+            mat<T> tmp(other);
+            *this = std::move(tmp);
+         }
+         return *this;
+      }
+
+   template <typename T>
+      mat<T>& mat<T>::operator=(mat<T>&& other) noexcept
+      {
+         if ( this != &other )
+         {
+            for ( size_t i = 0; i < this->n_rows; ++i )
+               delete[] this->data[i];
+            delete[] this->data;
+
+            this->n_rows = other.n_rows;
+            this->n_cols = other.n_cols;
+            this->row_capacity = other.row_capacity;
+            this->data = other.data;
+
+            other.n_rows = 0;
+            other.n_cols = 0;
+            other.row_capacity = 0;
+            other.data = nullptr;
+         }
+         return *this;
+      }
+
    template <typename T>
       bool mat<T>::print(const std::source_location& location) const
       {
@@ -104,15 +190,68 @@ namespace lawcat
       }
 
    template <typename T>
-      void mat<T>::set(const size_t& row, const size_t col, const T& value)
+      template <typename Policy>
+         policy_result<Policy> mat<T>::set(const size_t& row, const size_t col, const T& value)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( row >= this->n_rows )
+                  return Policy::template failure<>({ mat_errc::row_out_of_range });
+
+               if ( col >= this->n_cols )
+                  return Policy::template failure<>({ mat_errc::column_out_of_range });
+            }
+
+            this->data[row][col] = value;
+            return Policy::success();
+         }
+
+   // Rows are separate allocations, so a swap exchanges two row pointers.
+   template <typename T>
+      template <typename Policy>
+         policy_result<Policy> mat<T>::swap_rows(const size_t& row_a, const size_t& row_b)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( row_a >= this->n_rows || row_b >= this->n_rows )
+                  return Policy::template failure<>({ mat_errc::row_out_of_range });
+            }
+
+            std::swap(this->data[row_a], this->data[row_b]);
+            return Policy::success();
+         }
+
+   template <typename T>
+      void mat<T>::reserve(const size_t& n_rows)
       {
-         if ( row >= this->n_rows || row < 0 )
-            throw std::invalid_argument("ERROR: Row lies outside the bounds of the matrix.");
+         if ( n_rows <= this->row_capacity )
+            return;
 
-         if ( col >= this->n_cols || col < 0 )
-            throw std::invalid_argument("ERROR: Column lies outside the bounds of the matrix.");
+         T** table = new T*[n_rows];
+         for ( size_t i = 0; i < this->n_rows; ++i )
+            table[i] = this->data[i];
+         delete[] this->data;
+         this->data = table;
+         this->row_capacity = n_rows;
+      }
 
-         this->data[row][col] = value;
+   template <typename T>
+      T* mat<T>::append_row()
+      {
+         if ( this->n_rows == this->row_capacity )
+            this->reserve(this->row_capacity < 4 ? 4 : 2 * this->row_capacity);
+
+         this->data[this->n_rows] = new T[this->n_cols];
+         return this->data[this->n_rows++];
+      }
+
+   template <typename T>
+      T* mat<T>::append_row(const T* values)
+      {
+         T* r = this->append_row();
+         for ( size_t j = 0; j < this->n_cols; ++j )
+            r[j] = values[j];
+         return r;
       }
 
    template <typename T>
@@ -124,52 +263,78 @@ namespace lawcat
       }
 
    template <typename T>
-      mat<T> mat<T>::operator+(const mat<T>& other) const
-      {
-         check_matrix_dimensions(this->n_rows, this->n_cols, other.n_rows, other.n_cols);
+      template <typename Policy>
+         policy_result<Policy, mat<T>> mat<T>::add(const mat<T>& m_a, const mat<T>& m_b)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( !same_shape(m_a, m_b) )
+                  return Policy::template failure<mat<T>>(shape_error(m_a, m_b));
+            }
 
-         mat<T> out(this->n_rows, this->n_cols);
+            mat<T> out(m_a.n_rows, m_a.n_cols);
+            if ( small_add(m_a.data, m_b.data, out.data, m_a.n_rows, m_a.n_cols) )
+               return out;
 
-         for ( size_t i = 0; i < this->n_rows; ++i )
-            for ( size_t j = 0; j < this->n_cols; ++j )
-               out.set(i, j, this->data[i][j] + other.data[i][j]);
+            for ( size_t i = 0; i < m_a.n_rows; ++i )
+               for ( size_t j = 0; j < m_a.n_cols; ++j )
+                  out.data[i][j] = m_a.data[i][j] + m_b.data[i][j];
 
-         return out;
-      }
+            return out;
+         }
 
    template <typename T>
-      void mat<T>::operator+=(const mat<T>& other) 
-      {
-         check_matrix_dimensions(this->n_rows, this->n_cols, other.n_rows, other.n_cols);
+      template <typename Policy>
+         policy_result<Policy> mat<T>::add_assign(const mat<T>& other)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( !same_shape(*this, other) )
+                  return Policy::template failure<>(shape_error(*this, other));
+            }
 
-         for ( size_t i = 0; i < this->n_rows; ++i )
-            for ( size_t j = 0; j < this->n_cols; ++j )
-               this->data[i][j] += other.data[i][j];
-      }
+            for ( size_t i = 0; i < this->n_rows; ++i )
+               for ( size_t j = 0; j < this->n_cols; ++j )
+                  this->data[i][j] += other.data[i][j];
+            return Policy::success();
+         }
 
    template <typename T>
-      mat<T> mat<T>::operator-(const mat<T>& other) const
-      {
-         check_matrix_dimensions(this->n_rows, this->n_cols, other.n_rows, other.n_cols);
+      template <typename Policy>
+         policy_result<Policy, mat<T>> mat<T>::sub(const mat<T>& m_a, const mat<T>& m_b)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( !same_shape(m_a, m_b) )
+                  return Policy::template failure<mat<T>>(shape_error(m_a, m_b));
+            }
 
-         mat<T> out(this->n_rows, this->n_cols);
+            mat<T> out(m_a.n_rows, m_a.n_cols);
+            if ( small_sub(m_a.data, m_b.data, out.data, m_a.n_rows, m_a.n_cols) )
+               return out;
 
-         for ( size_t i = 0; i < this->n_rows; ++i )
-            for ( size_t j = 0; j < this->n_cols; ++j )
-               out.set(i, j, this->data[i][j] - other.data[i][j]);
+            for ( size_t i = 0; i < m_a.n_rows; ++i )
+               for ( size_t j = 0; j < m_a.n_cols; ++j )
+                  out.data[i][j] = m_a.data[i][j] - m_b.data[i][j];
 
-         return out;
-      }
+            return out;
+         }
 
    template <typename T>
-      void mat<T>::operator-=(const mat<T>& other) 
-      {
-         check_matrix_dimensions(this->n_rows, this->n_cols, other.n_rows, other.n_cols);
+      template <typename Policy>
+         policy_result<Policy> mat<T>::sub_assign(const mat<T>& other)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( !same_shape(*this, other) )
+                  return Policy::template failure<>(shape_error(*this, other));
+            }
 
-         for ( size_t i = 0; i < this->n_rows; ++i )
-            for ( size_t j = 0; j < this->n_cols; ++j )
-               this->data[i][j] -= other.data[i][j];
-      }
+            for ( size_t i = 0; i < this->n_rows; ++i )
+               for ( size_t j = 0; j < this->n_cols; ++j )
+                  this->data[i][j] -= other.data[i][j];
+            return Policy::success();
+         }
 
    template <typename T>
       bool mat<T>::operator==(const mat<T>& other) const
@@ -184,16 +349,24 @@ namespace lawcat
          return true;
       }
    template <typename T>
-      mat<T> mat<T>::hadamard_product(const mat<T>& m_a, const mat<T>& m_b)
-      {
-         check_matrix_dimensions(m_a.n_rows, m_a.n_cols, m_b.n_rows, m_b.n_cols);
-         mat<T> out(m_a.n_rows, m_a.n_cols);
+      template <typename Policy>
+         policy_result<Policy, mat<T>> mat<T>::hadamard_product(const mat<T>& m_a, const mat<T>& m_b)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( !same_shape(m_a, m_b) )
+                  return Policy::template failure<mat<T>>(shape_error(m_a, m_b));
+            }
 
-         for ( size_t i = 0; i < m_a.n_rows; ++i )
-            for ( size_t j = 0; j < m_a.n_cols; ++j )
-               out.data[i][j] = m_a.data[i][j] * m_b.data[i][j];
+            mat<T> out(m_a.n_rows, m_a.n_cols);
+            if ( small_hadamard(m_a.data, m_b.data, out.data, m_a.n_rows, m_a.n_cols) )
+               return out;
 
-         return out;
-      }
+            for ( size_t i = 0; i < m_a.n_rows; ++i )
+               for ( size_t j = 0; j < m_a.n_cols; ++j )
+                  out.data[i][j] = m_a.data[i][j] * m_b.data[i][j];
+
+            return out;
+         }
 }
 #endif
@@ -0,0 +1,88 @@
+#ifndef PARALLEL
+#define PARALLEL
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace lawcat
+{
+   // Cached: hardware_concurrency() can cost a few microseconds per call,
+   // which dominates parallel_for on small inputs.
+   inline size_t thread_count()
+   {
+      static const size_t n = std::max<size_t>(1, std::thread::hardware_concurrency());
+      return n;
+   }
+
+   namespace detail
+   {
+      // Runs one chunk, keeping its exception for the caller to rethrow.
+      // Without exception support there is nothing to catch.
+      template <typename F>
+         void run_chunk(F& fn, const size_t& lo, const size_t& hi, std::exception_ptr& error)
+         {
+#if defined(__cpp_exceptions)
+            try { fn(lo, hi); }
+            catch ( ... ) { error = std::current_exception(); }
+#else
+            (void)error;
+            fn(lo, hi);
+#endif
+         }
+   }
+
+   // Splits [begin, end) into contiguous chunks of at least `grain` indices and
+   // calls fn(chunk_begin, chunk_end) for each one on its own thread. The calling
+   // thread runs the first chunk. Exceptions are rethrown after all chunks join.
+   template <typename F>
+      void parallel_for(const size_t& begin, const size_t& end, const size_t& grain, F&& fn)
+      {
+         if ( end <= begin )
+            return;
+
+         const size_t n = end - begin;
+         const size_t max_chunks = std::max<size_t>(1, n / std::max<size_t>(1, grain));
+         const size_t n_chunks = std::min(thread_count(), max_chunks);
+
+         if ( n_chunks == 1 )
+         {
+            fn(begin, end);
+            return;
+         }
+
+         const size_t chunk = (n + n_chunks - 1) / n_chunks;
+         std::vector<std::exception_ptr> errors(n_chunks);
+         std::vector<std::thread> workers;
+         workers.reserve(n_chunks - 1);
+
+         for ( size_t c = 1; c < n_chunks; ++c )
+         {
+            const size_t lo = begin + c * chunk;
+            const size_t hi = std::min(end, lo + chunk);
+            if ( lo >= hi )
+               break;
+
+            workers.emplace_back([&fn, &errors, c, lo, hi]() { detail::run_chunk(fn, lo, hi, errors[c]); });
+         }
+
+         detail::run_chunk(fn, begin, std::min(end, begin + chunk), errors[0]);
+
+         for ( std::thread& w : workers )
+            w.join();
+
+#if defined(__cpp_exceptions)
+         for ( const std::exception_ptr& e : errors )
+            if ( e )
+               std::rethrow_exception(e);
+#endif
+      }
+
+   template <typename F>
+      void parallel_for(const size_t& begin, const size_t& end, F&& fn)
+      {
+         parallel_for(begin, end, 1, std::forward<F>(fn));
+      }
+}
+#endif
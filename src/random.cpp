@@ -0,0 +1,140 @@
+#ifndef RANDOM
+#define RANDOM
+#include <array>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <numbers>
+#include "mat.cpp"
+#include "parallel.cpp"
+
+namespace lawcat
+{
+   // Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+   // 3"). A keyed bijection on 128-bit counters: the same (counter, key) always
+   // produces the same four words, so any element can be generated
+   // independently of every other.
+   inline std::array<uint32_t, 4> philox4x32(std::array<uint32_t, 4> ctr, std::array<uint32_t, 2> key)
+   {
+      constexpr uint32_t m0 = 0xD2511F53;
+      constexpr uint32_t m1 = 0xCD9E8D57;
+      constexpr uint32_t w0 = 0x9E3779B9;
+      constexpr uint32_t w1 = 0xBB67AE85;
+
+      for ( int round = 0; round < 10; ++round )
+      {
+         const uint64_t p0 = uint64_t(m0) * ctr[0];
+         const uint64_t p1 = uint64_t(m1) * ctr[2];
+         ctr = {
+            uint32_t(p1 >> 32) ^ ctr[1] ^ key[0],
+            uint32_t(p1),
+            uint32_t(p0 >> 32) ^ ctr[3] ^ key[1],
+            uint32_t(p0)
+         };
+         key[0] += w0;
+         key[1] += w1;
+      }
+      return ctr;
+   }
+
+   // Uniform on the open interval (0, 1). One bit fewer than the mantissa
+   // keeps the half-step offset exact, so the largest value is 1 - 2^-24
+   // (float) or 1 - 2^-53 (double) rather than rounding up to 1.
+   template <std::floating_point T>
+      T uniform_from_bits(const uint32_t* words)
+      {
+         if constexpr ( sizeof(T) <= sizeof(float) )
+            return T((float(words[0] >> 9) + 0.5f) * (1.0f / 8388608.0f));
+         else
+         {
+            const uint64_t bits = (uint64_t(words[0]) << 20) ^ (uint64_t(words[1]) >> 12);
+            return (T(bits & ((uint64_t(1) << 52) - 1)) + T(0.5)) * T(1.0 / 4503599627370496.0);
+         }
+      }
+
+   template <std::floating_point T>
+      inline constexpr size_t uniform_words = sizeof(T) <= sizeof(float) ? 1 : 2;
+
+   // Fills m_a so that element (i, j) depends only on the seed and on the index
+   // i * n_cols + j. Each element consumes `words` of the Philox output
+   // (words divides 4), so element e reads block e / (4 / words) of the
+   // counter sequence. Rows are split across threads; because the mapping is
+   // positional the result is identical for any thread count.
+   template <typename T, typename F>
+      void fill_counter_based(mat<T>& m_a, const uint64_t& seed, const uint32_t& stream, const size_t& words, F&& make)
+      {
+         const std::array<uint32_t, 2> key = { uint32_t(seed), uint32_t(seed >> 32) };
+         const size_t per_block = 4 / words;
+         const size_t n_cols = m_a.get_n_cols();
+
+         parallel_for(0, m_a.get_n_rows(), 16, [&](size_t lo, size_t hi) {
+            for ( size_t i = lo; i < hi; ++i )
+            {
+               T* r = m_a.row(i);
+               size_t j = 0;
+               while ( j < n_cols )
+               {
+                  const uint64_t e = uint64_t(i) * n_cols + j;
+                  const uint64_t block = e / per_block;
+                  const std::array<uint32_t, 4> bits = philox4x32({ uint32_t(block), uint32_t(block >> 32), stream, 0 }, key);
+
+                  for ( size_t lane = e % per_block; lane < per_block && j < n_cols; ++lane, ++j )
+                     r[j] = make(bits.data() + lane * words);
+               }
+            }
+         });
+      }
+
+   // Distinct streams keep, say, a uniform and a normal fill with one seed
+   // from producing correlated matrices.
+   enum class random_stream : uint32_t
+   {
+      uniform = 1,
+      normal = 2,
+      bernoulli = 3,
+      sparse = 4
+   };
+
+   template <std::floating_point T>
+      void fill_uniform(mat<T>& m_a, const uint64_t& seed, const T& lo = T(0), const T& hi = T(1))
+      {
+         fill_counter_based(m_a, seed, uint32_t(random_stream::uniform), uniform_words<T>, [&](const uint32_t* w) {
+            return lo + (hi - lo) * uniform_from_bits<T>(w);
+         });
+      }
+
+   // Box-Muller on two uniforms; the sine branch is discarded so that each
+   // element stays a function of its own position.
+   template <std::floating_point T>
+      void fill_normal(mat<T>& m_a, const uint64_t& seed, const T& mean = T(0), const T& stddev = T(1))
+      {
+         constexpr size_t w = uniform_words<T>;
+         fill_counter_based(m_a, seed, uint32_t(random_stream::normal), 2 * w, [&](const uint32_t* words) {
+            const T u1 = uniform_from_bits<T>(words);
+            const T u2 = uniform_from_bits<T>(words + w);
+            return mean + stddev * std::sqrt(T(-2) * std::log(u1)) * std::cos(T(2) * std::numbers::pi_v<T> * u2);
+         });
+      }
+
+   // 1 with probability p, otherwise 0.
+   template <typename T>
+      void fill_bernoulli(mat<T>& m_a, const uint64_t& seed, const double& p)
+      {
+         fill_counter_based(m_a, seed, uint32_t(random_stream::bernoulli), 1, [&](const uint32_t* w) {
+            return w[0] * (1.0 / 4294967296.0) < p ? T(1) : T(0);
+         });
+      }
+
+   // Each element is non-zero with probability density, in which case it is
+   // drawn uniformly from [lo, hi).
+   template <std::floating_point T>
+      void fill_sparse_uniform(mat<T>& m_a, const uint64_t& seed, const double& density, const T& lo = T(0), const T& hi = T(1))
+      {
+         constexpr size_t w = uniform_words<T>;
+         fill_counter_based(m_a, seed, uint32_t(random_stream::sparse), w == 1 ? 2 : 4, [&](const uint32_t* words) {
+            const bool keep = words[0] * (1.0 / 4294967296.0) < density;
+            return keep ? lo + (hi - lo) * uniform_from_bits<T>(words + w) : T(0);
+         });
+      }
+}
+#endif
@@ -0,0 +1,228 @@
+#ifndef RCU
+#define RCU
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "mat.cpp"
+
+namespace lawcat
+{
+   // Read-copy-update wrapper: readers see an immutable snapshot without
+   // taking a lock while a writer prepares and publishes the next version.
+   //
+   // Each reader owns a slot. Entering a read section announces the current
+   // global epoch in the slot and then loads the published pointer. Publishing
+   // swaps the pointer, bumps the epoch and retires the old snapshot tagged
+   // with the epoch it was replaced in. A retired snapshot is reclaimed once
+   // every active reader announced a later epoch. The most recent reclaimed
+   // buffer is kept as a spare, so steady-state updates copy into it rather
+   // than allocating (double buffering).
+   template <typename T>
+      class rcu_mat
+      {
+         private:
+            struct alignas(64) slot
+            {
+               std::atomic<uint64_t> epoch { 0 };
+               std::atomic<bool> claimed { false };
+            };
+
+            struct retired
+            {
+               mat<T>* snapshot;
+               uint64_t epoch;
+            };
+
+         public:
+            // A snapshot pinned for the lifetime of the guard.
+            class read_guard
+            {
+               public:
+                  read_guard(const read_guard&) = delete;
+                  read_guard& operator=(const read_guard&) = delete;
+                  ~read_guard() { this->s->epoch.store(0, std::memory_order_release); }
+
+                  const mat<T>& operator*() const { return *this->snapshot; }
+                  const mat<T>* operator->() const { return this->snapshot; }
+
+               private:
+                  friend class rcu_mat<T>;
+                  read_guard(slot* s, const mat<T>* snapshot) : s(s), snapshot(snapshot) {}
+
+                  slot* s;
+                  const mat<T>* snapshot;
+            };
+
+            // One per reading thread. Read sections of a reader must not nest.
+            class reader
+            {
+               public:
+                  reader(reader&& other) noexcept : owner(other.owner), s(other.s) { other.s = nullptr; }
+                  reader(const reader&) = delete;
+                  reader& operator=(const reader&) = delete;
+                  ~reader()
+                  {
+                     if ( this->s != nullptr )
+                        this->s->claimed.store(false, std::memory_order_release);
+                  }
+
+                  read_guard lock() const;
+
+               private:
+                  friend class rcu_mat<T>;
+                  reader(const rcu_mat<T>* owner, slot* s) : owner(owner), s(s) {}
+
+                  const rcu_mat<T>* owner;
+                  slot* s;
+            };
+
+            static constexpr size_t default_max_readers = 64;
+
+            explicit rcu_mat(mat<T> initial, const size_t& max_readers = default_max_readers);
+            rcu_mat(const rcu_mat<T>&) = delete;
+            rcu_mat<T>& operator=(const rcu_mat<T>&) = delete;
+            ~rcu_mat();
+
+            // Claims a reader slot, reporting through Policy when all are
+            // taken. Running out of slots is not a check unchecked_policy can
+            // skip, so it aborts.
+            template <typename Policy = default_policy>
+               policy_result<Policy, reader> make_reader();
+
+            // Copies the current snapshot, applies fn to the copy and publishes it.
+            template <typename F>
+               void update(F&& fn);
+
+            void publish(mat<T> next);
+
+            // Frees retired snapshots no reader can still see. Returns how many
+            // remain pending.
+            size_t reclaim();
+
+         private:
+            std::atomic<mat<T>*> current;
+            std::atomic<uint64_t> epoch { 1 };
+            std::unique_ptr<slot[]> slots;
+            size_t n_slots;
+
+            std::mutex writer_lock;
+            std::vector<retired> pending;
+            std::unique_ptr<mat<T>> spare;
+
+            void publish_locked(mat<T>* next);
+            size_t reclaim_locked();
+      };
+
+   template <typename T>
+      rcu_mat<T>::rcu_mat(mat<T> initial, const size_t& max_readers)
+         : current(new mat<T>(std::move(initial))), slots(new slot[max_readers]), n_slots(max_readers) {}
+
+   template <typename T>
+      rcu_mat<T>::~rcu_mat()
+      {
+         for ( const retired& r : this->pending )
+            delete r.snapshot;
+         delete this->current.load();
+      }
+
+   template <typename T>
+      template <typename Policy>
+         policy_result<Policy, typename rcu_mat<T>::reader> rcu_mat<T>::make_reader()
+         {
+            for ( size_t i = 0; i < this->n_slots; ++i )
+            {
+               bool expected = false;
+               if ( this->slots[i].claimed.compare_exchange_strong(expected, true, std::memory_order_acq_rel) )
+                  return reader(this, &this->slots[i]);
+            }
+
+            const mat_error error { mat_errc::reader_slots_exhausted, { this->n_slots } };
+            if constexpr ( Policy::checked )
+               return Policy::template failure<reader>(error);
+            else
+               return abort_policy::failure<reader>(error);
+         }
+
+   template <typename T>
+      typename rcu_mat<T>::read_guard rcu_mat<T>::reader::lock() const
+      {
+         // Announce before loading: a writer that retires the snapshot we are
+         // about to see either observes the announcement or published first.
+         this->s->epoch.store(this->owner->epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+         return read_guard(this->s, this->owner->current.load(std::memory_order_seq_cst));
+      }
+
+   template <typename T>
+      template <typename F>
+         void rcu_mat<T>::update(F&& fn)
+         {
+            std::lock_guard<std::mutex> guard(this->writer_lock);
+            this->reclaim_locked();
+
+            const mat<T>& cur = *this->current.load(std::memory_order_acquire);
+            std::unique_ptr<mat<T>> next;
+            if ( this->spare && this->spare->get_n_rows() == cur.get_n_rows() && this->spare->get_n_cols() == cur.get_n_cols() )
+            {
+               next = std::move(this->spare);
+               for ( size_t i = 0; i < cur.get_n_rows(); ++i )
+                  std::copy(cur.row(i), cur.row(i) + cur.get_n_cols(), next->row(i));
+            }
+            else
+               next = std::make_unique<mat<T>>(cur);
+
+            fn(*next);
+            this->publish_locked(next.release());
+         }
+
+   template <typename T>
+      void rcu_mat<T>::publish(mat<T> next)
+      {
+         std::lock_guard<std::mutex> guard(this->writer_lock);
+         this->publish_locked(new mat<T>(std::move(next)));
+      }
+
+   template <typename T>
+      void rcu_mat<T>::publish_locked(mat<T>* next)
+      {
+         mat<T>* old = this->current.exchange(next, std::memory_order_seq_cst);
+         const uint64_t e = this->epoch.fetch_add(1, std::memory_order_seq_cst);
+         this->pending.push_back({ old, e });
+         this->reclaim_locked();
+      }
+
+   template <typename T>
+      size_t rcu_mat<T>::reclaim()
+      {
+         std::lock_guard<std::mutex> guard(this->writer_lock);
+         return this->reclaim_locked();
+      }
+
+   template <typename T>
+      size_t rcu_mat<T>::reclaim_locked()
+      {
+         uint64_t oldest = std::numeric_limits<uint64_t>::max();
+         for ( size_t i = 0; i < this->n_slots; ++i )
+         {
+            const uint64_t e = this->slots[i].epoch.load(std::memory_order_seq_cst);
+            if ( e != 0 )
+               oldest = std::min(oldest, e);
+         }
+
+         std::vector<retired> still;
+         for ( const retired& r : this->pending )
+         {
+            if ( r.epoch >= oldest )
+               still.push_back(r);
+            else
+               this->spare.reset(r.snapshot);
+         }
+         this->pending = std::move(still);
+         return this->pending.size();
+      }
+}
+#endif
@@ -0,0 +1,118 @@
+#ifndef RING
+#define RING
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "mat.cpp"
+
+namespace lawcat
+{
+   // Rolling window over the last `window` rows pushed. Row 0 is the oldest.
+   //
+   // Storage is a fixed pool of rows, overwritten in place once the window is
+   // full. The row table holds every row pointer twice, so rows() returns a
+   // contiguous, ordered T* const* for the current window without copying and
+   // can be passed straight to kernels such as gemm_nt_tiles.
+   template <typename T>
+      class ring_mat
+      {
+         public:
+            ring_mat(const size_t& window, const size_t& n_cols);
+            // The table points into pool, so a copy rebuilds it over its own
+            // rows. Moving keeps the rows where they are.
+            ring_mat(const ring_mat<T>& other);
+            ring_mat(ring_mat<T>&& other) noexcept = default;
+            ring_mat<T>& operator=(const ring_mat<T>& other);
+            ring_mat<T>& operator=(ring_mat<T>&& other) noexcept = default;
+
+            size_t get_n_rows() const { return this->count; }
+            size_t get_n_cols() const { return this->pool.get_n_cols(); }
+            size_t get_window() const { return this->pool.get_n_rows(); }
+            bool full() const { return this->count == this->get_window(); }
+
+            const T& get(const size_t& row, const size_t& col) const { return this->table[this->head + row][col]; }
+            const T* row(const size_t& i) const { return this->table[this->head + i]; }
+            const T* const* rows() const { return this->table.data() + this->head; }
+
+            // Slot for the next row, evicting the oldest when full. The caller
+            // fills it in.
+            T* push_row();
+            T* push_row(const T* values);
+
+            // Copies the window into an ordinary matrix.
+            mat<T> to_mat() const;
+
+         private:
+            mat<T> pool;
+            std::vector<T*> table;
+            size_t head = 0;
+            size_t count = 0;
+
+            void link_rows();
+      };
+
+   template <typename T>
+      ring_mat<T>::ring_mat(const size_t& window, const size_t& n_cols) : pool(window, n_cols), table(2 * window)
+      {
+         if ( window == 0 )
+            default_policy::failure({ mat_errc::nonpositive_size, {}, "Window size" });
+
+         this->link_rows();
+      }
+
+   template <typename T>
+      ring_mat<T>::ring_mat(const ring_mat<T>& other)
+         : pool(other.pool), table(other.table.size()), head(other.head), count(other.count)
+      {
+         this->link_rows();
+      }
+
+   template <typename T>
+      ring_mat<T>& ring_mat<T>::operator=(const ring_mat<T>& other)
+      {
+         if ( this != &other )
+         {
+            ring_mat<T> tmp(other);
+            *this = std::move(tmp);
+         }
+         return *this;
+      }
+
+   template <typename T>
+      void ring_mat<T>::link_rows()
+      {
+         const size_t window = this->get_window();
+         for ( size_t i = 0; i < window; ++i )
+            this->table[i] = this->table[i + window] = this->pool.row(i);
+      }
+
+   template <typename T>
+      T* ring_mat<T>::push_row()
+      {
+         const size_t window = this->get_window();
+         if ( this->count < window )
+            return this->table[this->head + this->count++];
+
+         T* slot = this->table[this->head];
+         this->head = (this->head + 1) % window;
+         return slot;
+      }
+
+   template <typename T>
+      T* ring_mat<T>::push_row(const T* values)
+      {
+         T* r = this->push_row();
+         std::copy(values, values + this->get_n_cols(), r);
+         return r;
+      }
+
+   template <typename T>
+      mat<T> ring_mat<T>::to_mat() const
+      {
+         mat<T> out(this->count, this->get_n_cols());
+         for ( size_t i = 0; i < this->count; ++i )
+            std::copy(this->row(i), this->row(i) + this->get_n_cols(), out.row(i));
+         return out;
+      }
+}
+#endif
@@ -0,0 +1,227 @@
+#ifndef ROWWISE
+#define ROWWISE
+#include <algorithm>
+#include <cmath>
+#include <concepts>
+#include <limits>
+#include <vector>
+#include "mat.cpp"
+#include "parallel.cpp"
+
+namespace lawcat
+{
+   // Rows are independent, so every kernel here runs over blocks of rows in
+   // parallel. Within a row the data is read from memory once and written once;
+   // the extra sweeps hit cache. Reductions use row_lanes independent
+   // accumulators so the compiler can vectorise them without -ffast-math.
+   inline constexpr size_t row_lanes = 8;
+   inline constexpr size_t row_grain = 16;
+
+   template <std::floating_point T>
+      T row_max(const T* x, const size_t& n)
+      {
+         T lanes[row_lanes];
+         std::fill(lanes, lanes + row_lanes, -std::numeric_limits<T>::infinity());
+
+         size_t j = 0;
+         for ( ; j + row_lanes <= n; j += row_lanes )
+            for ( size_t l = 0; l < row_lanes; ++l )
+               lanes[l] = std::max(lanes[l], x[j + l]);
+         for ( ; j < n; ++j )
+            lanes[0] = std::max(lanes[0], x[j]);
+
+         return *std::max_element(lanes, lanes + row_lanes);
+      }
+
+   template <std::floating_point T>
+      T row_sum(const T* x, const size_t& n)
+      {
+         T lanes[row_lanes] = {};
+
+         size_t j = 0;
+         for ( ; j + row_lanes <= n; j += row_lanes )
+            for ( size_t l = 0; l < row_lanes; ++l )
+               lanes[l] += x[j + l];
+         for ( ; j < n; ++j )
+            lanes[0] += x[j];
+
+         T acc = T(0);
+         for ( size_t l = 0; l < row_lanes; ++l )
+            acc += lanes[l];
+         return acc;
+      }
+
+   // sum_j exp(x[j] - shift), writing the exponentials to out when out is not null.
+   template <std::floating_point T>
+      T row_sum_exp(const T* x, const size_t& n, const T& shift, T* out)
+      {
+         T lanes[row_lanes] = {};
+
+         size_t j = 0;
+         for ( ; j + row_lanes <= n; j += row_lanes )
+            for ( size_t l = 0; l < row_lanes; ++l )
+            {
+               const T e = std::exp(x[j + l] - shift);
+               if ( out )
+                  out[j + l] = e;
+               lanes[l] += e;
+            }
+         for ( ; j < n; ++j )
+         {
+            const T e = std::exp(x[j] - shift);
+            if ( out )
+               out[j] = e;
+            lanes[0] += e;
+         }
+
+         T acc = T(0);
+         for ( size_t l = 0; l < row_lanes; ++l )
+            acc += lanes[l];
+         return acc;
+      }
+
+   template <std::floating_point T>
+      T row_logsumexp(const T* x, const size_t& n)
+      {
+         const T m = row_max(x, n);
+         if ( std::isinf(m) )
+            return m;
+         return m + std::log(row_sum_exp(x, n, m, static_cast<T*>(nullptr)));
+      }
+
+   template <std::floating_point T, typename F>
+      mat<T> map_rows(const mat<T>& m_a, F&& kernel)
+      {
+         mat<T> out(m_a.get_n_rows(), m_a.get_n_cols());
+         parallel_for(0, m_a.get_n_rows(), row_grain, [&](size_t lo, size_t hi) {
+            for ( size_t i = lo; i < hi; ++i )
+               kernel(m_a.row(i), out.row(i), m_a.get_n_cols());
+         });
+         return out;
+      }
+
+   template <std::floating_point T>
+      mat<T> softmax_rows(const mat<T>& m_a)
+      {
+         return map_rows(m_a, [](const T* x, T* y, size_t n) {
+            const T m = row_max(x, n);
+            const T inv = T(1) / row_sum_exp(x, n, m, y);
+            for ( size_t j = 0; j < n; ++j )
+               y[j] *= inv;
+         });
+      }
+
+   template <std::floating_point T>
+      mat<T> log_softmax_rows(const mat<T>& m_a)
+      {
+         return map_rows(m_a, [](const T* x, T* y, size_t n) {
+            const T lse = row_logsumexp(x, n);
+            for ( size_t j = 0; j < n; ++j )
+               y[j] = x[j] - lse;
+         });
+      }
+
+   // Returns an n_rows x 1 matrix holding log(sum_j exp(a[i][j])) for each row.
+   template <std::floating_point T>
+      mat<T> logsumexp_rows(const mat<T>& m_a)
+      {
+         mat<T> out(m_a.get_n_rows(), 1);
+         parallel_for(0, m_a.get_n_rows(), row_grain, [&](size_t lo, size_t hi) {
+            for ( size_t i = lo; i < hi; ++i )
+               out.row(i)[0] = row_logsumexp(m_a.row(i), m_a.get_n_cols());
+         });
+         return out;
+      }
+
+   inline bool affine_parameters_fit(const size_t& n_cols, const size_t& n_gamma, const size_t& n_beta)
+   {
+      return (n_gamma == 0 || n_gamma == n_cols) && (n_beta == 0 || n_beta == n_cols);
+   }
+
+   template <typename Policy = default_policy>
+      inline policy_result<Policy> check_affine_parameters(const size_t& n_cols, const size_t& n_gamma, const size_t& n_beta)
+      {
+         return check<Policy>(affine_parameters_fit(n_cols, n_gamma, n_beta), { mat_errc::parameter_mismatch, { n_cols } });
+      }
+
+   // (x - mean) / sqrt(var + eps) * gamma + beta, per row. An empty gamma or
+   // beta is treated as ones or zeros respectively. Parameter lengths are
+   // checked per Policy.
+   template <typename Policy = default_policy, std::floating_point T>
+      policy_result<Policy, mat<T>> layernorm_rows(const mat<T>& m_a, const std::vector<T>& gamma = {}, const std::vector<T>& beta = {}, const T& eps = T(1e-5))
+      {
+         if constexpr ( Policy::checked )
+         {
+            if ( !affine_parameters_fit(m_a.get_n_cols(), gamma.size(), beta.size()) )
+               return Policy::template failure<mat<T>>({ mat_errc::parameter_mismatch, { m_a.get_n_cols() } });
+         }
+
+         return map_rows(m_a, [&](const T* x, T* y, size_t n) {
+            if ( n == 0 )
+               return;
+
+            const T mean = row_sum(x, n) / T(n);
+            T lanes[row_lanes] = {};
+            size_t j = 0;
+            for ( ; j + row_lanes <= n; j += row_lanes )
+               for ( size_t l = 0; l < row_lanes; ++l )
+               {
+                  const T d = x[j + l] - mean;
+                  y[j + l] = d;
+                  lanes[l] += d * d;
+               }
+            for ( ; j < n; ++j )
+            {
+               const T d = x[j] - mean;
+               y[j] = d;
+               lanes[0] += d * d;
+            }
+
+            T var = T(0);
+            for ( size_t l = 0; l < row_lanes; ++l )
+               var += lanes[l];
+            const T inv_std = T(1) / std::sqrt(var / T(n) + eps);
+
+            for ( size_t c = 0; c < n; ++c )
+            {
+               const T g = gamma.empty() ? T(1) : gamma[c];
+               const T b = beta.empty() ? T(0) : beta[c];
+               y[c] = y[c] * inv_std * g + b;
+            }
+         });
+      }
+
+   // x / sqrt(mean(x^2) + eps) * gamma, per row. The length of gamma is
+   // checked per Policy.
+   template <typename Policy = default_policy, std::floating_point T>
+      policy_result<Policy, mat<T>> rmsnorm_rows(const mat<T>& m_a, const std::vector<T>& gamma = {}, const T& eps = T(1e-6))
+      {
+         if constexpr ( Policy::checked )
+         {
+            if ( !affine_parameters_fit(m_a.get_n_cols(), gamma.size(), 0) )
+               return Policy::template failure<mat<T>>({ mat_errc::parameter_mismatch, { m_a.get_n_cols() } });
+         }
+
+         return map_rows(m_a, [&](const T* x, T* y, size_t n) {
+            if ( n == 0 )
+               return;
+
+            T lanes[row_lanes] = {};
+            size_t j = 0;
+            for ( ; j + row_lanes <= n; j += row_lanes )
+               for ( size_t l = 0; l < row_lanes; ++l )
+                  lanes[l] += x[j + l] * x[j + l];
+            for ( ; j < n; ++j )
+               lanes[0] += x[j] * x[j];
+
+            T ms = T(0);
+            for ( size_t l = 0; l < row_lanes; ++l )
+               ms += lanes[l];
+            const T inv_rms = T(1) / std::sqrt(ms / T(n) + eps);
+
+            for ( size_t c = 0; c < n; ++c )
+               y[c] = x[c] * inv_rms * (gamma.empty() ? T(1) : gamma[c]);
+         });
+      }
+}
+#endif
@@ -0,0 +1,217 @@
+#ifndef SCATTER
+#define SCATTER
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "mat.cpp"
+#include "parallel.cpp"
+
+namespace lawcat
+{
+   // Element types std::atomic_ref can fetch_add: integers other than bool,
+   // and floating point.
+   template <typename T>
+      concept scatter_value = (std::integral<T> && !std::same_as<T, bool>) || std::floating_point<T>;
+
+   // Lets many threads add contributions into one matrix without a lock.
+   //
+   // Each producer thread owns a shard. The first few hits a shard makes on a
+   // tile go straight to the target as atomic adds, which is cheap when hits
+   // are sparse. Once a tile is hit more often than privatize_after, the
+   // shard gives it a private dense buffer and later adds are plain stores.
+   // merge() folds the private tiles into the target, one tile per task, so
+   // the merge itself needs no atomics. Shards keep state only for tiles
+   // they have touched, so memory follows the hits rather than the target.
+   //
+   // Nothing else may write the target between the first add and merge().
+   template <typename T>
+      requires scatter_value<T>
+      class scatter_accumulator
+      {
+         public:
+            class shard
+            {
+               public:
+                  // Bounds are checked per Policy.
+                  template <typename Policy = default_policy>
+                     policy_result<Policy> add(const size_t& row, const size_t& col, const T& value);
+
+               private:
+                  friend class scatter_accumulator<T>;
+                  explicit shard(scatter_accumulator<T>& owner);
+
+                  struct tile_state
+                  {
+                     uint32_t hits = 0;
+                     std::unique_ptr<T[]> buf;
+                  };
+
+                  scatter_accumulator<T>& owner;
+                  std::unordered_map<size_t, tile_state> tiles;
+                  std::vector<size_t> owned;
+                  // Most adds land in the tile of the previous one.
+                  size_t last_tile = SIZE_MAX;
+                  tile_state* last_state = nullptr;
+            };
+
+            static constexpr size_t default_tile = 64;
+            static constexpr uint32_t default_privatize_after = 16;
+
+            explicit scatter_accumulator(mat<T>& target, const size_t& tile = default_tile, const uint32_t& privatize_after = default_privatize_after);
+
+            // The calling thread's shard, created on first use. Hold on to the
+            // reference rather than looking it up for every add, until merge().
+            shard& local();
+
+            // Adds every private tile into the target and drops all shards, so
+            // an accumulator reused across rounds of parallel_for does not keep
+            // one shard per thread it has ever seen. References from local()
+            // are invalid afterwards.
+            void merge();
+
+         private:
+            mat<T>& target;
+            size_t tile;
+            uint32_t privatize_after;
+            size_t n_tile_cols;
+
+            std::mutex shards_lock;
+            std::unordered_map<std::thread::id, std::unique_ptr<shard>> shards;
+      };
+
+   template <typename T>
+      requires scatter_value<T>
+      scatter_accumulator<T>::scatter_accumulator(mat<T>& target, const size_t& tile, const uint32_t& privatize_after)
+         : target(target), tile(tile), privatize_after(privatize_after)
+      {
+         if ( tile == 0 )
+            default_policy::failure({ mat_errc::nonpositive_size, {}, "Tile size" });
+         this->n_tile_cols = (target.get_n_cols() + tile - 1) / tile;
+      }
+
+   template <typename T>
+      requires scatter_value<T>
+      scatter_accumulator<T>::shard::shard(scatter_accumulator<T>& owner)
+         : owner(owner) {}
+
+   template <typename T>
+      requires scatter_value<T>
+      template <typename Policy>
+         policy_result<Policy> scatter_accumulator<T>::shard::add(const size_t& row, const size_t& col, const T& value)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( row >= this->owner.target.get_n_rows() )
+                  return Policy::template failure<>({ mat_errc::row_out_of_range });
+               if ( col >= this->owner.target.get_n_cols() )
+                  return Policy::template failure<>({ mat_errc::column_out_of_range });
+            }
+
+            const size_t ts = this->owner.tile;
+            const size_t t = (row / ts) * this->owner.n_tile_cols + col / ts;
+
+            if ( t != this->last_tile )
+            {
+               // Map nodes do not move on rehash, so the pointer stays valid.
+               this->last_state = &this->tiles[t];
+               this->last_tile = t;
+            }
+            tile_state& state = *this->last_state;
+
+            if ( T* buf = state.buf.get() )
+            {
+               buf[(row % ts) * ts + col % ts] += value;
+               return Policy::success();
+            }
+
+            if ( state.hits++ < this->owner.privatize_after )
+            {
+               std::atomic_ref<T>(this->owner.target.row(row)[col]).fetch_add(value, std::memory_order_relaxed);
+               return Policy::success();
+            }
+
+            state.buf = std::make_unique<T[]>(ts * ts);
+            this->owned.push_back(t);
+            state.buf[(row % ts) * ts + col % ts] = value;
+            return Policy::success();
+         }
+
+   template <typename T>
+      requires scatter_value<T>
+      typename scatter_accumulator<T>::shard& scatter_accumulator<T>::local()
+      {
+         std::lock_guard<std::mutex> guard(this->shards_lock);
+         std::unique_ptr<shard>& s = this->shards[std::this_thread::get_id()];
+         if ( !s )
+            s.reset(new shard(*this));
+         return *s;
+      }
+
+   template <typename T>
+      requires scatter_value<T>
+      void scatter_accumulator<T>::merge()
+      {
+         std::lock_guard<std::mutex> guard(this->shards_lock);
+
+         std::vector<shard*> all;
+         std::vector<size_t> touched;
+         for ( auto& [id, s] : this->shards )
+         {
+            all.push_back(s.get());
+            touched.insert(touched.end(), s->owned.begin(), s->owned.end());
+         }
+         std::sort(touched.begin(), touched.end());
+         touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+         const size_t ts = this->tile;
+         parallel_for(0, touched.size(), [&](size_t lo, size_t hi) {
+            for ( size_t k = lo; k < hi; ++k )
+            {
+               const size_t t = touched[k];
+               const size_t r0 = (t / this->n_tile_cols) * ts;
+               const size_t c0 = (t % this->n_tile_cols) * ts;
+               const size_t r1 = std::min(this->target.get_n_rows(), r0 + ts);
+               const size_t c1 = std::min(this->target.get_n_cols(), c0 + ts);
+
+               for ( shard* s : all )
+               {
+                  const auto it = s->tiles.find(t);
+                  if ( it == s->tiles.end() || !it->second.buf )
+                     continue;
+                  const T* buf = it->second.buf.get();
+                  for ( size_t i = r0; i < r1; ++i )
+                  {
+                     T* dst = this->target.row(i);
+                     const T* src = buf + (i - r0) * ts;
+                     for ( size_t j = c0; j < c1; ++j )
+                        dst[j] += src[j - c0];
+                  }
+               }
+            }
+         });
+
+         this->shards.clear();
+      }
+
+   // Runs fn(i, shard) for every i in [begin, end) across threads, each chunk
+   // with its own shard, then merges into m_a.
+   template <typename T, typename F>
+      requires scatter_value<T>
+      void scatter_add(mat<T>& m_a, const size_t& begin, const size_t& end, F&& fn)
+      {
+         scatter_accumulator<T> acc(m_a);
+         parallel_for(begin, end, [&](size_t lo, size_t hi) {
+            typename scatter_accumulator<T>::shard& s = acc.local();
+            for ( size_t i = lo; i < hi; ++i )
+               fn(i, s);
+         });
+         acc.merge();
+      }
+}
+#endif
@@ -0,0 +1,400 @@
+#ifndef SHM
+#define SHM
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mat.cpp"
+
+namespace lawcat
+{
+   enum class shm_mode
+   {
+      read_only,
+      read_write
+   };
+
+   // A matrix stored in a named POSIX shared-memory segment, so processes on
+   // one host can share a single copy. The segment holds a small header and
+   // the elements in row-major order; each process builds its own row table
+   // over its mapping, so row() and rows() work like mat's.
+   //
+   // Updates go through a seqlock: write() makes the sequence odd while it
+   // runs and even again afterwards, and read() retries until it observes the
+   // same even sequence before and after. version() counts completed writes.
+   // Writers in different processes are serialized by an owner word holding
+   // the writer's pid.
+   //
+   // Writes that do not complete leave the segment poisoned: if fn throws,
+   // or the writing process dies (detected through its pid, so all processes
+   // must share a pid namespace), read() and snapshot() fail until assign()
+   // rewrites the whole matrix. A reader waiting on a dead writer fails
+   // rather than spinning; the next writer takes the lock over. These states
+   // and failures of the system calls are reported through default_policy;
+   // write() and assign() check their arguments per Policy.
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      class shared_mat
+      {
+         private:
+            struct header
+            {
+               std::atomic<uint64_t> ready;
+               std::atomic<uint64_t> sequence;
+               std::atomic<uint64_t> owner;
+               std::atomic<uint64_t> poisoned;
+               uint64_t element_size;
+               uint64_t n_rows;
+               uint64_t n_cols;
+            };
+
+            static constexpr uint64_t ready_tag = 0x4C415743415453ull;
+            static constexpr size_t data_offset = 64;
+            // Spins between checks that a lock holder is still alive.
+            static constexpr size_t owner_check_interval = 1024;
+
+            // Other processes see the same words, so the atomics must not
+            // fall back to a process-local lock.
+            static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared memory needs lock-free 64-bit atomics.");
+            static_assert(sizeof(header) <= data_offset, "Header overlaps the data.");
+
+            std::string name;
+            shm_mode mode;
+            size_t n_bytes = 0;
+            void* base = nullptr;
+            std::vector<T*> table;
+
+            shared_mat(const std::string& name, const shm_mode& mode) : name(name), mode(mode) {}
+
+            header* head() const { return static_cast<header*>(this->base); }
+            // False, with errno set, if the segment cannot be mapped.
+            bool map(const int& fd, const size_t& n_bytes);
+            [[noreturn]] static void fail(const std::string& message) { default_policy::failure({ mat_errc::io_failure, {}, message }); }
+            void link_rows();
+            static bool owner_dead(const uint64_t& pid) { return pid != 0 && kill(pid_t(pid), 0) != 0 && errno == ESRCH; }
+
+         public:
+            // Creates a new segment; fails if one with this name exists.
+            static shared_mat<T> create(const std::string& name, const size_t& n_rows, const size_t& n_cols);
+            // Waits up to timeout for a segment that is still being created.
+            static shared_mat<T> attach(const std::string& name, const shm_mode& mode = shm_mode::read_only, const std::chrono::milliseconds& timeout = std::chrono::milliseconds(1000));
+            // Removes the name; existing mappings stay valid until closed.
+            static void unlink(const std::string& name);
+
+            shared_mat(shared_mat<T>&& other) noexcept;
+            shared_mat(const shared_mat<T>&) = delete;
+            shared_mat<T>& operator=(const shared_mat<T>&) = delete;
+            ~shared_mat();
+
+            size_t get_n_rows() const { return this->head()->n_rows; }
+            size_t get_n_cols() const { return this->head()->n_cols; }
+            shm_mode get_mode() const { return this->mode; }
+            uint64_t version() const { return this->head()->sequence.load(std::memory_order_acquire) / 2; }
+            bool poisoned() const { return this->head()->poisoned.load(std::memory_order_acquire) != 0; }
+
+            // Unsynchronized access, for data that is not being updated.
+            const T& get(const size_t& row, const size_t& col) const { return this->table[row][col]; }
+            const T* row(const size_t& i) const { return this->table[i]; }
+            const T* const* rows() const { return this->table.data(); }
+
+            // Runs fn(rows) against a consistent state and returns its result,
+            // if any. fn may run several times and must only read.
+            template <typename F>
+               auto read(F&& fn) const;
+
+            // Runs fn(rows) with exclusive write access. If fn throws, the
+            // segment is poisoned and the exception propagates.
+            template <typename Policy = default_policy, typename F>
+               policy_result<Policy> write(F&& fn);
+
+            mat<T> snapshot() const;
+            template <typename Policy = default_policy>
+               policy_result<Policy> assign(const mat<T>& m_a);
+      };
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      bool shared_mat<T>::map(const int& fd, const size_t& n_bytes)
+      {
+         const int prot = this->mode == shm_mode::read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+         void* p = mmap(nullptr, n_bytes, prot, MAP_SHARED, fd, 0);
+         if ( p == MAP_FAILED )
+            return false;
+         this->base = p;
+         this->n_bytes = n_bytes;
+         return true;
+      }
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      shared_mat<T> shared_mat<T>::create(const std::string& name, const size_t& n_rows, const size_t& n_cols)
+      {
+         const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+         if ( fd < 0 )
+            fail("ERROR: Cannot create shared memory " + name + ": " + std::strerror(errno) + ".");
+
+         shared_mat<T> out(name, shm_mode::read_write);
+         const size_t n_bytes = data_offset + n_rows * n_cols * sizeof(T);
+         const bool sized = ftruncate(fd, off_t(n_bytes)) == 0;
+         if ( !sized || !out.map(fd, n_bytes) )
+         {
+            // Build the message before close() can overwrite errno.
+            const std::string message = std::string("ERROR: Cannot ") + (sized ? "map" : "size") + " shared memory " + name + ": " + std::strerror(errno) + ".";
+            close(fd);
+            shm_unlink(name.c_str());
+            fail(message);
+         }
+         close(fd);
+
+         header* h = new (out.base) header;
+         h->sequence.store(0, std::memory_order_relaxed);
+         h->owner.store(0, std::memory_order_relaxed);
+         h->poisoned.store(0, std::memory_order_relaxed);
+         h->element_size = sizeof(T);
+         h->n_rows = n_rows;
+         h->n_cols = n_cols;
+         h->ready.store(ready_tag, std::memory_order_release);
+
+         out.link_rows();
+         return out;
+      }
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      void shared_mat<T>::link_rows()
+      {
+         const header* h = this->head();
+         T* data = reinterpret_cast<T*>(static_cast<char*>(this->base) + data_offset);
+         this->table.resize(h->n_rows);
+         for ( size_t i = 0; i < h->n_rows; ++i )
+            this->table[i] = data + i * h->n_cols;
+      }
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      shared_mat<T> shared_mat<T>::attach(const std::string& name, const shm_mode& mode, const std::chrono::milliseconds& timeout)
+      {
+         // create() opens, sizes, maps and then publishes the header, so an
+         // attach racing it may find no segment, an empty one or one not yet
+         // ready. Each of those is retried until the deadline.
+         const auto deadline = std::chrono::steady_clock::now() + timeout;
+         while ( true )
+         {
+            const bool last_try = std::chrono::steady_clock::now() >= deadline;
+            const int fd = shm_open(name.c_str(), mode == shm_mode::read_only ? O_RDONLY : O_RDWR, 0);
+            if ( fd < 0 )
+            {
+               if ( errno != ENOENT || last_try )
+                  fail("ERROR: Cannot open shared memory " + name + ": " + std::strerror(errno) + ".");
+               std::this_thread::sleep_for(std::chrono::milliseconds(1));
+               continue;
+            }
+
+            shared_mat<T> out(name, mode);
+            struct stat st;
+            if ( fstat(fd, &st) != 0 )
+            {
+               const std::string message = "ERROR: Cannot stat shared memory " + name + ": " + std::strerror(errno) + ".";
+               close(fd);
+               fail(message);
+            }
+            if ( size_t(st.st_size) >= data_offset && !out.map(fd, size_t(st.st_size)) )
+            {
+               const std::string message = "ERROR: Cannot map shared memory " + name + ": " + std::strerror(errno) + ".";
+               close(fd);
+               fail(message);
+            }
+            close(fd);
+
+            if ( out.base == nullptr || out.head()->ready.load(std::memory_order_acquire) != ready_tag )
+            {
+               if ( last_try )
+                  fail("ERROR: Shared memory " + name + " is not an initialised lawcat matrix.");
+               std::this_thread::sleep_for(std::chrono::milliseconds(1));
+               continue;
+            }
+
+            const header* h = out.head();
+            if ( h->element_size != sizeof(T) )
+               fail("ERROR: Element size in shared memory " + name + " does not match the requested type.");
+            if ( data_offset + h->n_rows * h->n_cols * sizeof(T) > out.n_bytes )
+               fail("ERROR: Shared memory " + name + " is smaller than its header claims.");
+
+            out.link_rows();
+            return out;
+         }
+      }
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      void shared_mat<T>::unlink(const std::string& name)
+      {
+         if ( shm_unlink(name.c_str()) != 0 )
+            fail("ERROR: Cannot unlink shared memory " + name + ": " + std::strerror(errno) + ".");
+      }
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      shared_mat<T>::shared_mat(shared_mat<T>&& other) noexcept
+         : name(std::move(other.name)), mode(other.mode), n_bytes(other.n_bytes), base(other.base), table(std::move(other.table))
+      {
+         other.base = nullptr;
+         other.n_bytes = 0;
+      }
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      shared_mat<T>::~shared_mat()
+      {
+         if ( this->base != nullptr )
+            munmap(this->base, this->n_bytes);
+      }
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      template <typename F>
+         auto shared_mat<T>::read(F&& fn) const
+         {
+            const header* h = this->head();
+            const std::atomic<uint64_t>& seq = h->sequence;
+            size_t spins = 0;
+            while ( true )
+            {
+               const uint64_t before = seq.load(std::memory_order_acquire);
+               if ( before & 1 )
+               {
+                  if ( ++spins % owner_check_interval == 0 && owner_dead(h->owner.load(std::memory_order_relaxed)) )
+                     default_policy::failure({ mat_errc::writer_died, {}, this->name });
+                  std::this_thread::yield();
+                  continue;
+               }
+               if ( h->poisoned.load(std::memory_order_relaxed) != 0 )
+                  default_policy::failure({ mat_errc::segment_poisoned, {}, this->name });
+
+               if constexpr ( std::is_void_v<std::invoke_result_t<F&, const T* const*>> )
+               {
+                  fn(this->rows());
+                  std::atomic_thread_fence(std::memory_order_acquire);
+                  if ( seq.load(std::memory_order_relaxed) == before )
+                     return;
+               }
+               else
+               {
+                  auto result = fn(this->rows());
+                  std::atomic_thread_fence(std::memory_order_acquire);
+                  if ( seq.load(std::memory_order_relaxed) == before )
+                     return result;
+               }
+            }
+         }
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      template <typename Policy, typename F>
+         policy_result<Policy> shared_mat<T>::write(F&& fn)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( this->mode == shm_mode::read_only )
+                  return Policy::template failure<>({ mat_errc::read_only, {}, this->name });
+            }
+
+            header* h = this->head();
+            const uint64_t self = uint64_t(getpid());
+            for ( size_t spins = 1; ; ++spins )
+            {
+               // Only ever expect a free lock here, so a failed attempt can
+               // never hand us a live owner's lock.
+               uint64_t holder = 0;
+               if ( h->owner.compare_exchange_weak(holder, self, std::memory_order_acquire, std::memory_order_relaxed) )
+                  break;
+               // A dead owner keeps the lock forever; take it over and mark
+               // whatever it left behind as untrustworthy. The exchange only
+               // succeeds if the dead process still holds it.
+               if ( spins % owner_check_interval == 0 && owner_dead(holder)
+                     && h->owner.compare_exchange_strong(holder, self, std::memory_order_acquire, std::memory_order_relaxed) )
+               {
+                  h->poisoned.store(1, std::memory_order_relaxed);
+                  break;
+               }
+               std::this_thread::yield();
+            }
+
+            // The sequence is odd here only when taking over from a dead owner.
+            std::atomic<uint64_t>& seq = h->sequence;
+            uint64_t odd = seq.load(std::memory_order_relaxed);
+            if ( (odd & 1) == 0 )
+               seq.store(++odd, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+#if defined(__cpp_exceptions)
+            try
+            {
+               fn(this->table.data());
+            }
+            catch ( ... )
+            {
+               h->poisoned.store(1, std::memory_order_relaxed);
+               seq.store(odd + 1, std::memory_order_release);
+               h->owner.store(0, std::memory_order_release);
+               throw;
+            }
+#else
+            fn(this->table.data());
+#endif
+            seq.store(odd + 1, std::memory_order_release);
+            h->owner.store(0, std::memory_order_release);
+            return Policy::success();
+         }
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      mat<T> shared_mat<T>::snapshot() const
+      {
+         const size_t n_rows = this->get_n_rows();
+         const size_t n_cols = this->get_n_cols();
+         mat<T> out(n_rows, n_cols);
+         this->read([&](const T* const* rows) {
+            for ( size_t i = 0; i < n_rows; ++i )
+               std::memcpy(out.row(i), rows[i], n_cols * sizeof(T));
+         });
+         return out;
+      }
+
+   template <typename T>
+      requires std::is_trivially_copyable_v<T>
+      template <typename Policy>
+         policy_result<Policy> shared_mat<T>::assign(const mat<T>& m_a)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( this->mode == shm_mode::read_only )
+                  return Policy::template failure<>({ mat_errc::read_only, {}, this->name });
+               if ( this->get_n_rows() != m_a.get_n_rows() || this->get_n_cols() != m_a.get_n_cols() )
+                  return Policy::template failure<>({ mat_errc::dimension_mismatch, { this->get_n_rows(), this->get_n_cols(), m_a.get_n_rows(), m_a.get_n_cols() } });
+            }
+
+            const size_t n_cols = this->get_n_cols();
+            header* h = this->head();
+            this->template write<unchecked_policy>([&](T* const* rows) {
+               for ( size_t i = 0; i < m_a.get_n_rows(); ++i )
+                  std::memcpy(rows[i], m_a.row(i), n_cols * sizeof(T));
+               // Every element is rewritten, so earlier failed updates no
+               // longer matter.
+               h->poisoned.store(0, std::memory_order_relaxed);
+            });
+            return Policy::success();
+         }
+}
+#endif
@@ -0,0 +1,208 @@
+#ifndef SKETCH
+#define SKETCH
+#include <algorithm>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <vector>
+#include "mat.cpp"
+#include "parallel.cpp"
+
+namespace lawcat
+{
+   inline bool is_power_of_two(const size_t& n)
+   {
+      return n != 0 && (n & (n - 1)) == 0;
+   }
+
+   inline size_t next_power_of_two(const size_t& n)
+   {
+      size_t p = 1;
+      while ( p < n )
+         p <<= 1;
+      return p;
+   }
+
+   // Unnormalised in-place Walsh-Hadamard transform of a power-of-two length
+   // array. Each stage is a pair of contiguous sweeps, which vectorise. The
+   // length is checked per Policy.
+   template <typename Policy = default_policy, typename T>
+      policy_result<Policy> fwht_inplace(T* x, const size_t& n)
+      {
+         if constexpr ( Policy::checked )
+         {
+            if ( !is_power_of_two(n) )
+               return Policy::template failure<>({ mat_errc::not_power_of_two });
+         }
+
+         for ( size_t h = 1; h < n; h <<= 1 )
+            for ( size_t i = 0; i < n; i += 2 * h )
+            {
+               T* lo = x + i;
+               T* hi = x + i + h;
+               for ( size_t j = 0; j < h; ++j )
+               {
+                  const T a = lo[j];
+                  const T b = hi[j];
+                  lo[j] = a + b;
+                  hi[j] = a - b;
+               }
+            }
+         return Policy::success();
+      }
+
+   template <typename Policy = default_policy, typename T>
+      policy_result<Policy> fwht_rows(mat<T>& m_a)
+      {
+         if constexpr ( Policy::checked )
+         {
+            if ( !is_power_of_two(m_a.get_n_cols()) )
+               return Policy::template failure<>({ mat_errc::not_power_of_two });
+         }
+
+         parallel_for(0, m_a.get_n_rows(), [&](size_t lo, size_t hi) {
+            for ( size_t i = lo; i < hi; ++i )
+               fwht_inplace<unchecked_policy>(m_a.row(i), m_a.get_n_cols());
+         });
+         return Policy::success();
+      }
+
+   // Subsampled randomised Hadamard transform, mapping rows of length n to rows
+   // of length k as x -> sqrt(1 / k) * R H D x, where D flips signs at random, H
+   // is the unnormalised Hadamard transform on x zero-padded to a power of two
+   // and R keeps k of its coordinates. Costs O(n log n) per row.
+   template <std::floating_point T>
+      class srht
+      {
+         public:
+            srht(const size_t& n, const size_t& k, const uint64_t& seed)
+               : n(n), k(k), padded(next_power_of_two(n)), signs(n)
+            {
+               if ( k == 0 || k > this->padded )
+                  default_policy::failure({ mat_errc::srht_dimension });
+
+               std::mt19937_64 gen(seed);
+               for ( T& s : this->signs )
+                  s = (gen() & 1) ? T(1) : T(-1);
+
+               std::vector<size_t> idx(this->padded);
+               std::iota(idx.begin(), idx.end(), 0);
+               for ( size_t i = 0; i < k; ++i )
+                  std::swap(idx[i], idx[i + gen() % (this->padded - i)]);
+               this->samples.assign(idx.begin(), idx.begin() + k);
+               std::sort(this->samples.begin(), this->samples.end());
+            }
+
+            size_t input_dim() const { return this->n; }
+            size_t output_dim() const { return this->k; }
+
+            // Row lengths are checked per Policy.
+            template <typename Policy = default_policy>
+               policy_result<Policy, mat<T>> apply(const mat<T>& m_a) const
+               {
+                  if constexpr ( Policy::checked )
+                  {
+                     if ( m_a.get_n_cols() != this->n )
+                        return Policy::template failure<mat<T>>({ mat_errc::sketch_input_mismatch, { this->n, m_a.get_n_cols() }, "SRHT" });
+                  }
+
+                  mat<T> out(m_a.get_n_rows(), this->k);
+                  const T scale = T(1) / std::sqrt(T(this->k));
+
+                  parallel_for(0, m_a.get_n_rows(), [&](size_t lo, size_t hi) {
+                     std::vector<T> buf(this->padded);
+                     for ( size_t i = lo; i < hi; ++i )
+                     {
+                        const T* x = m_a.row(i);
+                        for ( size_t j = 0; j < this->n; ++j )
+                           buf[j] = x[j] * this->signs[j];
+                        std::fill(buf.begin() + this->n, buf.end(), T(0));
+
+                        fwht_inplace<unchecked_policy>(buf.data(), this->padded);
+
+                        T* y = out.row(i);
+                        for ( size_t j = 0; j < this->k; ++j )
+                           y[j] = buf[this->samples[j]] * scale;
+                     }
+                  });
+
+                  return out;
+               }
+
+         private:
+            size_t n;
+            size_t k;
+            size_t padded;
+            std::vector<T> signs;
+            std::vector<size_t> samples;
+      };
+
+   // Sparse sign embedding: every input coordinate is added, with a random sign
+   // and weight 1 / sqrt(nnz), to nnz distinct random output coordinates. With
+   // nnz = 1 this is CountSketch. Costs O(nnz * n) per row.
+   template <std::floating_point T>
+      class sparse_sign_embedding
+      {
+         public:
+            sparse_sign_embedding(const size_t& n, const size_t& k, const uint64_t& seed, const size_t& nnz = 1)
+               : n(n), k(k), nnz(nnz), buckets(n * nnz), weights(n * nnz)
+            {
+               if ( k == 0 || nnz == 0 || nnz > k )
+                  default_policy::failure({ mat_errc::sparse_embedding_nnz });
+
+               std::mt19937_64 gen(seed);
+               const T w = T(1) / std::sqrt(T(nnz));
+               for ( size_t j = 0; j < n; ++j )
+                  for ( size_t s = 0; s < nnz; ++s )
+                  {
+                     size_t b;
+                     do
+                        b = gen() % k;
+                     while ( std::find(this->buckets.begin() + j * nnz, this->buckets.begin() + j * nnz + s, b) != this->buckets.begin() + j * nnz + s );
+
+                     this->buckets[j * nnz + s] = b;
+                     this->weights[j * nnz + s] = (gen() & 1) ? w : -w;
+                  }
+            }
+
+            size_t input_dim() const { return this->n; }
+            size_t output_dim() const { return this->k; }
+
+            // Row lengths are checked per Policy.
+            template <typename Policy = default_policy>
+               policy_result<Policy, mat<T>> apply(const mat<T>& m_a) const
+               {
+                  if constexpr ( Policy::checked )
+                  {
+                     if ( m_a.get_n_cols() != this->n )
+                        return Policy::template failure<mat<T>>({ mat_errc::sketch_input_mismatch, { this->n, m_a.get_n_cols() }, "Sparse embedding" });
+                  }
+
+                  mat<T> out(m_a.get_n_rows(), this->k);
+                  out.fill(T(0));
+
+                  parallel_for(0, m_a.get_n_rows(), [&](size_t lo, size_t hi) {
+                     for ( size_t i = lo; i < hi; ++i )
+                     {
+                        const T* x = m_a.row(i);
+                        T* y = out.row(i);
+                        for ( size_t j = 0; j < this->n; ++j )
+                           for ( size_t s = 0; s < this->nnz; ++s )
+                              y[this->buckets[j * this->nnz + s]] += this->weights[j * this->nnz + s] * x[j];
+                     }
+                  });
+
+                  return out;
+               }
+
+         private:
+            size_t n;
+            size_t k;
+            size_t nnz;
+            std::vector<size_t> buckets;
+            std::vector<T> weights;
+      };
+}
+#endif
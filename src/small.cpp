@@ -0,0 +1,143 @@
+#ifndef SMALL
+#define SMALL
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace lawcat
+{
+   // Unrolled kernels for matrices with 2 to 16 columns (and, for GEMM, a
+   // shared dimension in the same range). The column count is a template
+   // parameter, so loops over a row unroll and the accumulators of a row stay
+   // in registers. Runtime sizes pick an instantiation through a
+   // constexpr table of function pointers; each small_* entry point returns
+   // false when the size is outside the table so callers fall back to their
+   // generic loop.
+   inline constexpr size_t small_min = 2;
+   inline constexpr size_t small_max = 16;
+
+   inline constexpr bool is_small(const size_t& n)
+   {
+      return n >= small_min && n <= small_max;
+   }
+
+   namespace detail
+   {
+      template <size_t N, typename F>
+         inline void unroll(F&& f)
+         {
+            [&]<size_t... I>(std::index_sequence<I...>) {
+               (f(std::integral_constant<size_t, I> {}), ...);
+            }(std::make_index_sequence<N> {});
+         }
+
+      struct small_add_op
+      {
+         template <typename T>
+            T operator()(const T& x, const T& y) const { return x + y; }
+      };
+
+      struct small_sub_op
+      {
+         template <typename T>
+            T operator()(const T& x, const T& y) const { return x - y; }
+      };
+
+      struct small_mul_op
+      {
+         template <typename T>
+            T operator()(const T& x, const T& y) const { return x * y; }
+      };
+
+      template <size_t N, typename Op, typename T>
+         void small_elementwise_kernel(const T* const* a, const T* const* b, T* const* c, const size_t& n_rows)
+         {
+            const Op op;
+            for ( size_t i = 0; i < n_rows; ++i )
+            {
+               const T* x = a[i];
+               const T* y = b[i];
+               T* z = c[i];
+               unroll<N>([&](auto j) { z[j] = op(x[j], y[j]); });
+            }
+         }
+
+      // c (m x N) = a (m x k) * b (k x N), one row of c in registers at a time.
+      // Only N is a template parameter: unrolling k as well would multiply the
+      // instantiations by 15 for little gain once a row of c is in registers.
+      template <size_t N, typename T>
+         void small_gemm_kernel(const T* const* a, const T* const* b, T* const* c, const size_t& m, const size_t& k)
+         {
+            for ( size_t i = 0; i < m; ++i )
+            {
+               const T* a_row = a[i];
+               T acc[N];
+               unroll<N>([&](auto j) { acc[j] = T(0); });
+               for ( size_t p = 0; p < k; ++p )
+               {
+                  const T a_ip = a_row[p];
+                  const T* b_row = b[p];
+                  unroll<N>([&](auto j) { acc[j] += a_ip * b_row[j]; });
+               }
+               T* c_row = c[i];
+               unroll<N>([&](auto j) { c_row[j] = acc[j]; });
+            }
+         }
+
+      template <typename Op, typename T>
+         using small_elementwise_fn = void (*)(const T* const*, const T* const*, T* const*, const size_t&);
+
+      template <typename T>
+         using small_gemm_fn = void (*)(const T* const*, const T* const*, T* const*, const size_t&, const size_t&);
+
+      template <typename Op, typename T>
+         inline constexpr auto small_elementwise_table = []<size_t... I>(std::index_sequence<I...>) {
+            return std::array<small_elementwise_fn<Op, T>, small_max - small_min + 1> { &small_elementwise_kernel<small_min + I, Op, T>... };
+         }(std::make_index_sequence<small_max - small_min + 1> {});
+
+      template <typename T>
+         inline constexpr auto small_gemm_table = []<size_t... I>(std::index_sequence<I...>) {
+            return std::array<small_gemm_fn<T>, small_max - small_min + 1> { &small_gemm_kernel<small_min + I, T>... };
+         }(std::make_index_sequence<small_max - small_min + 1> {});
+
+      template <typename Op, typename T>
+         bool small_elementwise(const T* const* a, const T* const* b, T* const* c, const size_t& n_rows, const size_t& n_cols)
+         {
+            if ( !is_small(n_cols) )
+               return false;
+            small_elementwise_table<Op, T>[n_cols - small_min](a, b, c, n_rows);
+            return true;
+         }
+   }
+
+   // c = a + b over n_rows rows of n_cols columns.
+   template <typename T>
+      bool small_add(const T* const* a, const T* const* b, T* const* c, const size_t& n_rows, const size_t& n_cols)
+      {
+         return detail::small_elementwise<detail::small_add_op>(a, b, c, n_rows, n_cols);
+      }
+
+   template <typename T>
+      bool small_sub(const T* const* a, const T* const* b, T* const* c, const size_t& n_rows, const size_t& n_cols)
+      {
+         return detail::small_elementwise<detail::small_sub_op>(a, b, c, n_rows, n_cols);
+      }
+
+   template <typename T>
+      bool small_hadamard(const T* const* a, const T* const* b, T* const* c, const size_t& n_rows, const size_t& n_cols)
+      {
+         return detail::small_elementwise<detail::small_mul_op>(a, b, c, n_rows, n_cols);
+      }
+
+   // c (m x n) = a (m x k) * b (k x n) for n and k in the small range.
+   template <typename T>
+      bool small_gemm(const T* const* a, const T* const* b, T* const* c, const size_t& m, const size_t& n, const size_t& k)
+      {
+         if ( !is_small(n) || !is_small(k) )
+            return false;
+         detail::small_gemm_table<T>[n - small_min](a, b, c, m, k);
+         return true;
+      }
+}
+#endif
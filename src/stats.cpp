@@ -0,0 +1,220 @@
+#ifndef STATS
+#define STATS
+#include <algorithm>
+#include <concepts>
+#include <limits>
+#include <vector>
+#include "mat.cpp"
+#include "gemm.cpp"
+#include "parallel.cpp"
+
+namespace lawcat
+{
+   // Mergeable per-column statistics over a stream of rows: count, mean,
+   // variance, min, max and, optionally, the full covariance matrix.
+   //
+   // Rows are consumed in batches. A batch is reduced on its own (two-pass
+   // mean and centred sums) and folded into the running state with Chan's
+   // parallel update, which is also how accumulators from different threads
+   // merge. The centred covariance of a batch is a rank-k update X_c^T X_c run
+   // through the tiled GEMM.
+   template <std::floating_point T>
+      class row_stats
+      {
+         public:
+            static constexpr size_t batch_rows = 256;
+
+            explicit row_stats(const size_t& n_cols, const bool& track_covariance = false);
+
+            size_t count() const { return this->n; }
+            size_t get_n_cols() const { return this->d; }
+            const std::vector<T>& mean() const { return this->mu; }
+            const std::vector<T>& min() const { return this->lo; }
+            const std::vector<T>& max() const { return this->hi; }
+            // ddof = 1 gives the unbiased sample estimate.
+            std::vector<T> variance(const size_t& ddof = 1) const;
+            // Whether covariance was tracked is checked per Policy.
+            template <typename Policy = default_policy>
+               policy_result<Policy, mat<T>> covariance(const size_t& ddof = 1) const;
+
+            void add(const T* row) { this->add_rows(&row, 1); }
+            void add_rows(const T* const* rows, const size_t& n_rows);
+            void add_rows(const mat<T>& m_a) { this->add_rows(m_a.rows(), m_a.get_n_rows()); }
+
+            // Column counts, and that other tracks covariance when this does,
+            // are checked per Policy.
+            template <typename Policy = default_policy>
+               policy_result<Policy> merge(const row_stats<T>& other);
+
+         private:
+            size_t d;
+            bool track_covariance;
+            size_t n = 0;
+            std::vector<T> mu;
+            std::vector<T> m2;
+            std::vector<T> lo;
+            std::vector<T> hi;
+            mat<T> comoment;
+
+            void add_batch(const T* const* rows, const size_t& b);
+      };
+
+   template <std::floating_point T>
+      row_stats<T>::row_stats(const size_t& n_cols, const bool& track_covariance)
+         : d(n_cols), track_covariance(track_covariance),
+           mu(n_cols, T(0)), m2(n_cols, T(0)),
+           lo(n_cols, std::numeric_limits<T>::infinity()), hi(n_cols, -std::numeric_limits<T>::infinity()),
+           comoment(track_covariance ? n_cols : 0, track_covariance ? n_cols : 0)
+      {
+         this->comoment.fill(T(0));
+      }
+
+   template <std::floating_point T>
+      void row_stats<T>::add_rows(const T* const* rows, const size_t& n_rows)
+      {
+         for ( size_t r0 = 0; r0 < n_rows; r0 += batch_rows )
+            this->add_batch(rows + r0, std::min(batch_rows, n_rows - r0));
+      }
+
+   template <std::floating_point T>
+      void row_stats<T>::add_batch(const T* const* rows, const size_t& b)
+      {
+         const size_t d = this->d;
+         row_stats<T> batch(d, false);
+         batch.n = b;
+
+         for ( size_t i = 0; i < b; ++i )
+         {
+            const T* x = rows[i];
+            for ( size_t j = 0; j < d; ++j )
+            {
+               batch.mu[j] += x[j];
+               batch.lo[j] = std::min(batch.lo[j], x[j]);
+               batch.hi[j] = std::max(batch.hi[j], x[j]);
+            }
+         }
+         for ( size_t j = 0; j < d; ++j )
+            batch.mu[j] /= T(b);
+
+         // Centred batch, stored transposed so the rank-k update is X_c^T X_c = Xt Xt^T.
+         mat<T> xt(d, b);
+         for ( size_t i = 0; i < b; ++i )
+         {
+            const T* x = rows[i];
+            for ( size_t j = 0; j < d; ++j )
+            {
+               const T c = x[j] - batch.mu[j];
+               xt.row(j)[i] = c;
+               batch.m2[j] += c * c;
+            }
+         }
+
+         if ( this->track_covariance )
+         {
+            batch.track_covariance = true;
+            batch.comoment = mat<T>(d, d);
+            gemm_nt_tiles(xt.rows(), d, xt.rows(), d, b, [&](size_t i0, size_t j0, size_t mb, size_t nb, const T* tile, size_t ld) {
+               for ( size_t i = 0; i < mb; ++i )
+                  std::copy(tile + i * ld, tile + i * ld + nb, batch.comoment.row(i0 + i) + j0);
+            });
+         }
+
+         this->template merge<unchecked_policy>(batch);
+      }
+
+   template <std::floating_point T>
+      template <typename Policy>
+         policy_result<Policy> row_stats<T>::merge(const row_stats<T>& other)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( other.d != this->d )
+                  return Policy::template failure<>({ mat_errc::statistics_mismatch, { this->d, other.d } });
+               if ( this->track_covariance && !other.track_covariance && other.n > 0 )
+                  return Policy::template failure<>({ mat_errc::covariance_merge });
+            }
+            if ( other.n == 0 )
+               return Policy::success();
+
+            const size_t d = this->d;
+            const T na = T(this->n);
+            const T nb = T(other.n);
+            const T total = na + nb;
+            const T w = na * nb / total;
+
+            std::vector<T> delta(d);
+            for ( size_t j = 0; j < d; ++j )
+            {
+               delta[j] = other.mu[j] - this->mu[j];
+               this->mu[j] += delta[j] * (nb / total);
+               this->m2[j] += other.m2[j] + delta[j] * delta[j] * w;
+               this->lo[j] = std::min(this->lo[j], other.lo[j]);
+               this->hi[j] = std::max(this->hi[j], other.hi[j]);
+            }
+
+            if ( this->track_covariance )
+               for ( size_t i = 0; i < d; ++i )
+               {
+                  T* c = this->comoment.row(i);
+                  const T* oc = other.comoment.row(i);
+                  const T di = delta[i] * w;
+                  for ( size_t j = 0; j < d; ++j )
+                     c[j] += oc[j] + di * delta[j];
+               }
+
+            this->n += other.n;
+            return Policy::success();
+         }
+
+   template <std::floating_point T>
+      std::vector<T> row_stats<T>::variance(const size_t& ddof) const
+      {
+         std::vector<T> out(this->d, std::numeric_limits<T>::quiet_NaN());
+         if ( this->n <= ddof )
+            return out;
+         for ( size_t j = 0; j < this->d; ++j )
+            out[j] = this->m2[j] / T(this->n - ddof);
+         return out;
+      }
+
+   template <std::floating_point T>
+      template <typename Policy>
+         policy_result<Policy, mat<T>> row_stats<T>::covariance(const size_t& ddof) const
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( !this->track_covariance )
+                  return Policy::template failure<mat<T>>({ mat_errc::covariance_not_tracked });
+            }
+
+            mat<T> out(this->d, this->d);
+            const T scale = this->n > ddof ? T(1) / T(this->n - ddof) : std::numeric_limits<T>::quiet_NaN();
+            for ( size_t i = 0; i < this->d; ++i )
+               for ( size_t j = 0; j < this->d; ++j )
+                  out.row(i)[j] = this->comoment.get(i, j) * scale;
+            return out;
+         }
+
+   // Statistics over the rows of m_a, reduced in parallel and merged.
+   template <std::floating_point T>
+      row_stats<T> column_stats(const mat<T>& m_a, const bool& track_covariance = false)
+      {
+         const size_t n_chunks = std::max<size_t>(1, std::min(thread_count(), m_a.get_n_rows() / row_stats<T>::batch_rows));
+         const size_t chunk = (m_a.get_n_rows() + n_chunks - 1) / n_chunks;
+
+         std::vector<row_stats<T>> parts(n_chunks, row_stats<T>(m_a.get_n_cols(), track_covariance));
+         parallel_for(0, n_chunks, 1, [&](size_t lo, size_t hi) {
+            for ( size_t c = lo; c < hi; ++c )
+            {
+               const size_t r0 = std::min(m_a.get_n_rows(), c * chunk);
+               const size_t r1 = std::min(m_a.get_n_rows(), r0 + chunk);
+               parts[c].add_rows(m_a.rows() + r0, r1 - r0);
+            }
+         });
+
+         for ( size_t c = 1; c < n_chunks; ++c )
+            parts[0].template merge<unchecked_policy>(parts[c]);
+         return parts[0];
+      }
+}
+#endif
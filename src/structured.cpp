@@ -0,0 +1,498 @@
+#ifndef STRUCTURED
+#define STRUCTURED
+#include <algorithm>
+#include <vector>
+#include "mat.cpp"
+#include "gemm.cpp"
+#include "parallel.cpp"
+
+namespace lawcat
+{
+   template <typename T>
+      class diagonal_matrix
+      {
+         public:
+            explicit diagonal_matrix(const std::vector<T>& values) : values(values) {}
+
+            size_t size() const { return this->values.size(); }
+            const T& get(const size_t& i) const { return this->values[i]; }
+
+            // Scales row i of m_a by the i-th diagonal entry.
+            void apply_inplace(mat<T>& m_a) const
+            {
+               check_product_dimensions(this->size(), this->size(), m_a.get_n_rows(), m_a.get_n_cols());
+               parallel_for(0, m_a.get_n_rows(), [&](size_t lo, size_t hi) {
+                  for ( size_t i = lo; i < hi; ++i )
+                  {
+                     T* r = m_a.row(i);
+                     const T d = this->values[i];
+                     for ( size_t j = 0; j < m_a.get_n_cols(); ++j )
+                        r[j] *= d;
+                  }
+               });
+            }
+
+            mat<T> to_dense() const
+            {
+               mat<T> out(this->size(), this->size());
+               out.fill(T(0));
+               for ( size_t i = 0; i < this->size(); ++i )
+                  out.row(i)[i] = this->values[i];
+               return out;
+            }
+
+         private:
+            std::vector<T> values;
+      };
+
+   // P with P[i][perm[i]] = 1, so (P A)[i] = A[perm[i]].
+   class permutation_matrix
+   {
+      public:
+         explicit permutation_matrix(const std::vector<size_t>& perm) : perm(perm)
+         {
+            std::vector<bool> seen(perm.size(), false);
+            for ( const size_t p : perm )
+            {
+               if ( p >= perm.size() || seen[p] )
+                  default_policy::failure({ mat_errc::not_a_permutation });
+               seen[p] = true;
+            }
+         }
+
+         static permutation_matrix identity(const size_t& n)
+         {
+            std::vector<size_t> perm(n);
+            for ( size_t i = 0; i < n; ++i )
+               perm[i] = i;
+            return permutation_matrix(perm);
+         }
+
+         // LAPACK-style pivots: row i was swapped with row pivots[i], in order.
+         static permutation_matrix from_pivots(const std::vector<size_t>& pivots)
+         {
+            std::vector<size_t> perm(pivots.size());
+            for ( size_t i = 0; i < perm.size(); ++i )
+               perm[i] = i;
+            for ( size_t i = 0; i < pivots.size(); ++i )
+            {
+               if ( pivots[i] >= perm.size() )
+                  default_policy::failure({ mat_errc::pivot_out_of_range });
+               std::swap(perm[i], perm[pivots[i]]);
+            }
+            return permutation_matrix(perm);
+         }
+
+         size_t size() const { return this->perm.size(); }
+         const std::vector<size_t>& indices() const { return this->perm; }
+
+         permutation_matrix inverse() const
+         {
+            std::vector<size_t> inv(this->size());
+            for ( size_t i = 0; i < this->size(); ++i )
+               inv[this->perm[i]] = i;
+            return permutation_matrix(inv);
+         }
+
+         // Permutes the rows of m_a in place by following the cycles of perm;
+         // each step is an O(1) row-pointer swap.
+         template <typename T>
+            void apply_inplace(mat<T>& m_a) const
+            {
+               check_product_dimensions(this->size(), this->size(), m_a.get_n_rows(), m_a.get_n_cols());
+
+               std::vector<bool> done(this->size(), false);
+               for ( size_t start = 0; start < this->size(); ++start )
+               {
+                  if ( done[start] )
+                     continue;
+                  size_t i = start;
+                  done[i] = true;
+                  while ( !done[this->perm[i]] )
+                  {
+                     m_a.swap_rows(i, this->perm[i]);
+                     i = this->perm[i];
+                     done[i] = true;
+                  }
+               }
+            }
+
+         template <typename T>
+            mat<T> to_dense() const
+            {
+               mat<T> out(this->size(), this->size());
+               out.fill(T(0));
+               for ( size_t i = 0; i < this->size(); ++i )
+                  out.row(i)[this->perm[i]] = T(1);
+               return out;
+            }
+
+      private:
+         std::vector<size_t> perm;
+   };
+
+   template <typename T>
+      class scaled_identity
+      {
+         public:
+            scaled_identity(const size_t& n, const T& alpha = T(1)) : n(n), alpha(alpha) {}
+
+            size_t size() const { return this->n; }
+            const T& scale() const { return this->alpha; }
+
+            mat<T> to_dense() const
+            {
+               mat<T> out(this->n, this->n);
+               out.fill(T(0));
+               for ( size_t i = 0; i < this->n; ++i )
+                  out.row(i)[i] = this->alpha;
+               return out;
+            }
+
+         private:
+            size_t n;
+            T alpha;
+      };
+
+   // Square or rectangular blocks placed along the diagonal; everything off the
+   // blocks is zero.
+   template <typename T>
+      class block_diagonal
+      {
+         public:
+            explicit block_diagonal(const std::vector<mat<T>>& blocks) : blocks(blocks)
+            {
+               for ( const mat<T>& b : blocks )
+               {
+                  this->n_rows += b.get_n_rows();
+                  this->n_cols += b.get_n_cols();
+               }
+            }
+
+            size_t get_n_rows() const { return this->n_rows; }
+            size_t get_n_cols() const { return this->n_cols; }
+            const std::vector<mat<T>>& get_blocks() const { return this->blocks; }
+
+            mat<T> to_dense() const
+            {
+               mat<T> out(this->n_rows, this->n_cols);
+               out.fill(T(0));
+               size_t r0 = 0;
+               size_t c0 = 0;
+               for ( const mat<T>& b : this->blocks )
+               {
+                  for ( size_t i = 0; i < b.get_n_rows(); ++i )
+                     std::copy(b.row(i), b.row(i) + b.get_n_cols(), out.row(r0 + i) + c0);
+                  r0 += b.get_n_rows();
+                  c0 += b.get_n_cols();
+               }
+               return out;
+            }
+
+         private:
+            std::vector<mat<T>> blocks;
+            size_t n_rows = 0;
+            size_t n_cols = 0;
+      };
+
+   // Products with dense matrices: O(n^2) for diagonal, permutation and scaled
+   // identity, one GEMM per block for block-diagonal.
+
+   namespace detail
+   {
+      template <typename T>
+         void scale_rows(mat<T>& m_a, const T& alpha)
+         {
+            parallel_for(0, m_a.get_n_rows(), [&](size_t lo, size_t hi) {
+               for ( size_t i = lo; i < hi; ++i )
+               {
+                  T* r = m_a.row(i);
+                  for ( size_t j = 0; j < m_a.get_n_cols(); ++j )
+                     r[j] *= alpha;
+               }
+            });
+         }
+
+      // Dense matrix with value(i) at (i, perm[i]) and zeros elsewhere.
+      template <typename T, typename F>
+         mat<T> monomial(const permutation_matrix& p, F&& value)
+         {
+            mat<T> out(p.size(), p.size());
+            out.fill(T(0));
+            for ( size_t i = 0; i < p.size(); ++i )
+               out.row(i)[p.indices()[i]] = value(i);
+            return out;
+         }
+   }
+
+   template <typename T>
+      mat<T> operator*(const diagonal_matrix<T>& d, const mat<T>& m_a)
+      {
+         mat<T> out = m_a;
+         d.apply_inplace(out);
+         return out;
+      }
+
+   template <typename T>
+      mat<T> operator*(const mat<T>& m_a, const diagonal_matrix<T>& d)
+      {
+         check_product_dimensions(m_a.get_n_rows(), m_a.get_n_cols(), d.size(), d.size());
+         mat<T> out(m_a.get_n_rows(), m_a.get_n_cols());
+         parallel_for(0, m_a.get_n_rows(), [&](size_t lo, size_t hi) {
+            for ( size_t i = lo; i < hi; ++i )
+               for ( size_t j = 0; j < m_a.get_n_cols(); ++j )
+                  out.row(i)[j] = m_a.row(i)[j] * d.get(j);
+         });
+         return out;
+      }
+
+   template <typename T>
+      mat<T> operator*(const permutation_matrix& p, const mat<T>& m_a)
+      {
+         check_product_dimensions(p.size(), p.size(), m_a.get_n_rows(), m_a.get_n_cols());
+         mat<T> out(m_a.get_n_rows(), m_a.get_n_cols());
+         for ( size_t i = 0; i < p.size(); ++i )
+            std::copy(m_a.row(p.indices()[i]), m_a.row(p.indices()[i]) + m_a.get_n_cols(), out.row(i));
+         return out;
+      }
+
+   // (A P)[:, perm[i]] = A[:, i]
+   template <typename T>
+      mat<T> operator*(const mat<T>& m_a, const permutation_matrix& p)
+      {
+         check_product_dimensions(m_a.get_n_rows(), m_a.get_n_cols(), p.size(), p.size());
+         mat<T> out(m_a.get_n_rows(), m_a.get_n_cols());
+         for ( size_t r = 0; r < m_a.get_n_rows(); ++r )
+            for ( size_t i = 0; i < p.size(); ++i )
+               out.row(r)[p.indices()[i]] = m_a.row(r)[i];
+         return out;
+      }
+
+   template <typename T>
+      mat<T> operator*(const scaled_identity<T>& s, const mat<T>& m_a)
+      {
+         check_product_dimensions(s.size(), s.size(), m_a.get_n_rows(), m_a.get_n_cols());
+         mat<T> out = m_a;
+         detail::scale_rows(out, s.scale());
+         return out;
+      }
+
+   template <typename T>
+      mat<T> operator*(const mat<T>& m_a, const scaled_identity<T>& s)
+      {
+         check_product_dimensions(m_a.get_n_rows(), m_a.get_n_cols(), s.size(), s.size());
+         mat<T> out = m_a;
+         detail::scale_rows(out, s.scale());
+         return out;
+      }
+
+   template <typename T>
+      mat<T> operator*(const block_diagonal<T>& bd, const mat<T>& m_a)
+      {
+         check_product_dimensions(bd.get_n_rows(), bd.get_n_cols(), m_a.get_n_rows(), m_a.get_n_cols());
+         mat<T> out(bd.get_n_rows(), m_a.get_n_cols());
+
+         size_t r0 = 0;
+         size_t c0 = 0;
+         for ( const mat<T>& b : bd.get_blocks() )
+         {
+            mat<T> slab(b.get_n_cols(), m_a.get_n_cols());
+            for ( size_t i = 0; i < b.get_n_cols(); ++i )
+               std::copy(m_a.row(c0 + i), m_a.row(c0 + i) + m_a.get_n_cols(), slab.row(i));
+
+            const mat<T> prod = gemm(b, slab);
+            for ( size_t i = 0; i < prod.get_n_rows(); ++i )
+               std::copy(prod.row(i), prod.row(i) + prod.get_n_cols(), out.row(r0 + i));
+
+            r0 += b.get_n_rows();
+            c0 += b.get_n_cols();
+         }
+         return out;
+      }
+
+   // Block i of bd maps columns [r0, r0 + rows) of m_a to [c0, c0 + cols).
+   template <typename T>
+      mat<T> operator*(const mat<T>& m_a, const block_diagonal<T>& bd)
+      {
+         check_product_dimensions(m_a.get_n_rows(), m_a.get_n_cols(), bd.get_n_rows(), bd.get_n_cols());
+         mat<T> out(m_a.get_n_rows(), bd.get_n_cols());
+
+         size_t r0 = 0;
+         size_t c0 = 0;
+         for ( const mat<T>& b : bd.get_blocks() )
+         {
+            mat<T> slab(m_a.get_n_rows(), b.get_n_rows());
+            for ( size_t i = 0; i < m_a.get_n_rows(); ++i )
+               std::copy(m_a.row(i) + r0, m_a.row(i) + r0 + b.get_n_rows(), slab.row(i));
+
+            const mat<T> prod = gemm(slab, b);
+            for ( size_t i = 0; i < prod.get_n_rows(); ++i )
+               std::copy(prod.row(i), prod.row(i) + prod.get_n_cols(), out.row(i) + c0);
+
+            r0 += b.get_n_rows();
+            c0 += b.get_n_cols();
+         }
+         return out;
+      }
+
+   // Products between structured types stay structured where the result has
+   // the same structure; otherwise they are built densely in O(n^2).
+
+   template <typename T>
+      diagonal_matrix<T> operator*(const diagonal_matrix<T>& d_a, const diagonal_matrix<T>& d_b)
+      {
+         check_product_dimensions(d_a.size(), d_a.size(), d_b.size(), d_b.size());
+         std::vector<T> values(d_a.size());
+         for ( size_t i = 0; i < values.size(); ++i )
+            values[i] = d_a.get(i) * d_b.get(i);
+         return diagonal_matrix<T>(values);
+      }
+
+   // (P Q)[i] = Q[p[i]], whose one sits in column q[p[i]].
+   inline permutation_matrix operator*(const permutation_matrix& p, const permutation_matrix& q)
+   {
+      check_product_dimensions(p.size(), p.size(), q.size(), q.size());
+      std::vector<size_t> perm(p.size());
+      for ( size_t i = 0; i < perm.size(); ++i )
+         perm[i] = q.indices()[p.indices()[i]];
+      return permutation_matrix(perm);
+   }
+
+   template <typename T>
+      scaled_identity<T> operator*(const scaled_identity<T>& s_a, const scaled_identity<T>& s_b)
+      {
+         check_product_dimensions(s_a.size(), s_a.size(), s_b.size(), s_b.size());
+         return scaled_identity<T>(s_a.size(), s_a.scale() * s_b.scale());
+      }
+
+   template <typename T>
+      diagonal_matrix<T> operator*(const scaled_identity<T>& s, const diagonal_matrix<T>& d)
+      {
+         check_product_dimensions(s.size(), s.size(), d.size(), d.size());
+         std::vector<T> values(d.size());
+         for ( size_t i = 0; i < values.size(); ++i )
+            values[i] = s.scale() * d.get(i);
+         return diagonal_matrix<T>(values);
+      }
+
+   template <typename T>
+      diagonal_matrix<T> operator*(const diagonal_matrix<T>& d, const scaled_identity<T>& s)
+      {
+         return s * d;
+      }
+
+   // A permutation times a diagonal or scaled identity has one nonzero per row
+   // and column but is not itself a permutation.
+
+   // (P D)[i][perm[i]] = d[perm[i]]
+   template <typename T>
+      mat<T> operator*(const permutation_matrix& p, const diagonal_matrix<T>& d)
+      {
+         check_product_dimensions(p.size(), p.size(), d.size(), d.size());
+         return detail::monomial<T>(p, [&](size_t i) { return d.get(p.indices()[i]); });
+      }
+
+   // (D P)[i][perm[i]] = d[i]
+   template <typename T>
+      mat<T> operator*(const diagonal_matrix<T>& d, const permutation_matrix& p)
+      {
+         check_product_dimensions(d.size(), d.size(), p.size(), p.size());
+         return detail::monomial<T>(p, [&](size_t i) { return d.get(i); });
+      }
+
+   template <typename T>
+      mat<T> operator*(const permutation_matrix& p, const scaled_identity<T>& s)
+      {
+         check_product_dimensions(p.size(), p.size(), s.size(), s.size());
+         return detail::monomial<T>(p, [&](size_t) { return s.scale(); });
+      }
+
+   template <typename T>
+      mat<T> operator*(const scaled_identity<T>& s, const permutation_matrix& p)
+      {
+         return p * s;
+      }
+
+   // D BD scales the rows of each block, BD D its columns.
+   template <typename T>
+      block_diagonal<T> operator*(const diagonal_matrix<T>& d, const block_diagonal<T>& bd)
+      {
+         check_product_dimensions(d.size(), d.size(), bd.get_n_rows(), bd.get_n_cols());
+         std::vector<mat<T>> blocks = bd.get_blocks();
+         size_t r0 = 0;
+         for ( mat<T>& b : blocks )
+         {
+            for ( size_t i = 0; i < b.get_n_rows(); ++i )
+               for ( size_t j = 0; j < b.get_n_cols(); ++j )
+                  b.row(i)[j] *= d.get(r0 + i);
+            r0 += b.get_n_rows();
+         }
+         return block_diagonal<T>(blocks);
+      }
+
+   template <typename T>
+      block_diagonal<T> operator*(const block_diagonal<T>& bd, const diagonal_matrix<T>& d)
+      {
+         check_product_dimensions(bd.get_n_rows(), bd.get_n_cols(), d.size(), d.size());
+         std::vector<mat<T>> blocks = bd.get_blocks();
+         size_t c0 = 0;
+         for ( mat<T>& b : blocks )
+         {
+            for ( size_t i = 0; i < b.get_n_rows(); ++i )
+               for ( size_t j = 0; j < b.get_n_cols(); ++j )
+                  b.row(i)[j] *= d.get(c0 + j);
+            c0 += b.get_n_cols();
+         }
+         return block_diagonal<T>(blocks);
+      }
+
+   template <typename T>
+      block_diagonal<T> operator*(const scaled_identity<T>& s, const block_diagonal<T>& bd)
+      {
+         check_product_dimensions(s.size(), s.size(), bd.get_n_rows(), bd.get_n_cols());
+         std::vector<mat<T>> blocks = bd.get_blocks();
+         for ( mat<T>& b : blocks )
+            detail::scale_rows(b, s.scale());
+         return block_diagonal<T>(blocks);
+      }
+
+   template <typename T>
+      block_diagonal<T> operator*(const block_diagonal<T>& bd, const scaled_identity<T>& s)
+      {
+         check_product_dimensions(bd.get_n_rows(), bd.get_n_cols(), s.size(), s.size());
+         std::vector<mat<T>> blocks = bd.get_blocks();
+         for ( mat<T>& b : blocks )
+            detail::scale_rows(b, s.scale());
+         return block_diagonal<T>(blocks);
+      }
+
+   // A permutation mixes rows (or columns) across blocks, so the result is
+   // dense.
+   template <typename T>
+      mat<T> operator*(const permutation_matrix& p, const block_diagonal<T>& bd)
+      {
+         return p * bd.to_dense();
+      }
+
+   template <typename T>
+      mat<T> operator*(const block_diagonal<T>& bd, const permutation_matrix& p)
+      {
+         return bd.to_dense() * p;
+      }
+
+   // Blocks must line up: the i-th block of bd_a has as many columns as the
+   // i-th block of bd_b has rows.
+   template <typename T>
+      block_diagonal<T> operator*(const block_diagonal<T>& bd_a, const block_diagonal<T>& bd_b)
+      {
+         if ( bd_a.get_blocks().size() != bd_b.get_blocks().size() )
+            default_policy::failure({ mat_errc::block_count_mismatch, { bd_a.get_blocks().size(), bd_b.get_blocks().size() } });
+
+         std::vector<mat<T>> blocks;
+         blocks.reserve(bd_a.get_blocks().size());
+         for ( size_t i = 0; i < bd_a.get_blocks().size(); ++i )
+            blocks.push_back(gemm(bd_a.get_blocks()[i], bd_b.get_blocks()[i]));
+         return block_diagonal<T>(blocks);
+      }
+}
+#endif
@@ -0,0 +1,309 @@
+#ifndef TENSOR
+#define TENSOR
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <vector>
+#include "mat.cpp"
+
+namespace lawcat
+{
+   // Rank-N strided tensor. The elements live in a 1 x numel mat<T> that is
+   // shared between a tensor and every view taken from it (permute, slice,
+   // diagonal, reshape of a contiguous tensor), so views never copy. Strides
+   // are in elements and the default layout is row-major. Indices, axes and
+   // shapes are checked per Policy.
+   template <typename T>
+      class tensor
+      {
+         public:
+            explicit tensor(const std::vector<size_t>& shape);
+
+            static tensor<T> from_mat(const mat<T>& m_a);
+            template <typename Policy = default_policy>
+               policy_result<Policy, mat<T>> to_mat() const;
+
+            size_t get_rank() const { return this->shape.size(); }
+            size_t get_numel() const;
+            const std::vector<size_t>& get_shape() const { return this->shape; }
+            const std::vector<size_t>& get_strides() const { return this->strides; }
+
+            template <typename Policy = default_policy>
+               policy_result<Policy, T> get(const std::vector<size_t>& index) const
+               {
+                  if constexpr ( Policy::checked )
+                  {
+                     if ( const std::optional<mat_error> error = this->index_error(index) )
+                        return Policy::template failure<T>(*error);
+                  }
+                  return this->base()[this->offset_of(index)];
+               }
+            template <typename Policy = default_policy>
+               policy_result<Policy> set(const std::vector<size_t>& index, const T& value)
+               {
+                  if constexpr ( Policy::checked )
+                  {
+                     if ( const std::optional<mat_error> error = this->index_error(index) )
+                        return Policy::template failure<>(*error);
+                  }
+                  this->base()[this->offset_of(index)] = value;
+                  return Policy::success();
+               }
+            void fill(const T& value);
+
+            // Pointer to the element at index 0 (all zeros).
+            T* data() { return this->base(); }
+            const T* data() const { return this->base(); }
+
+            bool is_contiguous() const;
+            bool shares_storage(const tensor<T>& other) const { return this->storage == other.storage; }
+
+            template <typename Policy = default_policy>
+               policy_result<Policy, tensor<T>> permute(const std::vector<size_t>& axes) const;
+            template <typename Policy = default_policy>
+               policy_result<Policy, tensor<T>> slice(const size_t& axis, const size_t& begin, const size_t& end) const;
+            template <typename Policy = default_policy>
+               policy_result<Policy, tensor<T>> diagonal(const size_t& axis_a, const size_t& axis_b) const;
+            template <typename Policy = default_policy>
+               policy_result<Policy, tensor<T>> reshape(const std::vector<size_t>& new_shape) const;
+            tensor<T> contiguous() const;
+
+            // Calls fn(offset) for the storage offset of every element in
+            // row-major order of the logical index.
+            template <typename F>
+               void for_each_offset(F&& fn) const;
+
+         private:
+            std::shared_ptr<mat<T>> storage;
+            size_t offset;
+            std::vector<size_t> shape;
+            std::vector<size_t> strides;
+
+            T* base() { return this->storage->row(0) + this->offset; }
+            const T* base() const { return static_cast<const mat<T>&>(*this->storage).row(0) + this->offset; }
+            size_t offset_of(const std::vector<size_t>& index) const;
+            std::optional<mat_error> index_error(const std::vector<size_t>& index) const;
+      };
+
+   inline size_t shape_numel(const std::vector<size_t>& shape)
+   {
+      return std::accumulate(shape.begin(), shape.end(), size_t(1), std::multiplies<size_t>());
+   }
+
+   inline std::vector<size_t> row_major_strides(const std::vector<size_t>& shape)
+   {
+      std::vector<size_t> strides(shape.size());
+      size_t s = 1;
+      for ( size_t d = shape.size(); d-- > 0; )
+      {
+         strides[d] = s;
+         s *= shape[d];
+      }
+      return strides;
+   }
+
+   template <typename T>
+      tensor<T>::tensor(const std::vector<size_t>& shape)
+         : storage(std::make_shared<mat<T>>(1, shape_numel(shape))), offset(0), shape(shape), strides(row_major_strides(shape)) {}
+
+   template <typename T>
+      tensor<T> tensor<T>::from_mat(const mat<T>& m_a)
+      {
+         tensor<T> out({ m_a.get_n_rows(), m_a.get_n_cols() });
+         T* dst = out.data();
+         for ( size_t i = 0; i < m_a.get_n_rows(); ++i )
+            dst = std::copy(m_a.row(i), m_a.row(i) + m_a.get_n_cols(), dst);
+         return out;
+      }
+
+   template <typename T>
+      template <typename Policy>
+         policy_result<Policy, mat<T>> tensor<T>::to_mat() const
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( this->get_rank() != 2 )
+                  return Policy::template failure<mat<T>>({ mat_errc::tensor_rank_mismatch, { this->get_rank() } });
+            }
+
+            mat<T> out(this->shape[0], this->shape[1]);
+            const T* src = this->base();
+            for ( size_t i = 0; i < this->shape[0]; ++i )
+               for ( size_t j = 0; j < this->shape[1]; ++j )
+                  out.row(i)[j] = src[i * this->strides[0] + j * this->strides[1]];
+            return out;
+         }
+
+   template <typename T>
+      size_t tensor<T>::get_numel() const
+      {
+         return shape_numel(this->shape);
+      }
+
+   template <typename T>
+      size_t tensor<T>::offset_of(const std::vector<size_t>& index) const
+      {
+         size_t off = 0;
+         for ( size_t d = 0; d < index.size(); ++d )
+            off += index[d] * this->strides[d];
+         return off;
+      }
+
+   template <typename T>
+      std::optional<mat_error> tensor<T>::index_error(const std::vector<size_t>& index) const
+      {
+         if ( index.size() != this->shape.size() )
+            return mat_error { mat_errc::tensor_index_rank_mismatch };
+         for ( size_t d = 0; d < index.size(); ++d )
+            if ( index[d] >= this->shape[d] )
+               return mat_error { mat_errc::tensor_index_out_of_range };
+         return std::nullopt;
+      }
+
+   template <typename T>
+      template <typename F>
+         void tensor<T>::for_each_offset(F&& fn) const
+         {
+            const size_t rank = this->get_rank();
+            if ( this->get_numel() == 0 )
+               return;
+            if ( rank == 0 )
+            {
+               fn(size_t(0));
+               return;
+            }
+
+            // Odometer over all but the last axis; the last axis is a strided run.
+            std::vector<size_t> idx(rank, 0);
+            const size_t inner = this->shape[rank - 1];
+            const size_t inner_stride = this->strides[rank - 1];
+            size_t off = 0;
+
+            while ( true )
+            {
+               for ( size_t j = 0; j < inner; ++j )
+                  fn(off + j * inner_stride);
+
+               size_t d = rank - 1;
+               while ( d-- > 0 )
+               {
+                  off += this->strides[d];
+                  if ( ++idx[d] < this->shape[d] )
+                     break;
+                  off -= idx[d] * this->strides[d];
+                  idx[d] = 0;
+               }
+               if ( d == size_t(-1) )
+                  return;
+            }
+         }
+
+   template <typename T>
+      void tensor<T>::fill(const T& value)
+      {
+         T* b = this->base();
+         this->for_each_offset([&](size_t off) { b[off] = value; });
+      }
+
+   template <typename T>
+      bool tensor<T>::is_contiguous() const
+      {
+         const std::vector<size_t> dense = row_major_strides(this->shape);
+         for ( size_t d = 0; d < this->shape.size(); ++d )
+            if ( this->shape[d] > 1 && this->strides[d] != dense[d] )
+               return false;
+         return true;
+      }
+
+   template <typename T>
+      template <typename Policy>
+         policy_result<Policy, tensor<T>> tensor<T>::permute(const std::vector<size_t>& axes) const
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( axes.size() != this->get_rank() )
+                  return Policy::template failure<tensor<T>>({ mat_errc::axis_permutation_rank_mismatch });
+
+               std::vector<bool> seen(axes.size(), false);
+               for ( const size_t& axis : axes )
+               {
+                  if ( axis >= axes.size() || seen[axis] )
+                     return Policy::template failure<tensor<T>>({ mat_errc::invalid_axis_permutation });
+                  seen[axis] = true;
+               }
+            }
+
+            tensor<T> out = *this;
+            for ( size_t d = 0; d < axes.size(); ++d )
+            {
+               out.shape[d] = this->shape[axes[d]];
+               out.strides[d] = this->strides[axes[d]];
+            }
+            return out;
+         }
+
+   template <typename T>
+      template <typename Policy>
+         policy_result<Policy, tensor<T>> tensor<T>::slice(const size_t& axis, const size_t& begin, const size_t& end) const
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( axis >= this->get_rank() || begin > end || end > this->shape[axis] )
+                  return Policy::template failure<tensor<T>>({ mat_errc::slice_out_of_range });
+            }
+
+            tensor<T> out = *this;
+            out.offset += begin * this->strides[axis];
+            out.shape[axis] = end - begin;
+            return out;
+         }
+
+   // View of the elements whose indices on axis_a and axis_b are equal. The
+   // merged axis takes the place of axis_a.
+   template <typename T>
+      template <typename Policy>
+         policy_result<Policy, tensor<T>> tensor<T>::diagonal(const size_t& axis_a, const size_t& axis_b) const
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( axis_a >= this->get_rank() || axis_b >= this->get_rank() || axis_a == axis_b )
+                  return Policy::template failure<tensor<T>>({ mat_errc::invalid_diagonal_axes });
+            }
+
+            tensor<T> out = *this;
+            out.shape[axis_a] = std::min(this->shape[axis_a], this->shape[axis_b]);
+            out.strides[axis_a] = this->strides[axis_a] + this->strides[axis_b];
+            out.shape.erase(out.shape.begin() + axis_b);
+            out.strides.erase(out.strides.begin() + axis_b);
+            return out;
+         }
+
+   template <typename T>
+      template <typename Policy>
+         policy_result<Policy, tensor<T>> tensor<T>::reshape(const std::vector<size_t>& new_shape) const
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( shape_numel(new_shape) != this->get_numel() )
+                  return Policy::template failure<tensor<T>>({ mat_errc::reshape_mismatch, { this->get_numel(), shape_numel(new_shape) } });
+            }
+
+            tensor<T> out = this->is_contiguous() ? *this : this->contiguous();
+            out.shape = new_shape;
+            out.strides = row_major_strides(new_shape);
+            return out;
+         }
+
+   template <typename T>
+      tensor<T> tensor<T>::contiguous() const
+      {
+         tensor<T> out(this->shape);
+         T* dst = out.data();
+         const T* src = this->base();
+         this->for_each_offset([&](size_t off) { *dst++ = src[off]; });
+         return out;
+      }
+}
+#endif
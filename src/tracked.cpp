@@ -0,0 +1,211 @@
+#ifndef TRACKED
+#define TRACKED
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "mat.cpp"
+
+namespace lawcat
+{
+   // Mutable rows [first, first + n_rows) of a tracked matrix.
+   template <typename T>
+      struct row_view
+      {
+         T* const* data;
+         size_t n_rows;
+         size_t n_cols;
+
+         T* row(const size_t& i) const { return this->data[i]; }
+         T& operator()(const size_t& i, const size_t& j) const { return this->data[i][j]; }
+      };
+
+   // A matrix that records which row blocks changed, for incremental
+   // checkpoints and recomputation.
+   //
+   // Every mutation stamps the touched blocks with the current epoch. A
+   // consumer remembers the epoch returned by advance() when it last caught up
+   // and later visits only blocks whose version is newer, so any number of
+   // consumers can follow the same matrix at their own pace.
+   //
+   // Writable access through row() and view() marks its rows dirty when the
+   // pointer is handed out, whether or not it is written through.
+   template <typename T>
+      class tracked_mat
+      {
+         public:
+            static constexpr size_t default_block_rows = 256;
+
+            tracked_mat(const size_t& n_rows, const size_t& n_cols, const size_t& block_rows = default_block_rows);
+            explicit tracked_mat(mat<T> m_a, const size_t& block_rows = default_block_rows);
+
+            size_t get_n_rows() const { return this->m.get_n_rows(); }
+            size_t get_n_cols() const { return this->m.get_n_cols(); }
+            size_t get_block_rows() const { return this->block_rows; }
+            size_t get_n_blocks() const { return this->versions.size(); }
+            const T& get(const size_t& row, const size_t& col) const { return this->m.get(row, col); }
+            const T* row(const size_t& i) const { return this->m.row(i); }
+            const mat<T>& value() const { return this->m; }
+
+            // Rows covered by block b, as [first, last).
+            std::pair<size_t, size_t> block_range(const size_t& b) const;
+
+            // Mutations check their arguments per Policy and mark rows only
+            // once the check has passed.
+            template <typename Policy = default_policy>
+               policy_result<Policy> set(const size_t& row, const size_t& col, const T& value);
+            void fill(const T& value);
+            template <typename Policy = default_policy>
+               policy_result<Policy> add_assign(const mat<T>& other);
+            template <typename Policy = default_policy>
+               policy_result<Policy> sub_assign(const mat<T>& other);
+            void operator+=(const mat<T>& other) { this->add_assign(other); }
+            void operator-=(const mat<T>& other) { this->sub_assign(other); }
+            template <typename Policy = default_policy>
+               policy_result<Policy, T*> row(const size_t& i);
+            template <typename Policy = default_policy>
+               policy_result<Policy, row_view<T>> view(const size_t& first, const size_t& count);
+
+            // Epoch currently being written to.
+            uint64_t get_epoch() const { return this->epoch; }
+            uint64_t block_version(const size_t& b) const { return this->versions[b]; }
+
+            // Closes the current epoch and returns it; changes made afterwards
+            // are newer than the returned value.
+            uint64_t advance() { return this->epoch++; }
+
+            // Blocks changed after the epoch `since` was closed. since == 0
+            // selects every block.
+            std::vector<size_t> dirty_blocks(const uint64_t& since) const;
+
+            void mark_rows(const size_t& first, const size_t& last);
+
+         private:
+            mat<T> m;
+            size_t block_rows;
+            uint64_t epoch = 1;
+            std::vector<uint64_t> versions;
+      };
+
+   template <typename T>
+      tracked_mat<T>::tracked_mat(const size_t& n_rows, const size_t& n_cols, const size_t& block_rows)
+         : tracked_mat(mat<T>(n_rows, n_cols), block_rows) {}
+
+   template <typename T>
+      tracked_mat<T>::tracked_mat(mat<T> m_a, const size_t& block_rows)
+         : m(std::move(m_a)), block_rows(block_rows)
+      {
+         if ( block_rows == 0 )
+            default_policy::failure({ mat_errc::nonpositive_size, {}, "Block size" });
+         this->versions.assign((this->m.get_n_rows() + block_rows - 1) / block_rows, this->epoch);
+      }
+
+   template <typename T>
+      std::pair<size_t, size_t> tracked_mat<T>::block_range(const size_t& b) const
+      {
+         const size_t first = b * this->block_rows;
+         return { first, std::min(this->m.get_n_rows(), first + this->block_rows) };
+      }
+
+   template <typename T>
+      void tracked_mat<T>::mark_rows(const size_t& first, const size_t& last)
+      {
+         if ( first >= last )
+            return;
+         for ( size_t b = first / this->block_rows; b <= (last - 1) / this->block_rows; ++b )
+            this->versions[b] = this->epoch;
+      }
+
+   template <typename T>
+      template <typename Policy>
+         policy_result<Policy> tracked_mat<T>::set(const size_t& row, const size_t& col, const T& value)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( row >= this->m.get_n_rows() )
+                  return Policy::template failure<>({ mat_errc::row_out_of_range });
+               if ( col >= this->m.get_n_cols() )
+                  return Policy::template failure<>({ mat_errc::column_out_of_range });
+            }
+
+            this->m.template set<unchecked_policy>(row, col, value);
+            this->versions[row / this->block_rows] = this->epoch;
+            return Policy::success();
+         }
+
+   template <typename T>
+      void tracked_mat<T>::fill(const T& value)
+      {
+         this->m.fill(value);
+         this->mark_rows(0, this->m.get_n_rows());
+      }
+
+   template <typename T>
+      template <typename Policy>
+         policy_result<Policy> tracked_mat<T>::add_assign(const mat<T>& other)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( this->m.get_n_rows() != other.get_n_rows() || this->m.get_n_cols() != other.get_n_cols() )
+                  return Policy::template failure<>({ mat_errc::dimension_mismatch, { this->m.get_n_rows(), this->m.get_n_cols(), other.get_n_rows(), other.get_n_cols() } });
+            }
+
+            this->m.template add_assign<unchecked_policy>(other);
+            this->mark_rows(0, this->m.get_n_rows());
+            return Policy::success();
+         }
+
+   template <typename T>
+      template <typename Policy>
+         policy_result<Policy> tracked_mat<T>::sub_assign(const mat<T>& other)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( this->m.get_n_rows() != other.get_n_rows() || this->m.get_n_cols() != other.get_n_cols() )
+                  return Policy::template failure<>({ mat_errc::dimension_mismatch, { this->m.get_n_rows(), this->m.get_n_cols(), other.get_n_rows(), other.get_n_cols() } });
+            }
+
+            this->m.template sub_assign<unchecked_policy>(other);
+            this->mark_rows(0, this->m.get_n_rows());
+            return Policy::success();
+         }
+
+   template <typename T>
+      template <typename Policy>
+         policy_result<Policy, T*> tracked_mat<T>::row(const size_t& i)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( i >= this->m.get_n_rows() )
+                  return Policy::template failure<T*>({ mat_errc::row_out_of_range });
+            }
+
+            this->versions[i / this->block_rows] = this->epoch;
+            return this->m.row(i);
+         }
+
+   template <typename T>
+      template <typename Policy>
+         policy_result<Policy, row_view<T>> tracked_mat<T>::view(const size_t& first, const size_t& count)
+         {
+            if constexpr ( Policy::checked )
+            {
+               if ( first + count > this->m.get_n_rows() )
+                  return Policy::template failure<row_view<T>>({ mat_errc::view_out_of_range });
+            }
+
+            this->mark_rows(first, first + count);
+            return row_view<T>{ this->m.rows() + first, count, this->m.get_n_cols() };
+         }
+
+   template <typename T>
+      std::vector<size_t> tracked_mat<T>::dirty_blocks(const uint64_t& since) const
+      {
+         std::vector<size_t> out;
+         for ( size_t b = 0; b < this->versions.size(); ++b )
+            if ( this->versions[b] > since )
+               out.push_back(b);
+         return out;
+      }
+}
+#endif